@@ -2,12 +2,14 @@
 
 #include "Constants.hh"
 #include "getInputImageFilenameFilter.hh"
+#include "ImageCache.hh"
 #include "Settings.hh"
 
 #include <QSignalBlocker>
 #include <QtWidgets>
 
 #include <functional>
+#include <utility>
 
 namespace
 {
@@ -16,6 +18,8 @@ namespace
   struct ChannelUi : IChannelUi
   {
     std::shared_ptr<Settings> settings;
+    std::shared_ptr<ImageCache> imageCache;
+    std::function<void()> onChanged;
 
     int outputChannel;
 
@@ -37,8 +41,10 @@ namespace
       QString filename; // might be empty
     } image;
 
-    ChannelUi(int outputChannel, std::shared_ptr<Settings> settings, QWidget *parent)
+    ChannelUi(int outputChannel, std::shared_ptr<Settings> settings, std::shared_ptr<ImageCache> imageCache, std::function<void()> onChanged, QWidget *parent)
       : settings{ settings }
+      , imageCache{ imageCache }
+      , onChanged{ std::move(onChanged) }
       , outputChannel{ outputChannel }
     {
       buildUi(parent);
@@ -83,13 +89,13 @@ namespace
 
         {
           constant.radio = new QRadioButton("constant", mainWidget);
-          QObject::connect(constant.radio, &QRadioButton::clicked, [=](bool checked){ if (checked) setInputSource(InputSource::Constant); });
+          QObject::connect(constant.radio, &QRadioButton::clicked, [=](bool checked){ if (checked) { setInputSource(InputSource::Constant); onChanged(); } });
           grid->addWidget(constant.radio, 0, 1);
 
           constant.value = new QSpinBox(mainWidget);
           constant.value->setRange(0, 255);
           constant.value->setAlignment(Qt::AlignHCenter);
-          QObject::connect(constant.value, QOverload<int>::of(&QSpinBox::valueChanged), [=](int v){ setInputConstant(v); });
+          QObject::connect(constant.value, QOverload<int>::of(&QSpinBox::valueChanged), [=](int v){ setInputConstant(v); onChanged(); });
           grid->addWidget(constant.value, 0, 2);
 
           grid->addWidget(new QLabel("in [0, 255]"), 0, 3);
@@ -97,7 +103,7 @@ namespace
 
         {
           image.radio = new QRadioButton("image", mainWidget);
-          QObject::connect(image.radio, &QRadioButton::clicked, [=](bool checked){ if (checked) setInputSource(InputSource::Image); });
+          QObject::connect(image.radio, &QRadioButton::clicked, [=](bool checked){ if (checked) { setInputSource(InputSource::Image); prefetchImage(); onChanged(); } });
           grid->addWidget(image.radio, 1, 1);
 
           image.buttonFilename = new QPushButton(mainWidget);
@@ -106,11 +112,11 @@ namespace
 
           image.comboInputChannel = new QComboBox(mainWidget);
           image.comboInputChannel->addItems({"red", "green", "blue", "alpha"});
-          QObject::connect(image.comboInputChannel, QOverload<int>::of(&QComboBox::currentIndexChanged), [=](int i){ setInputChannel(i); });
+          QObject::connect(image.comboInputChannel, QOverload<int>::of(&QComboBox::currentIndexChanged), [=](int i){ setInputChannel(i); onChanged(); });
           grid->addWidget(image.comboInputChannel, 2, 2);
 
           image.checkInvert = new QCheckBox("invert image", mainWidget);
-          QObject::connect(image.checkInvert, &QCheckBox::clicked, [=](bool i){ setInputImageInvert(i); });
+          QObject::connect(image.checkInvert, &QCheckBox::clicked, [=](bool i){ setInputImageInvert(i); onChanged(); });
           grid->addWidget(image.checkInvert, 2, 3);
         }
       }
@@ -124,6 +130,18 @@ namespace
       setInputImageFilename(settings->getInputImageFilename(outputChannel), true);
       setInputChannel(settings->getInputChannel(outputChannel), true);
       setInputImageInvert(settings->getInputImageInvert(outputChannel), true);
+      prefetchImage();
+    }
+
+    // starts decoding the selected image in the background so it is ready by the time the user saves
+    void
+    prefetchImage()
+    {
+      if (settings->getInputSource(outputChannel) != InputSource::Image)
+        return;
+
+      if (QString filename = settings->getInputImageFilename(outputChannel); !filename.isEmpty())
+        imageCache->prefetch(filename);
     }
 
     void
@@ -137,6 +155,8 @@ namespace
       settings->setInputDir(QFileInfo(filename).absolutePath());
       setInputImageFilename(filename);
       setInputSource(InputSource::Image);
+      prefetchImage();
+      onChanged();
     }
 
     void
@@ -202,7 +222,7 @@ namespace
 }
 
 std::unique_ptr<IChannelUi>
-makeChannelUi(int outputChannel, std::shared_ptr<Settings> settings, QWidget *parent)
+makeChannelUi(int outputChannel, std::shared_ptr<Settings> settings, std::shared_ptr<ImageCache> imageCache, std::function<void()> onChanged, QWidget *parent)
 {
-  return std::unique_ptr<ChannelUi>{new ChannelUi(outputChannel, settings, parent)};
+  return std::unique_ptr<ChannelUi>{new ChannelUi(outputChannel, settings, imageCache, std::move(onChanged), parent)};
 }
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+
+class ImageCache;
+class QWidget;
+class Settings;
+
+struct IChannelUi
+{
+  virtual ~IChannelUi() {}
+  virtual QWidget *getMainWidget() = 0;
+};
+
+// onChanged is called after the user changes any of the channel's controls, once the settings hold the change
+std::unique_ptr<IChannelUi>
+makeChannelUi(int outputChannel, std::shared_ptr<Settings>, std::shared_ptr<ImageCache>, std::function<void()> onChanged, QWidget *parent);
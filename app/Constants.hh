@@ -5,6 +5,9 @@ namespace Constants
   constexpr int channelNamePointSize = 32;
   constexpr int channelNameMinimumWidth = 50;
   constexpr int saveButtonPointSize = 24;
+  constexpr int saveProgressDelayMs = 300; // saves quicker than this show no progress dialog
+  constexpr int saveProgressIntervalMs = 50;
+  constexpr int previewSize = 320; // the longest side of the preview, in pixels
   constexpr const char *channelNames[4] = {"R", "G", "B", "A"};
   constexpr const char *colorNames[4] = {"Red", "Green", "Blue", "Black"};
 }
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "BlockFormat.hh"
+#include "InputSource.hh"
+#include "Precision.hh"
+#include "PreviewView.hh"
+#include "ResizeMode.hh"
+#include "SaveOptions.hh"
+
+#include <QSize>
+
+namespace Defaults
+{
+  constexpr const char *saveImageFormat = "png (*.png)";
+  constexpr QSize outputSize = {1, 1};
+  constexpr const InputSource inputSource = InputSource::Constant;
+  constexpr const Precision precision = Precision::Uint8;
+  constexpr const PreviewView previewView = PreviewView::Rgb;
+  constexpr bool mipmaps = false;
+  constexpr const ResizeMode resizeMode = ResizeMode::None;
+  constexpr const ResampleFilter resampleFilter = ResampleFilter::Bilinear;
+  constexpr const BlockFormat ddsFormat = BlockFormat::Bc7;
+  constexpr const BlockQuality ddsQuality = BlockQuality::Normal;
+  constexpr int pngLevel = 6;
+  constexpr const PngStrategy pngStrategy = PngStrategy::Default;
+  constexpr bool parallelPng = true;
+  constexpr int lossyQuality = -1;
+  constexpr int imageCacheBudgetMiB = 1024;
+  constexpr int streamingThresholdMiB = 2048;
+  constexpr int bufferPoolMiB = 1024;
+  constexpr bool hugePages = false;
+}
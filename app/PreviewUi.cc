@@ -0,0 +1,233 @@
+#include "PreviewUi.hh"
+
+#include "Constants.hh"
+#include "ImageCache.hh"
+#include "Preview.hh"
+#include "Settings.hh"
+#include "TilePool.hh"
+
+#include <QtWidgets>
+
+#include <map>
+#include <utility>
+
+namespace
+{
+  // Loading one input and reducing it to a thumbnail. Shared with its thread, so it outlives whichever of the two is
+  // done first.
+  struct ThumbnailJob
+  {
+    QString filename;
+    QDateTime modified; // of the file when the job started
+    std::shared_ptr<ImageCache> imageCache;
+    std::shared_ptr<TilePool> pool;
+
+    QImage thumbnail;
+    QString error;
+
+    void
+    run()
+    {
+      // through the cache, so the decoded image is ready for the next save
+      const QImage image = imageCache->get(filename, error);
+      if (image.isNull())
+        return;
+
+      thumbnail = Preview::makeThumbnail(image, Preview::getPreviewSize(image.size(), Constants::previewSize), *pool);
+      if (thumbnail.isNull())
+        error = "Not enough memory for the preview";
+    }
+  };
+
+  struct PreviewUi : IPreviewUi
+  {
+    std::shared_ptr<Settings> settings;
+    std::shared_ptr<ImageCache> imageCache;
+    std::function<std::shared_ptr<TilePool>()> getPool;
+
+    Preview preview;
+    std::map<QString, QDateTime> thumbnailModified; // when each file was last loaded, even if that failed
+    std::map<QString, QString> errors; // by file, from its last load
+    std::map<QString, QThread*> loading; // by file
+
+    QWidget *mainWidget{};
+    QLabel *imageLabel{};
+    QComboBox *comboView{};
+    QLabel *statusLabel{};
+
+    PreviewUi(std::shared_ptr<Settings> settings, std::shared_ptr<ImageCache> imageCache, std::function<std::shared_ptr<TilePool>()> getPool, QWidget *parent)
+      : settings{ settings }
+      , imageCache{ imageCache }
+      , getPool{ std::move(getPool) }
+    {
+      buildUi(parent);
+      update();
+    }
+
+    ~PreviewUi() override
+    {
+      // loads can't be cancelled, but they only hold the thread while one image decodes
+      for (const auto &[filename, thread] : loading)
+        thread->wait();
+    }
+
+    QWidget *getMainWidget() override
+    {
+      return mainWidget;
+    }
+
+    void
+    buildUi(QWidget *parent)
+    {
+      mainWidget = new QWidget(parent);
+      auto layout = new QVBoxLayout(mainWidget);
+
+      imageLabel = new QLabel(mainWidget);
+      imageLabel->setFixedSize(Constants::previewSize, Constants::previewSize);
+      imageLabel->setAlignment(Qt::AlignCenter);
+      layout->addWidget(imageLabel);
+
+      comboView = new QComboBox(mainWidget);
+      comboView->addItems({"RGB", "alpha", "RGBA over checkerboard"});
+      comboView->setCurrentIndex(int(settings->getPreviewView()));
+      QObject::connect(comboView, QOverload<int>::of(&QComboBox::currentIndexChanged), [=](int i){
+        settings->setPreviewView(PreviewView(i));
+        show();
+      });
+      layout->addWidget(comboView);
+
+      statusLabel = new QLabel(mainWidget);
+      statusLabel->setWordWrap(true);
+      statusLabel->setMaximumWidth(Constants::previewSize);
+      layout->addWidget(statusLabel);
+
+      layout->addStretch();
+    }
+
+    void
+    update() override
+    {
+      const CompositionSpec spec = settings->getCompositionSpec();
+
+      // a file that changed on disk is loaded again; until then the preview shows what it had
+      bool missingFilename = false;
+      for (const ChannelSpec &channel : spec.channels)
+      {
+        if (channel.source != InputSource::Image)
+          continue;
+        if (channel.filename.isEmpty())
+        {
+          missingFilename = true;
+          continue;
+        }
+
+        const QDateTime modified = QFileInfo(channel.filename).lastModified();
+        const auto it = thumbnailModified.find(channel.filename);
+        if ((it == thumbnailModified.end() || it->second != modified) && !loading.count(channel.filename))
+          startLoading(channel.filename, modified);
+      }
+
+      const bool complete = preview.update(spec, Preview::getPreviewSize(settings->getOutputSize(), Constants::previewSize));
+      show();
+
+      QString status;
+      for (const ChannelSpec &channel : spec.channels)
+        if (channel.source == InputSource::Image && errors.count(channel.filename))
+          status = "Couldn't load " + QDir::toNativeSeparators(channel.filename) + ": " + errors[channel.filename];
+      if (status.isEmpty() && !loading.empty())
+        status = "Loading...";
+      if (status.isEmpty() && !complete && !missingFilename)
+        status = "The input images differ in size";
+      statusLabel->setText(status);
+    }
+
+    void
+    startLoading(const QString &filename, const QDateTime &modified)
+    {
+      auto job = std::make_shared<ThumbnailJob>();
+      job->filename = filename;
+      job->modified = modified;
+      job->imageCache = imageCache;
+      job->pool = getPool();
+
+      QThread *thread = QThread::create([job]{ job->run(); });
+      thread->setParent(mainWidget);
+      QObject::connect(thread, &QThread::finished, mainWidget, [this, job, thread]{
+        loading.erase(job->filename);
+        thread->deleteLater();
+
+        thumbnailModified[job->filename] = job->modified;
+        if (job->error.isEmpty())
+        {
+          errors.erase(job->filename);
+          preview.setThumbnail(job->filename, job->thumbnail);
+        }
+        else
+          errors[job->filename] = job->error;
+        update();
+      });
+
+      loading[filename] = thread;
+      thread->start();
+    }
+
+    // the preview as the view asks for it; all of these are a pass over the preview's pixels, not the inputs'
+    void
+    show()
+    {
+      const QImage &image = preview.getImage();
+      if (image.isNull())
+      {
+        imageLabel->clear();
+        return;
+      }
+
+      QImage shown;
+      switch (settings->getPreviewView())
+      {
+        case PreviewView::Alpha:
+          shown = QImage(image.size(), QImage::Format_Grayscale8);
+          for (int y = 0; y < image.height(); ++y)
+          {
+            const auto *src = (const QRgb*)image.constScanLine(y);
+            uchar *dst = shown.scanLine(y);
+            for (int x = 0; x < image.width(); ++x)
+              dst[x] = uchar(qAlpha(src[x]));
+          }
+          break;
+
+        case PreviewView::Rgba:
+        {
+          shown = QImage(image.size(), QImage::Format_RGB32);
+          QPainter painter(&shown);
+          constexpr int square = 8;
+          for (int y = 0; y < image.height(); y += square)
+            for (int x = 0; x < image.width(); x += square)
+              painter.fillRect(x, y, square, square, (x / square + y / square) % 2 ? Qt::lightGray : Qt::white);
+          painter.drawImage(0, 0, image);
+          break;
+        }
+
+        default:
+          // the alpha lane only hides the color channels, which are what this view is for
+          shown = QImage(image.size(), QImage::Format_RGB32);
+          for (int y = 0; y < image.height(); ++y)
+          {
+            const auto *src = (const QRgb*)image.constScanLine(y);
+            auto *dst = (QRgb*)shown.scanLine(y);
+            for (int x = 0; x < image.width(); ++x)
+              dst[x] = src[x] | 0xff000000u;
+          }
+          break;
+      }
+
+      imageLabel->setPixmap(QPixmap::fromImage(shown));
+    }
+  };
+}
+
+std::unique_ptr<IPreviewUi>
+makePreviewUi(std::shared_ptr<Settings> settings, std::shared_ptr<ImageCache> imageCache, std::function<std::shared_ptr<TilePool>()> getPool, QWidget *parent)
+{
+  return std::unique_ptr<PreviewUi>{new PreviewUi(settings, imageCache, std::move(getPool), parent)};
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+
+class ImageCache;
+class QWidget;
+class Settings;
+class TilePool;
+
+// A downscaled live preview of the composite, see Preview. Inputs are loaded and reduced to thumbnails on threads of
+// their own; update() after a channel changes only redraws that channel.
+struct IPreviewUi
+{
+  virtual ~IPreviewUi() {}
+  virtual QWidget *getMainWidget() = 0;
+
+  // brings the preview up to date with the settings, loading inputs it hasn't got yet or that changed on disk
+  virtual void update() = 0;
+};
+
+// getPool gives the pool to make thumbnails on, shared with saves
+std::unique_ptr<IPreviewUi>
+makePreviewUi(std::shared_ptr<Settings>, std::shared_ptr<ImageCache>, std::function<std::shared_ptr<TilePool>()> getPool, QWidget *parent);
@@ -0,0 +1,4 @@
+#pragma once
+
+// what the preview pane shows of the composite
+enum class PreviewView { Rgb, Alpha, Rgba, NUM };
@@ -0,0 +1,508 @@
+#include "RgbaComposer.hh"
+#include "ui_RgbaComposer.h"
+
+#include "BufferPool.hh"
+#include "ChannelUi.hh"
+#include "compose.hh"
+#include "Constants.hh"
+#include "getOutputImageFilenameFilter.hh"
+#include "GetImageSizeDialog.hh"
+#include "ImageCache.hh"
+#include "PreviewUi.hh"
+#include "Progress.hh"
+#include "Settings.hh"
+#include "showImageCacheDialog.hh"
+#include "StageLog.hh"
+#include "TilePool.hh"
+
+#include <QDebug>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QtWidgets>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace
+{
+  // One save running in the background. Shared with its thread, so it outlives whichever of the two is done first.
+  struct SaveJob
+  {
+    CompositionSpec spec;
+    SaveOptions saveOptions;
+    QString filename;
+    std::shared_ptr<TilePool> pool;
+    std::shared_ptr<ImageCache> imageCache;
+    std::shared_ptr<BufferPool> bufferPool;
+    qint64 streamingThresholdBytes = 0;
+
+    StageLog stageLog;
+    Progress progress;
+    ComposeResult result;
+    QString saveError;
+
+    void
+    run()
+    {
+      // the images of this save take buffers the ones of earlier saves left, and count them into its log
+      const StageLog::Scope logScope(&stageLog);
+      const BufferPool::Scope bufferScope(bufferPool.get());
+
+      // too big to hold whole, or constants alone, which need no whole image: compose strip by strip straight into the
+      // file
+      if ((!spec.usesImages() || estimateComposeBytes(spec) > streamingThresholdBytes) && canComposeToFile(spec, filename))
+      {
+        result = composeToFile(spec, filename, saveOptions, *pool, &stageLog, &progress);
+        return;
+      }
+
+      result = compose(spec, *pool, *imageCache, &stageLog, &progress);
+      if (result.ok())
+        saveResult(result, filename, saveOptions, *pool, saveError, &stageLog, &progress);
+
+      // written or cancelled, the composite isn't needed anymore; don't hold it until the GUI thread gets round to it
+      result.image = {};
+      result.mipLevels.clear();
+    }
+  };
+
+  struct Private
+  {
+    std::shared_ptr<Settings> settings = std::make_unique<Settings>();
+    std::unique_ptr<IChannelUi> channelUis[4]; // RGBA
+    std::shared_ptr<TilePool> pool;
+    std::shared_ptr<BufferPool> bufferPool = std::make_shared<BufferPool>(qint64(settings->getBufferPoolMiB()) * 1024 * 1024, settings->getHugePages());
+    // inputs are decoded on prefetch and preview threads too, so the loader draws from the buffer pool itself
+    std::shared_ptr<ImageCache> imageCache = std::make_shared<ImageCache>([bufferPool = bufferPool](const QString &filename, QString &error){
+      const BufferPool::Scope bufferScope(bufferPool.get());
+      return loadInputImage(filename, error);
+    }, qint64(settings->getImageCacheBudgetMiB()) * 1024 * 1024);
+    std::unique_ptr<IPreviewUi> previewUi;
+    QPushButton *saveButton = nullptr;
+    QStatusBar *statusBar = nullptr;
+
+    // while a save is running
+    std::shared_ptr<SaveJob> saveJob;
+    QThread *saveThread = nullptr;
+
+    ~Private()
+    {
+      // don't leave a save running behind a closed window
+      if (saveThread)
+      {
+        saveJob->progress.cancel();
+        saveThread->wait();
+      }
+    }
+
+    void
+    onButtonSave(QWidget *parent)
+    {
+      CompositionSpec spec = settings->getCompositionSpec();
+
+      // without input images there is nothing to take the size from, so ask the user what size to make the output image
+      if (!spec.usesImages() && !(spec.size = getImageSizeFromUser(parent)))
+        return;
+
+      // asked before anything else so that the rest runs without the user
+      QString filename = getOutputFilenameFromUser(parent);
+      if (filename.isEmpty())
+        return;
+
+      auto job = std::make_shared<SaveJob>();
+      job->spec = std::move(spec);
+      job->spec.saveFormat = getSaveFormat(filename);
+      job->saveOptions = settings->getSaveOptions();
+      job->filename = filename;
+      job->pool = getPool();
+      job->imageCache = imageCache;
+      job->bufferPool = bufferPool;
+      job->streamingThresholdBytes = qint64(settings->getStreamingThresholdMiB()) * 1024 * 1024;
+
+      auto progressDialog = new QProgressDialog("Saving " + QDir::toNativeSeparators(filename), "Cancel", 0, 0, parent);
+      progressDialog->setWindowModality(Qt::WindowModal);
+      progressDialog->setAutoReset(false);
+      progressDialog->setAutoClose(false);
+
+      auto progressTimer = new QTimer(progressDialog);
+      QObject::connect(progressTimer, &QTimer::timeout, [progressDialog, job]{ showProgress(*progressDialog, *job); });
+      QObject::connect(progressDialog, &QProgressDialog::canceled, [progressTimer, job]{
+        progressTimer->stop();
+        job->progress.cancel();
+      });
+      progressTimer->start(Constants::saveProgressIntervalMs);
+
+      // only bother the user with a dialog if the save takes a while
+      QTimer::singleShot(Constants::saveProgressDelayMs, progressDialog, [progressDialog]{
+        if (!progressDialog->wasCanceled())
+          progressDialog->show();
+      });
+
+      saveJob = job;
+      saveThread = QThread::create([job]{ job->run(); });
+      saveThread->setParent(parent);
+      QObject::connect(saveThread, &QThread::finished, parent, [this, parent, progressDialog]{
+        delete progressDialog;
+        onSaveFinished(parent);
+      });
+
+      saveButton->setEnabled(false);
+      saveThread->start();
+    }
+
+    void
+    onActionThreads(QWidget *parent)
+    {
+      bool ok = false;
+      int threadCount = QInputDialog::getInt(parent, "Worker threads", "Threads used to compose images (0 = one per CPU core):", settings->getThreadCount(), 0, 1024, 1, &ok);
+      if (ok)
+        settings->setThreadCount(threadCount);
+    }
+
+    void
+    onActionImageCache(QWidget *parent)
+    {
+      showImageCacheDialog(imageCache, settings, parent);
+    }
+
+    void
+    onActionImageBuffers(QWidget *parent)
+    {
+      bool ok = false;
+      int poolMiB = QInputDialog::getInt(parent, "Image buffers", "Memory kept for the images of later saves once a save is done with it (MiB, 0 = none):", settings->getBufferPoolMiB(), 0, 1024 * 1024, 256, &ok);
+      if (ok)
+      {
+        settings->setBufferPoolMiB(poolMiB);
+        bufferPool->setRetainBytes(qint64(poolMiB) * 1024 * 1024);
+      }
+    }
+
+    void
+    onActionHugePages(bool hugePages)
+    {
+      settings->setHugePages(hugePages);
+      bufferPool->setHugePages(hugePages);
+    }
+
+    void
+    onActionStreaming(QWidget *parent)
+    {
+      bool ok = false;
+      int thresholdMiB = QInputDialog::getInt(parent, "Streaming", "Compose PNG and PPM images strip by strip, straight into the file, once they would take more memory than this (MiB):", settings->getStreamingThresholdMiB(), 0, 1024 * 1024, 256, &ok);
+      if (ok)
+        settings->setStreamingThresholdMiB(thresholdMiB);
+    }
+
+    void
+    onActionLossyQuality(QWidget *parent)
+    {
+      bool ok = false;
+      int quality = QInputDialog::getInt(parent, "Lossy quality", "Quality of JPEG and WebP images, 0 to 100 (-1 = the format's default):", settings->getLossyQuality(), -1, 100, 1, &ok);
+      if (ok)
+        settings->setLossyQuality(quality);
+    }
+
+    // a given size is asked for each time it is chosen; cancelling keeps the mode there was, whose action is in
+    // actions by mode
+    void
+    onActionResize(QWidget *parent, ResizeMode mode, const std::vector<QAction*> &actions)
+    {
+      if (mode == ResizeMode::Explicit)
+      {
+        auto dialog = std::make_unique<GetImageSizeDialog>("What image size?", "Input images of other sizes will be resampled to this size.", settings->getOutputSize(), parent);
+        auto maybeSize = dialog->getImageSizeModal();
+        if (!maybeSize)
+        {
+          actions[size_t(settings->getResizeMode())]->setChecked(true);
+          return;
+        }
+        settings->setOutputSize(*maybeSize);
+      }
+      settings->setResizeMode(mode);
+      previewUi->update();
+    }
+
+    void
+    onActionStageLog(QWidget *parent, QAction *action)
+    {
+      QString filename;
+      if (action->isChecked())
+      {
+        filename = QFileDialog::getSaveFileName(parent, "Stage log file", settings->getStageLogFile(), "JSON Lines (*.jsonl);;All files (*)", nullptr, QFileDialog::DontConfirmOverwrite);
+        action->setChecked(!filename.isEmpty());
+      }
+      settings->setStageLogFile(filename);
+    }
+
+    // (re)creates the pool if the configured thread count changed since it was made; a save still running keeps the old one
+    std::shared_ptr<TilePool>
+    getPool()
+    {
+      if (!pool || pool->getThreadCount() != TilePool::resolveThreadCount(settings->getThreadCount()))
+        pool = std::make_shared<TilePool>(settings->getThreadCount());
+      return pool;
+    }
+
+  private:
+
+    std::optional<QSize>
+    getImageSizeFromUser(QWidget *parent)
+    {
+      auto dialog = std::make_unique<GetImageSizeDialog>("What image size?", "Since no input images were selected, you must tell me what size to make the output image.", settings->getOutputSize(), parent);
+      auto maybeSize = dialog->getImageSizeModal();
+      if (maybeSize)
+        settings->setOutputSize(*maybeSize);
+      return maybeSize;
+    }
+
+    QString
+    getOutputFilenameFromUser(QWidget *parent)
+    {
+      QString outputFormat = settings->getOutputFormat();
+      QString filename = QFileDialog::getSaveFileName(parent, "Composite image output filename", settings->getOutputDir(), getOutputImageFilenameFilter(), &outputFormat);
+      if (!filename.isEmpty())
+      {
+        settings->setOutputDir(QFileInfo(filename).absolutePath());
+        settings->setOutputFormat(outputFormat);
+      }
+      return filename;
+    }
+
+    // progress dialogs take ints, so this goes by permille of the current stage
+    static void
+    showProgress(QProgressDialog &dialog, const SaveJob &job)
+    {
+      const Progress::State state = job.progress.getState();
+      dialog.setLabelText("Saving " + QDir::toNativeSeparators(job.filename) + "\n" + state.stage + "...");
+      if (state.total > 0)
+      {
+        dialog.setRange(0, 1000);
+        dialog.setValue(int(std::min<qint64>(1000, state.done * 1000 / state.total)));
+      }
+      else
+        dialog.setRange(0, 0); // busy indicator
+    }
+
+    void
+    onSaveFinished(QWidget *parent)
+    {
+      std::shared_ptr<SaveJob> job = std::exchange(saveJob, {});
+      saveThread->deleteLater();
+      saveThread = nullptr;
+      saveButton->setEnabled(true);
+
+      if (job->progress.isCancelled())
+      {
+        statusBar->showMessage("Save cancelled");
+        statusBar->setToolTip({});
+        return;
+      }
+
+      reportStages(job->stageLog, job->filename);
+
+      if (!job->result.ok())
+        QMessageBox::critical(parent, job->result.errorTitle, job->result.errorText);
+      else if (!job->saveError.isEmpty())
+        QMessageBox::critical(parent, "Error saving image file", "Couldn't save image to file " + QDir::toNativeSeparators(job->filename) + "\n\n" + job->saveError);
+    }
+
+    // shows where the time of a save went in the status bar (per stage in its tooltip) and appends it to the stage log file, if one is set;
+    // peak memory and page faults are the process's so far, not the save's alone
+    void
+    reportStages(const StageLog &stageLog, const QString &filename)
+    {
+      const ProcessMemory memory = getProcessMemory();
+      const QString memoryText = QString("peak RSS %1 MiB, %2 page faults").arg(memory.peakResidentBytes / (1024 * 1024)).arg(memory.pageFaults);
+      QString summary = stageLog.toSummary() + ", " + memoryText;
+
+      if (QString logFile = settings->getStageLogFile(); !logFile.isEmpty())
+      {
+        QString error;
+        if (!stageLog.appendToFile(logFile, {{"output", filename}, {"date", QDateTime::currentDateTime().toString(Qt::ISODate)},
+                                             {"peakResidentBytes", double(memory.peakResidentBytes)}, {"pageFaults", double(memory.pageFaults)}}, error))
+          summary += " (couldn't write stage log: " + error + ")";
+      }
+
+      const BufferPool::Stats buffers = bufferPool->getStats();
+      statusBar->showMessage(summary);
+      statusBar->setToolTip(stageLog.toText() + QString("\n%1\nbuffer pool: %2 MiB held, %3 MiB in use").arg(memoryText).arg(buffers.heldBytes / (1024 * 1024)).arg(buffers.usedBytes / (1024 * 1024)));
+    }
+  };
+} // namespace
+
+struct RgbaComposer::Private : public ::Private {};
+
+RgbaComposer::RgbaComposer(QWidget *parent)
+  : QMainWindow(parent)
+  , ui(new Ui::RgbaComposer)
+  , p{new Private}
+{
+  ui->setupUi(this);
+  setupUi();
+}
+
+RgbaComposer::~RgbaComposer()
+{
+  delete p;
+  delete ui;
+}
+
+void RgbaComposer::setupUi()
+{
+  auto mainWidget = new QWidget(this);
+  auto mainLayout = new QHBoxLayout(mainWidget);
+  auto channelsLayout = new QVBoxLayout;
+  mainLayout->addLayout(channelsLayout);
+
+  setCentralWidget(mainWidget);
+
+  // RGBA input widgets, each redrawing its lane of the preview when it changes
+  for (int outputChannel : {0, 1, 2, 3})
+  {
+    auto ui = makeChannelUi(outputChannel, p->settings, p->imageCache, [this]{ p->previewUi->update(); }, mainWidget);
+    channelsLayout->addWidget(ui->getMainWidget());
+    p->channelUis[outputChannel] = std::move(ui);
+  }
+
+  p->previewUi = makePreviewUi(p->settings, p->imageCache, [this]{ return p->getPool(); }, mainWidget);
+  mainLayout->addWidget(p->previewUi->getMainWidget());
+
+  {
+    auto optionsMenu = menuBar()->addMenu("&Options");
+    auto threadsAction = optionsMenu->addAction("Worker threads...");
+    QObject::connect(threadsAction, &QAction::triggered, [this](bool){ p->onActionThreads(this); });
+    auto imageCacheAction = optionsMenu->addAction("Image cache...");
+    QObject::connect(imageCacheAction, &QAction::triggered, [this](bool){ p->onActionImageCache(this); });
+    auto imageBuffersAction = optionsMenu->addAction("Image buffers...");
+    QObject::connect(imageBuffersAction, &QAction::triggered, [this](bool){ p->onActionImageBuffers(this); });
+    // on Linux, advised to the kernel's transparent huge pages; elsewhere ignored
+    auto hugePagesAction = optionsMenu->addAction("Huge pages for image buffers");
+    hugePagesAction->setCheckable(true);
+    hugePagesAction->setChecked(p->settings->getHugePages());
+    QObject::connect(hugePagesAction, &QAction::triggered, [this](bool checked){ p->onActionHugePages(checked); });
+    auto streamingAction = optionsMenu->addAction("Streaming...");
+    QObject::connect(streamingAction, &QAction::triggered, [this](bool){ p->onActionStreaming(this); });
+
+    // bits per channel of the saved image; 16-bit and float keep the precision of such inputs
+    auto precisionMenu = optionsMenu->addMenu("Precision");
+    auto precisionGroup = new QActionGroup(precisionMenu);
+    const std::pair<Precision, const char *> precisions[] = {{Precision::Uint8, "8 bits per channel"}, {Precision::Uint16, "16 bits per channel"}, {Precision::Float32, "32-bit float per channel"}};
+    for (const auto &[precision, name] : precisions)
+    {
+      auto action = precisionMenu->addAction(name);
+      action->setCheckable(true);
+      action->setChecked(p->settings->getPrecision() == precision);
+      precisionGroup->addAction(action);
+      QObject::connect(action, &QAction::triggered, [this, precision = precision](bool){ p->settings->setPrecision(precision); });
+    }
+    auto mipmapsAction = optionsMenu->addAction("Save mipmaps");
+    mipmapsAction->setCheckable(true);
+    mipmapsAction->setChecked(p->settings->getMipmaps());
+    QObject::connect(mipmapsAction, &QAction::triggered, [this](bool checked){ p->settings->setMipmaps(checked); });
+
+    // inputs of different sizes are an error unless they are resampled to one
+    auto resizeMenu = optionsMenu->addMenu("Resize inputs");
+    auto resizeGroup = new QActionGroup(resizeMenu);
+    const std::pair<ResizeMode, const char *> resizeModes[] = {{ResizeMode::None, "Don't resize"}, {ResizeMode::Largest, "To the largest input"}, {ResizeMode::Smallest, "To the smallest input"}, {ResizeMode::Explicit, "To a given size..."}};
+    std::vector<QAction*> resizeActions;
+    for (const auto &[mode, name] : resizeModes)
+    {
+      auto action = resizeMenu->addAction(name);
+      action->setCheckable(true);
+      action->setChecked(p->settings->getResizeMode() == mode);
+      resizeGroup->addAction(action);
+      resizeActions.push_back(action);
+    }
+    for (size_t i = 0; i < resizeActions.size(); ++i)
+      QObject::connect(resizeActions[i], &QAction::triggered, [this, mode = resizeModes[i].first, resizeActions](bool){ p->onActionResize(this, mode, resizeActions); });
+    auto filterMenu = optionsMenu->addMenu("Resampling filter");
+    auto filterGroup = new QActionGroup(filterMenu);
+    const std::pair<ResampleFilter, const char *> filters[] = {{ResampleFilter::Nearest, "Nearest"}, {ResampleFilter::Bilinear, "Bilinear"}, {ResampleFilter::Lanczos3, "Lanczos"}};
+    for (const auto &[filter, name] : filters)
+    {
+      auto action = filterMenu->addAction(name);
+      action->setCheckable(true);
+      action->setChecked(p->settings->getResampleFilter() == filter);
+      filterGroup->addAction(action);
+      QObject::connect(action, &QAction::triggered, [this, filter = filter](bool){
+        p->settings->setResampleFilter(filter);
+        p->previewUi->update();
+      });
+    }
+
+    // presets of zlib level and strategy for PNG, from quick iterations to final files
+    auto pngMenu = optionsMenu->addMenu("PNG compression");
+    auto pngGroup = new QActionGroup(pngMenu);
+    const std::tuple<int, PngStrategy, const char *> pngPresets[] = {{1, PngStrategy::Rle, "Fastest (level 1, RLE)"}, {6, PngStrategy::Default, "Default (level 6)"}, {9, PngStrategy::Default, "Smallest (level 9)"}};
+    for (const auto &[level, strategy, name] : pngPresets)
+    {
+      auto action = pngMenu->addAction(name);
+      action->setCheckable(true);
+      action->setChecked(p->settings->getPngLevel() == level && p->settings->getPngStrategy() == strategy);
+      pngGroup->addAction(action);
+      QObject::connect(action, &QAction::triggered, [this, level = level, strategy = strategy](bool){
+        p->settings->setPngLevel(level);
+        p->settings->setPngStrategy(strategy);
+      });
+    }
+    pngMenu->addSeparator();
+    auto parallelPngAction = pngMenu->addAction("Deflate on all threads");
+    parallelPngAction->setCheckable(true);
+    parallelPngAction->setChecked(p->settings->getParallelPng());
+    QObject::connect(parallelPngAction, &QAction::triggered, [this](bool checked){ p->settings->setParallelPng(checked); });
+    auto lossyQualityAction = optionsMenu->addAction("Lossy quality...");
+    QObject::connect(lossyQualityAction, &QAction::triggered, [this](bool){ p->onActionLossyQuality(this); });
+
+    // how .dds outputs are block-compressed
+    auto ddsFormatMenu = optionsMenu->addMenu("DDS compression");
+    auto ddsFormatGroup = new QActionGroup(ddsFormatMenu);
+    const std::pair<BlockFormat, const char *> ddsFormats[] = {{BlockFormat::Bc7, "BC7 (RGBA)"}, {BlockFormat::Bc5, "BC5 (red and green)"}, {BlockFormat::Bc4, "BC4 (red)"}};
+    for (const auto &[format, name] : ddsFormats)
+    {
+      auto action = ddsFormatMenu->addAction(name);
+      action->setCheckable(true);
+      action->setChecked(p->settings->getDdsFormat() == format);
+      ddsFormatGroup->addAction(action);
+      QObject::connect(action, &QAction::triggered, [this, format = format](bool){ p->settings->setDdsFormat(format); });
+    }
+    auto ddsQualityMenu = optionsMenu->addMenu("DDS quality");
+    auto ddsQualityGroup = new QActionGroup(ddsQualityMenu);
+    const std::pair<BlockQuality, const char *> ddsQualities[] = {{BlockQuality::Fast, "Fast"}, {BlockQuality::Normal, "Normal"}, {BlockQuality::Best, "Best"}};
+    for (const auto &[quality, name] : ddsQualities)
+    {
+      auto action = ddsQualityMenu->addAction(name);
+      action->setCheckable(true);
+      action->setChecked(p->settings->getDdsQuality() == quality);
+      ddsQualityGroup->addAction(action);
+      QObject::connect(action, &QAction::triggered, [this, quality = quality](bool){ p->settings->setDdsQuality(quality); });
+    }
+    auto stageLogAction = optionsMenu->addAction("Write stage log...");
+    stageLogAction->setCheckable(true);
+    stageLogAction->setChecked(!p->settings->getStageLogFile().isEmpty());
+    QObject::connect(stageLogAction, &QAction::triggered, [this, stageLogAction](bool){ p->onActionStageLog(this, stageLogAction); });
+  }
+
+  // timings of the last save
+  p->statusBar = statusBar();
+
+  {
+    auto saveButton = p->saveButton = new QPushButton("Save Composite Image...", mainWidget);
+
+    auto font = saveButton->font();
+    font.setPointSize(Constants::saveButtonPointSize);
+    saveButton->setFont(font);
+
+    QObject::connect(saveButton, &QPushButton::clicked, [this](bool){ p->onButtonSave(this); });
+
+    channelsLayout->addWidget(saveButton);
+  }
+
+  adjustSize();
+  setMinimumHeight(size().height());
+  setMaximumHeight(size().height());
+}
@@ -0,0 +1,457 @@
+#pragma once
+
+#include "CompositionSpec.hh"
+#include "Defaults.hh"
+#include "InputSource.hh"
+#include "Precision.hh"
+#include "PreviewView.hh"
+#include "ResizeMode.hh"
+#include "SaveOptions.hh"
+
+#include <QDir>
+#include <QSettings>
+
+#include <algorithm>
+
+class Settings
+{
+  QSettings settings;
+
+  struct Keys
+  {
+    static constexpr const char
+    *bufferPoolMiB = "bufferPoolMiB",
+    *ddsFormat = "ddsFormat",
+    *ddsQuality = "ddsQuality",
+    *filename = "filename",
+    *hugePages = "hugePages",
+    *imageCacheBudgetMiB = "imageCacheBudgetMiB",
+    *inputDir = "inputDir",
+    *lossyQuality = "lossyQuality",
+    *mipmaps = "mipmaps",
+    *outputChannel = "outputChannel",
+    *outputDir = "outputDir",
+    *outputFormat = "outputFormat",
+    *outputSize = "outputSize",
+    *parallelPng = "parallelPng",
+    *pngLevel = "pngLevel",
+    *pngStrategy = "pngStrategy",
+    *precision = "precision",
+    *previewView = "previewView",
+    *resampleFilter = "resampleFilter",
+    *resizeMode = "resizeMode",
+    *stageLogFile = "stageLogFile",
+    *streamingThresholdMiB = "streamingThresholdMiB",
+    *threadCount = "threadCount";
+
+    struct PerOutputChannel
+    {
+      static constexpr const char
+      *constantValue = "constantValue",
+      *inputChannel = "inputChannel",
+      *inputImageFilename = "inputImageFilename",
+      *inputImageInvert = "inputImageInvert",
+      *inputSource = "inputSource";
+    } perOutputChannel;
+  } keys;
+
+  QString
+  getPerOutputChannelPrefix(int outputChannel) const
+  {
+    return QString("%1_%2/").arg(keys.outputChannel).arg(outputChannel);
+  }
+
+public:
+
+  CompositionSpec
+  getCompositionSpec()
+  {
+    CompositionSpec spec;
+    for (int outputChannel : {0, 1, 2, 3})
+    {
+      ChannelSpec &channel = spec.channels[outputChannel];
+      channel.source = getInputSource(outputChannel);
+      channel.constant = getInputConstant(outputChannel);
+      channel.filename = getInputImageFilename(outputChannel);
+      channel.inputChannel = getInputChannel(outputChannel);
+      channel.invert = getInputImageInvert(outputChannel);
+    }
+    spec.resize = getResizeMode();
+    spec.filter = getResampleFilter();
+    if (spec.resize == ResizeMode::Explicit)
+      spec.size = getOutputSize();
+    spec.precision = getPrecision();
+    spec.mipmaps = getMipmaps();
+    return spec;
+  }
+
+  SaveOptions
+  getSaveOptions() const
+  {
+    SaveOptions options;
+    options.pngLevel = getPngLevel();
+    options.pngStrategy = getPngStrategy();
+    options.parallelPng = getParallelPng();
+    options.quality = getLossyQuality();
+    options.ddsFormat = getDdsFormat();
+    options.ddsQuality = getDdsQuality();
+    return options;
+  }
+
+  // image buffers kept for later saves once their images are done
+  int
+  getBufferPoolMiB() const
+  {
+    return std::max(0, settings.value(keys.bufferPoolMiB, Defaults::bufferPoolMiB).toInt());
+  }
+
+  void
+  setBufferPoolMiB(int poolMiB)
+  {
+    settings.setValue(keys.bufferPoolMiB, poolMiB);
+  }
+
+  BlockFormat
+  getDdsFormat() const
+  {
+    unsigned rawValue = settings.value(keys.ddsFormat, (unsigned)Defaults::ddsFormat).toUInt();
+    if (rawValue >= (unsigned)BlockFormat::NUM)
+      rawValue = (unsigned)Defaults::ddsFormat;
+    return (BlockFormat)rawValue;
+  }
+
+  void
+  setDdsFormat(BlockFormat format)
+  {
+    settings.setValue(keys.ddsFormat, (unsigned)format);
+  }
+
+  BlockQuality
+  getDdsQuality() const
+  {
+    unsigned rawValue = settings.value(keys.ddsQuality, (unsigned)Defaults::ddsQuality).toUInt();
+    if (rawValue >= (unsigned)BlockQuality::NUM)
+      rawValue = (unsigned)Defaults::ddsQuality;
+    return (BlockQuality)rawValue;
+  }
+
+  void
+  setDdsQuality(BlockQuality quality)
+  {
+    settings.setValue(keys.ddsQuality, (unsigned)quality);
+  }
+
+  int
+  getInputChannel(int outputChannel) const
+  {
+    int inputChannel = settings.value(getPerOutputChannelPrefix(outputChannel) + keys.perOutputChannel.inputChannel, 0).toInt();
+    if (inputChannel < 0 || inputChannel >= 4)
+      inputChannel = 0;
+    return inputChannel;
+  }
+
+  void
+  setInputChannel(int outputChannel, int inputChannel)
+  {
+    settings.setValue(getPerOutputChannelPrefix(outputChannel) + keys.perOutputChannel.inputChannel, inputChannel);
+  }
+
+  quint8
+  getInputConstant(int outputChannel)
+  {
+    return settings.value(getPerOutputChannelPrefix(outputChannel) + keys.perOutputChannel.constantValue, 0).toUInt();
+  }
+
+  void
+  setInputConstant(int outputChannel, quint8 constant)
+  {
+    settings.setValue(getPerOutputChannelPrefix(outputChannel) + keys.perOutputChannel.constantValue, constant);
+  }
+
+  // whether big image buffers are advised to be backed by huge pages
+  bool
+  getHugePages() const
+  {
+    return settings.value(keys.hugePages, Defaults::hugePages).toBool();
+  }
+
+  void
+  setHugePages(bool hugePages)
+  {
+    settings.setValue(keys.hugePages, hugePages);
+  }
+
+  int
+  getImageCacheBudgetMiB() const
+  {
+    return std::max(0, settings.value(keys.imageCacheBudgetMiB, Defaults::imageCacheBudgetMiB).toInt());
+  }
+
+  void
+  setImageCacheBudgetMiB(int budgetMiB)
+  {
+    settings.setValue(keys.imageCacheBudgetMiB, budgetMiB);
+  }
+
+  QString
+  getInputDir() const
+  {
+    if (settings.contains(keys.inputDir))
+      if (QString inputDir = settings.value(keys.inputDir).toString(); QDir(inputDir).exists())
+        return inputDir;
+
+    return QDir::rootPath();
+  }
+
+  void
+  setInputDir(QString inputDir)
+  {
+    settings.setValue(keys.inputDir, inputDir);
+  }
+
+  QString
+  getInputImageFilename(int outputChannel)
+  {
+    return settings.value(getPerOutputChannelPrefix(outputChannel) + keys.perOutputChannel.inputImageFilename, QString()).toString();
+  }
+
+  void
+  setInputImageFilename(int outputChannel, QString filename)
+  {
+    settings.setValue(getPerOutputChannelPrefix(outputChannel) + keys.perOutputChannel.inputImageFilename, filename);
+  }
+
+  bool
+  getInputImageInvert(int outputChannel)
+  {
+    return settings.value(getPerOutputChannelPrefix(outputChannel) + keys.perOutputChannel.inputImageInvert, false).toBool();
+  }
+
+  void
+  setInputImageInvert(int outputChannel, bool invert)
+  {
+    settings.setValue(getPerOutputChannelPrefix(outputChannel) + keys.perOutputChannel.inputImageInvert, invert);
+  }
+
+  InputSource
+  getInputSource(int outputChannel) const
+  {
+    unsigned rawValue = settings.value(getPerOutputChannelPrefix(outputChannel) + keys.perOutputChannel.inputSource, (unsigned)Defaults::inputSource).toUInt();
+    if (rawValue >= (unsigned)InputSource::NUM)
+      rawValue = (unsigned)Defaults::inputSource;
+    return (InputSource)rawValue;
+  }
+
+  void
+  setInputSource(int outputChannel, InputSource inputSource)
+  {
+    settings.setValue(getPerOutputChannelPrefix(outputChannel) + keys.perOutputChannel.inputSource,  (unsigned)inputSource);
+  }
+
+  // whether the mip levels are saved next to the output
+  bool
+  getMipmaps() const
+  {
+    return settings.value(keys.mipmaps, Defaults::mipmaps).toBool();
+  }
+
+  void
+  setMipmaps(bool mipmaps)
+  {
+    settings.setValue(keys.mipmaps, mipmaps);
+  }
+
+  // for JPEG and WebP, 0 to 100; -1 means the writer's default
+  int
+  getLossyQuality() const
+  {
+    return std::clamp(settings.value(keys.lossyQuality, Defaults::lossyQuality).toInt(), -1, 100);
+  }
+
+  void
+  setLossyQuality(int quality)
+  {
+    settings.setValue(keys.lossyQuality, quality);
+  }
+
+  QString
+  getOutputDir() const
+  {
+    if (settings.contains(keys.outputDir))
+      if (QString outputDir = settings.value(keys.outputDir).toString(); QDir(outputDir).exists())
+        return outputDir;
+
+    return getInputDir();
+  }
+
+  void
+  setOutputDir(QString outputDir)
+  {
+    settings.setValue(keys.outputDir, outputDir);
+  }
+
+  QString
+  getOutputFormat() const
+  {
+    return settings.value(keys.outputFormat, Defaults::saveImageFormat).toString();
+  }
+
+  void
+  setOutputFormat(QString outputFormat)
+  {
+    settings.setValue(keys.outputFormat, outputFormat);
+  }
+
+  QSize
+  getOutputSize() const
+  {
+    return settings.value(keys.outputSize, Defaults::outputSize).toSize();
+  }
+
+  void
+  setOutputSize(QSize outputSize)
+  {
+    settings.setValue(keys.outputSize, outputSize);
+  }
+
+  // whether PNGs are deflated in chunks on all threads rather than by QImageWriter
+  bool
+  getParallelPng() const
+  {
+    return settings.value(keys.parallelPng, Defaults::parallelPng).toBool();
+  }
+
+  void
+  setParallelPng(bool parallelPng)
+  {
+    settings.setValue(keys.parallelPng, parallelPng);
+  }
+
+  // zlib's, from 0 (stored) to 9 (smallest)
+  int
+  getPngLevel() const
+  {
+    return std::clamp(settings.value(keys.pngLevel, Defaults::pngLevel).toInt(), 0, 9);
+  }
+
+  void
+  setPngLevel(int level)
+  {
+    settings.setValue(keys.pngLevel, level);
+  }
+
+  PngStrategy
+  getPngStrategy() const
+  {
+    unsigned rawValue = settings.value(keys.pngStrategy, (unsigned)Defaults::pngStrategy).toUInt();
+    if (rawValue >= (unsigned)PngStrategy::NUM)
+      rawValue = (unsigned)Defaults::pngStrategy;
+    return (PngStrategy)rawValue;
+  }
+
+  void
+  setPngStrategy(PngStrategy strategy)
+  {
+    settings.setValue(keys.pngStrategy, (unsigned)strategy);
+  }
+
+  Precision
+  getPrecision() const
+  {
+    unsigned rawValue = settings.value(keys.precision, (unsigned)Defaults::precision).toUInt();
+    if (rawValue >= (unsigned)Precision::NUM)
+      rawValue = (unsigned)Defaults::precision;
+    return (Precision)rawValue;
+  }
+
+  void
+  setPrecision(Precision precision)
+  {
+    settings.setValue(keys.precision, (unsigned)precision);
+  }
+
+  PreviewView
+  getPreviewView() const
+  {
+    unsigned rawValue = settings.value(keys.previewView, (unsigned)Defaults::previewView).toUInt();
+    if (rawValue >= (unsigned)PreviewView::NUM)
+      rawValue = (unsigned)Defaults::previewView;
+    return (PreviewView)rawValue;
+  }
+
+  void
+  setPreviewView(PreviewView view)
+  {
+    settings.setValue(keys.previewView, (unsigned)view);
+  }
+
+  ResampleFilter
+  getResampleFilter() const
+  {
+    unsigned rawValue = settings.value(keys.resampleFilter, (unsigned)Defaults::resampleFilter).toUInt();
+    if (rawValue >= (unsigned)ResampleFilter::NUM)
+      rawValue = (unsigned)Defaults::resampleFilter;
+    return (ResampleFilter)rawValue;
+  }
+
+  void
+  setResampleFilter(ResampleFilter filter)
+  {
+    settings.setValue(keys.resampleFilter, (unsigned)filter);
+  }
+
+  // what inputs of different sizes are resampled to; ResizeMode::Explicit takes the output size
+  ResizeMode
+  getResizeMode() const
+  {
+    unsigned rawValue = settings.value(keys.resizeMode, (unsigned)Defaults::resizeMode).toUInt();
+    if (rawValue >= (unsigned)ResizeMode::NUM)
+      rawValue = (unsigned)Defaults::resizeMode;
+    return (ResizeMode)rawValue;
+  }
+
+  void
+  setResizeMode(ResizeMode mode)
+  {
+    settings.setValue(keys.resizeMode, (unsigned)mode);
+  }
+
+  // empty means no stage log is written
+  QString
+  getStageLogFile() const
+  {
+    return settings.value(keys.stageLogFile, QString()).toString();
+  }
+
+  void
+  setStageLogFile(QString stageLogFile)
+  {
+    settings.setValue(keys.stageLogFile, stageLogFile);
+  }
+
+  // images whose composition would hold more than this are streamed if their formats allow
+  int
+  getStreamingThresholdMiB() const
+  {
+    return std::max(0, settings.value(keys.streamingThresholdMiB, Defaults::streamingThresholdMiB).toInt());
+  }
+
+  void
+  setStreamingThresholdMiB(int thresholdMiB)
+  {
+    settings.setValue(keys.streamingThresholdMiB, thresholdMiB);
+  }
+
+  // 0 means one thread per hardware thread
+  int
+  getThreadCount() const
+  {
+    return std::max(0, settings.value(keys.threadCount, 0).toInt());
+  }
+
+  void
+  setThreadCount(int threadCount)
+  {
+    settings.setValue(keys.threadCount, threadCount);
+  }
+};
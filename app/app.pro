@@ -0,0 +1,46 @@
+QT       += core gui widgets
+
+CONFIG += c++latest
+
+TARGET = rgba-compose
+
+include(../engine/engine.pri)
+
+# You can make your code fail to compile if it uses deprecated APIs.
+# In order to do so, uncomment the following line.
+#DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
+
+SOURCES += \
+    ChannelUi.cc \
+    commandLine.cc \
+    GetImageSizeDialog.cc \
+    getInputImageFilenameFilter.cc \
+    getOutputImageFilenameFilter.cc \
+    main.cc \
+    PreviewUi.cc \
+    RgbaComposer.cc \
+    showImageCacheDialog.cc
+
+HEADERS += \
+    ChannelUi.hh \
+    commandLine.hh \
+    Constants.hh \
+    Defaults.hh \
+    Destroyer.hh \
+    GetImageSizeDialog.hh \
+    PreviewUi.hh \
+    PreviewView.hh \
+    RgbaComposer.hh \
+    Settings.hh \
+    getInputImageFilenameFilter.hh \
+    getOutputImageFilenameFilter.hh \
+    showImageCacheDialog.hh
+
+FORMS += \
+    GetImageSizeDialog.ui \
+    RgbaComposer.ui
+
+# Default rules for deployment.
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
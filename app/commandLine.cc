@@ -0,0 +1,937 @@
+#include "commandLine.hh"
+
+#include "BufferPool.hh"
+#include "compose.hh"
+#include "ImageCache.hh"
+#include "OutputIndex.hh"
+#include "StageLog.hh"
+#include "TilePool.hh"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTimer>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace
+{
+  constexpr const char *channelOptionNames[4] = {"red", "green", "blue", "alpha"};
+
+  struct Job
+  {
+    CompositionSpec spec;
+    QString output;
+  };
+
+  // Blocks jobs until their estimated image memory fits, so that running many jobs at once stays within a limit.
+  class MemoryBudget
+  {
+  public:
+    explicit MemoryBudget(qint64 bytes) : available{bytes}, total{bytes} {}
+
+    // a job bigger than the whole budget waits until it can run alone
+    qint64
+    acquire(qint64 bytes)
+    {
+      bytes = std::min(bytes, total);
+      std::unique_lock lock(mutex);
+      released.wait(lock, [&]{ return available >= bytes; });
+      available -= bytes;
+      return bytes;
+    }
+
+    void
+    release(qint64 bytes)
+    {
+      {
+        std::lock_guard lock(mutex);
+        available += bytes;
+      }
+      released.notify_all();
+    }
+
+  private:
+    std::mutex mutex;
+    std::condition_variable released;
+    qint64 available;
+    const qint64 total;
+  };
+
+  void
+  printLine(FILE *stream, const QString &line)
+  {
+    static std::mutex mutex;
+    std::lock_guard lock(mutex);
+    std::fprintf(stream, "%s\n", line.toLocal8Bit().constData());
+    std::fflush(stream);
+  }
+
+  std::optional<QSize>
+  parseSize(const QString &text)
+  {
+    const QStringList parts = text.toLower().split('x');
+    if (parts.size() != 2)
+      return std::nullopt;
+
+    bool okWidth = false, okHeight = false;
+    const QSize size(parts[0].trimmed().toInt(&okWidth), parts[1].trimmed().toInt(&okHeight));
+    if (!okWidth || !okHeight || size.isEmpty())
+      return std::nullopt;
+    return size;
+  }
+
+  // "bc7", "bc5" or "bc4"
+  std::optional<BlockFormat>
+  parseBlockFormat(const QString &text)
+  {
+    const QString format = text.trimmed().toLower();
+    if (format == "bc7")
+      return BlockFormat::Bc7;
+    if (format == "bc5")
+      return BlockFormat::Bc5;
+    if (format == "bc4")
+      return BlockFormat::Bc4;
+    return std::nullopt;
+  }
+
+  // "default", "filtered", "rle" or "huffman"
+  std::optional<PngStrategy>
+  parsePngStrategy(const QString &text)
+  {
+    const QString strategy = text.trimmed().toLower();
+    if (strategy == "default")
+      return PngStrategy::Default;
+    if (strategy == "filtered")
+      return PngStrategy::Filtered;
+    if (strategy == "rle")
+      return PngStrategy::Rle;
+    if (strategy == "huffman")
+      return PngStrategy::HuffmanOnly;
+    return std::nullopt;
+  }
+
+  // "fast", "normal" or "best"
+  std::optional<BlockQuality>
+  parseBlockQuality(const QString &text)
+  {
+    const QString quality = text.trimmed().toLower();
+    if (quality == "fast")
+      return BlockQuality::Fast;
+    if (quality == "normal")
+      return BlockQuality::Normal;
+    if (quality == "best")
+      return BlockQuality::Best;
+    return std::nullopt;
+  }
+
+  // "<0..255>" for a constant, or "<file>[:r|g|b|a][:invert]"; suffixes are taken from the right so paths may contain ':'
+  std::optional<ChannelSpec>
+  parseChannelSpec(const QString &text, const QDir &baseDir, QString &error)
+  {
+    ChannelSpec channel;
+
+    bool isNumber = false;
+    const double constant = text.trimmed().toDouble(&isNumber);
+    if (isNumber)
+    {
+      if (!(constant >= 0 && constant <= 255 && constant == std::floor(constant)))
+      {
+        error = "constant " + text.trimmed() + " is not a whole number in [0, 255]";
+        return std::nullopt;
+      }
+      channel.constant = quint8(constant);
+      return channel;
+    }
+
+    static const QStringList channelNames[4] = {{"r", "red"}, {"g", "green"}, {"b", "blue"}, {"a", "alpha"}};
+
+    QStringList parts = text.split(':');
+    while (parts.size() > 1)
+    {
+      const QString suffix = parts.last().trimmed().toLower();
+      if (suffix == "invert" || suffix == "i")
+        channel.invert = true;
+      else if (auto it = std::find_if(std::begin(channelNames), std::end(channelNames), [&](const QStringList &names){ return names.contains(suffix); }); it != std::end(channelNames))
+        channel.inputChannel = int(it - std::begin(channelNames));
+      else
+        break;
+      parts.removeLast();
+    }
+
+    const QString filename = parts.join(':').trimmed();
+    if (filename.isEmpty())
+    {
+      error = "missing image filename in '" + text + "'";
+      return std::nullopt;
+    }
+
+    channel.source = InputSource::Image;
+    channel.filename = QDir::cleanPath(baseDir.absoluteFilePath(filename));
+    return channel;
+  }
+
+  // channels that aren't given are constant: 0 for color, 255 (opaque) for alpha
+  CompositionSpec
+  makeDefaultSpec()
+  {
+    CompositionSpec spec;
+    spec.channels[3].constant = 255;
+    return spec;
+  }
+
+  // fills in job from field values named output, r/red, g/green, b/blue, a/alpha, size, resize, filter, precision and
+  // mipmaps
+  bool
+  parseJobFields(const std::function<QString(const QString &name)> &field, const QDir &baseDir, Job &job, QString &error)
+  {
+    job.spec = makeDefaultSpec();
+
+    job.output = field("output").trimmed();
+    if (job.output.isEmpty())
+    {
+      error = "missing output";
+      return false;
+    }
+    job.output = QDir::cleanPath(baseDir.absoluteFilePath(job.output));
+    job.spec.saveFormat = getSaveFormat(job.output);
+
+    for (int outputChannel : {0, 1, 2, 3})
+    {
+      QString text = field(QString(channelOptionNames[outputChannel]).left(1));
+      if (text.isEmpty())
+        text = field(channelOptionNames[outputChannel]);
+      if (text.isEmpty())
+        continue;
+
+      if (auto channel = parseChannelSpec(text, baseDir, error))
+        job.spec.channels[outputChannel] = *channel;
+      else
+        return false;
+    }
+
+    if (QString precision = field("precision").trimmed().toLower(); !precision.isEmpty())
+    {
+      if (precision == "8")
+        job.spec.precision = Precision::Uint8;
+      else if (precision == "16")
+        job.spec.precision = Precision::Uint16;
+      else if (precision == "float" || precision == "32")
+        job.spec.precision = Precision::Float32;
+      else
+      {
+        error = "bad precision '" + precision + "', expected 8, 16 or float";
+        return false;
+      }
+    }
+
+    if (QString mipmaps = field("mipmaps").trimmed().toLower(); !mipmaps.isEmpty())
+    {
+      if (mipmaps == "1" || mipmaps == "true" || mipmaps == "yes")
+        job.spec.mipmaps = true;
+      else if (mipmaps == "0" || mipmaps == "false" || mipmaps == "no")
+        job.spec.mipmaps = false;
+      else
+      {
+        error = "bad mipmaps '" + mipmaps + "', expected yes or no";
+        return false;
+      }
+    }
+
+    if (QString size = field("size"); !size.isEmpty())
+      if (!(job.spec.size = parseSize(size)))
+      {
+        error = "bad size '" + size + "', expected <width>x<height>";
+        return false;
+      }
+
+    // a size to resize to is the output size too
+    if (QString resize = field("resize").trimmed().toLower(); !resize.isEmpty())
+    {
+      if (resize == "none")
+        job.spec.resize = ResizeMode::None;
+      else if (resize == "largest")
+        job.spec.resize = ResizeMode::Largest;
+      else if (resize == "smallest")
+        job.spec.resize = ResizeMode::Smallest;
+      else if (auto size = parseSize(resize))
+      {
+        job.spec.resize = ResizeMode::Explicit;
+        job.spec.size = size;
+      }
+      else
+      {
+        error = "bad resize '" + resize + "', expected none, largest, smallest or <width>x<height>";
+        return false;
+      }
+    }
+
+    if (QString filter = field("filter").trimmed().toLower(); !filter.isEmpty())
+    {
+      if (filter == "nearest")
+        job.spec.filter = ResampleFilter::Nearest;
+      else if (filter == "bilinear")
+        job.spec.filter = ResampleFilter::Bilinear;
+      else if (filter == "lanczos")
+        job.spec.filter = ResampleFilter::Lanczos3;
+      else
+      {
+        error = "bad filter '" + filter + "', expected nearest, bilinear or lanczos";
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  // The fields of one CSV line: separated by commas, and in double quotes if they hold commas or quotes, with the quotes
+  // inside doubled. Empty with error set if a quote isn't closed.
+  std::optional<QStringList>
+  splitCsvLine(const QString &line, QString &error)
+  {
+    QStringList fields;
+    QString field;
+    bool quoted = false;
+    for (qsizetype i = 0; i < line.size(); ++i)
+    {
+      const QChar c = line[i];
+      if (quoted && c == '"' && i + 1 < line.size() && line[i + 1] == '"')
+      {
+        field += c;
+        ++i;
+      }
+      else if (c == '"')
+        quoted = !quoted;
+      else if (c == ',' && !quoted)
+        fields.append(std::exchange(field, {}));
+      else
+        field += c;
+    }
+    fields.append(field);
+
+    if (quoted)
+    {
+      error = "unterminated quote";
+      return std::nullopt;
+    }
+    return fields;
+  }
+
+  // JSON: an array of job objects, or {"jobs": [...]}; CSV: a header row naming the fields, then one job per row
+  std::optional<std::vector<Job>>
+  readManifest(const QString &filename, QString &error)
+  {
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+      error = file.errorString();
+      return std::nullopt;
+    }
+
+    const QDir baseDir = QFileInfo(filename).absoluteDir();
+    std::vector<Job> jobs;
+
+    if (QFileInfo(filename).suffix().toLower() == "json")
+    {
+      QJsonParseError parseError;
+      const QJsonDocument document = QJsonDocument::fromJson(file.readAll(), &parseError);
+      if (document.isNull())
+      {
+        error = parseError.errorString();
+        return std::nullopt;
+      }
+
+      const QJsonArray array = document.isArray() ? document.array() : document.object().value("jobs").toArray();
+      for (int i = 0; i < array.size(); ++i)
+      {
+        const QJsonObject object = array[i].toObject();
+        auto field = [&](const QString &name) -> QString {
+          const QJsonValue value = object.value(name);
+          if (value.isBool())
+            return value.toBool() ? "yes" : "no";
+          // all digits of fractions and big numbers, so that they are reported rather than rounded
+          return value.isDouble() ? QString::number(value.toDouble(), 'g', 17) : value.toString();
+        };
+
+        // constants are JSON numbers; a number in a string is more likely a slip than an image of that name
+        for (int outputChannel : {0, 1, 2, 3})
+          for (const QString &name : {QString(channelOptionNames[outputChannel]).left(1), QString(channelOptionNames[outputChannel])})
+          {
+            bool isNumber = false;
+            if (const QJsonValue value = object.value(name); value.isString())
+              value.toString().trimmed().toDouble(&isNumber);
+            if (isNumber)
+            {
+              error = QString("job %1: constant %2 of %3 is a string, not a number").arg(i + 1).arg(object.value(name).toString(), name);
+              return std::nullopt;
+            }
+          }
+
+        Job job;
+        if (!parseJobFields(field, baseDir, job, error))
+        {
+          error = QString("job %1: %2").arg(i + 1).arg(error);
+          return std::nullopt;
+        }
+        jobs.push_back(std::move(job));
+      }
+    }
+    else
+    {
+      QStringList header;
+      for (int lineNumber = 1; !file.atEnd(); ++lineNumber)
+      {
+        const QString line = QString::fromUtf8(file.readLine()).trimmed();
+        if (line.isEmpty() || line.startsWith('#'))
+          continue;
+
+        const std::optional<QStringList> values = splitCsvLine(line, error);
+        if (!values)
+        {
+          error = QString("line %1: %2").arg(lineNumber).arg(error);
+          return std::nullopt;
+        }
+        if (header.isEmpty())
+        {
+          for (const QString &name : *values)
+            header.append(name.trimmed().toLower());
+          continue;
+        }
+
+        auto field = [&](const QString &name) -> QString {
+          const qsizetype column = header.indexOf(name);
+          return column >= 0 && column < values->size() ? (*values)[column].trimmed() : QString();
+        };
+
+        Job job;
+        if (!parseJobFields(field, baseDir, job, error))
+        {
+          error = QString("line %1: %2").arg(lineNumber).arg(error);
+          return std::nullopt;
+        }
+        jobs.push_back(std::move(job));
+      }
+    }
+
+    return jobs;
+  }
+
+  bool
+  isSameJob(const Job &a, const Job &b)
+  {
+    for (int c : {0, 1, 2, 3})
+    {
+      const ChannelSpec &x = a.spec.channels[c], &y = b.spec.channels[c];
+      if (x.source != y.source || x.constant != y.constant || x.filename != y.filename || x.inputChannel != y.inputChannel || x.invert != y.invert)
+        return false;
+    }
+    return a.output == b.output && a.spec.size == b.spec.size && a.spec.resize == b.spec.resize && a.spec.filter == b.spec.filter
+      && a.spec.precision == b.spec.precision && a.spec.mipmaps == b.spec.mipmaps;
+  }
+
+  // What every job shares: the workers, the memory budget and the decoded inputs, which outlive one run() so that
+  // watch mode only decodes the inputs that changed.
+  class Runner
+  {
+  public:
+    // outputIndex, if given, is used to skip outputs that are up to date and saved after every run; the image buffers
+    // of finished jobs, up to bufferPoolBytes, are kept for the jobs after them
+    Runner(int jobCount, qint64 memoryBytes, qint64 cacheBytes, qint64 bufferPoolBytes, bool hugePages, const SaveOptions &saveOptions, const QString &stageLogFile, bool alwaysStream,
+           OutputIndex *outputIndex)
+      : jobCount{TilePool::resolveThreadCount(jobCount)}
+      , pool{0}
+      , memoryBytes{memoryBytes}
+      , memoryBudget{memoryBytes}
+      , bufferPool{bufferPoolBytes, hugePages}
+      , imageCache{std::make_shared<ImageCache>([this](const QString &filename, QString &error){
+          const BufferPool::Scope bufferScope(&bufferPool);
+          return loadInputImage(filename, error);
+        }, cacheBytes)}
+      , saveOptions{saveOptions}
+      , stageLogFile{stageLogFile}
+      , alwaysStream{alwaysStream}
+      , outputIndex{outputIndex}
+    {
+    }
+
+    // composes and saves the jobs, printing a line for each; returns how many failed
+    int
+    run(const std::vector<Job> &jobs)
+    {
+      std::atomic<int> failures{0};
+
+      // jobs run on threads of their own rather than as tiles of the pool, so that each of their stages still has
+      // every worker; while one job holds the pool the others decode, encode and write
+      const auto runJob = [&](int i){
+        const Job &job = jobs[i];
+        const auto start = std::chrono::steady_clock::now();
+        StageLog stageLog;
+        const StageLog::Scope logScope(&stageLog);
+        const BufferPool::Scope bufferScope(&bufferPool);
+
+        // inputs that can't be read leave the fingerprint empty, and compose() reports them
+        QByteArray fingerprint;
+        if (outputIndex)
+        {
+          QString fingerprintError;
+          fingerprint = outputIndex->makeFingerprint(job.spec, saveOptions, *imageCache, fingerprintError);
+        }
+        if (!fingerprint.isEmpty() && outputIndex->isUpToDate(job.output, fingerprint))
+        {
+          QString stageLogError;
+          if (!stageLogFile.isEmpty() && !stageLog.appendToFile(stageLogFile, {{"output", job.output}, {"ok", true}, {"skipped", true}}, stageLogError))
+            printLine(stderr, "Couldn't write stage log " + QDir::toNativeSeparators(stageLogFile) + ": " + stageLogError);
+          printLine(stdout, QString("[%1/%2] %3 is up to date").arg(i + 1).arg(jobs.size()).arg(QDir::toNativeSeparators(job.output)));
+          return;
+        }
+
+        const qint64 estimatedBytes = estimateComposeBytes(job.spec);
+        ComposeResult result;
+        QString writeError;
+        QStringList writtenFiles{job.output}; // with the mip levels saved beside it, for the index
+
+        // streamed jobs hold a few strips rather than whole images, so they don't count against the budget; constants
+        // alone are always streamed, as they need no whole image
+        if ((alwaysStream || !job.spec.usesImages() || estimatedBytes > memoryBytes) && canComposeToFile(job.spec, job.output))
+        {
+          QDir().mkpath(QFileInfo(job.output).absolutePath());
+          result = composeToFile(job.spec, job.output, saveOptions, pool, &stageLog);
+        }
+        else
+        {
+          const qint64 bytes = memoryBudget.acquire(estimatedBytes);
+          result = compose(job.spec, pool, *imageCache, &stageLog);
+          if (result.ok())
+          {
+            QDir().mkpath(QFileInfo(job.output).absolutePath());
+            saveResult(result, job.output, saveOptions, pool, writeError, &stageLog);
+            writtenFiles = getWrittenFiles(result, job.output);
+          }
+          result.image = {};
+          result.mipLevels.clear();
+          memoryBudget.release(bytes);
+        }
+
+        // peak memory and page faults are the process's so far, across the jobs running alongside too
+        const ProcessMemory memory = getProcessMemory();
+        QString stageLogError;
+        if (!stageLogFile.isEmpty() && !stageLog.appendToFile(stageLogFile, {{"output", job.output}, {"ok", result.ok() && writeError.isEmpty()},
+                                                                             {"peakResidentBytes", double(memory.peakResidentBytes)}, {"pageFaults", double(memory.pageFaults)}}, stageLogError))
+          printLine(stderr, "Couldn't write stage log " + QDir::toNativeSeparators(stageLogFile) + ": " + stageLogError);
+
+        const QString output = QDir::toNativeSeparators(job.output);
+        if (!result.ok())
+        {
+          ++failures;
+          printLine(stderr, QString("[%1/%2] %3: %4\n%5").arg(i + 1).arg(jobs.size()).arg(output, result.errorTitle, result.errorText));
+        }
+        else if (!writeError.isEmpty())
+        {
+          ++failures;
+          printLine(stderr, QString("[%1/%2] %3: couldn't save image: %4").arg(i + 1).arg(jobs.size()).arg(output, writeError));
+        }
+        else
+        {
+          if (!fingerprint.isEmpty())
+            outputIndex->setWritten(writtenFiles, fingerprint);
+          const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+          printLine(stdout, QString("[%1/%2] %3 (%4 ms)").arg(i + 1).arg(jobs.size()).arg(output).arg(ms, 0, 'f', 0));
+        }
+      };
+
+      // the calling thread takes jobs too
+      std::atomic<int> nextJob{0};
+      const auto takeJobs = [&]{
+        for (int i; (i = nextJob++) < int(jobs.size());)
+          runJob(i);
+      };
+      std::vector<std::thread> threads;
+      for (int t = 1; t < std::min(jobCount, int(jobs.size())); ++t)
+        threads.emplace_back(takeJobs);
+      takeJobs();
+      for (std::thread &thread : threads)
+        thread.join();
+
+      QString indexError;
+      if (outputIndex && !outputIndex->save(indexError))
+        printLine(stderr, "Couldn't write index: " + indexError);
+
+      const BufferPool::Stats buffers = bufferPool.getStats();
+      const ProcessMemory memory = getProcessMemory();
+      printLine(stdout, QString("Image buffers: %1 allocated, %2 reused; peak RSS %3 MiB, %4 page faults")
+                          .arg(buffers.allocations).arg(buffers.reuses).arg(memory.peakResidentBytes / (1024 * 1024)).arg(memory.pageFaults));
+      return failures;
+    }
+
+  private:
+    const int jobCount; // run at the same time
+    TilePool pool; // one worker per hardware thread
+    const qint64 memoryBytes;
+    MemoryBudget memoryBudget;
+    BufferPool bufferPool;
+    const std::shared_ptr<ImageCache> imageCache;
+    const SaveOptions saveOptions;
+    const QString stageLogFile;
+    const bool alwaysStream;
+    OutputIndex *const outputIndex;
+  };
+
+  // Recomposes the jobs whose input files change on disk, and those a changed manifest adds or alters, until the
+  // process is stopped. The directories of the files are watched too, since exporters often replace a file rather
+  // than write to it, which ends the watch on the file itself. Changes are acted on once the files have been quiet
+  // for the delay, and only files whose modification time or size moved count as changed; the runner's image cache
+  // still holds the other inputs, so one edited map costs one decode and one compose per output reading it.
+  class Watcher
+  {
+  public:
+    // jobs starts with the manifestJobCount jobs read from manifest, if any; a manifest that changes replaces those
+    Watcher(Runner &runner, std::vector<Job> jobs, QString manifest, size_t manifestJobCount, int delayMs)
+      : runner{runner}
+      , jobs{std::move(jobs)}
+      , manifest{std::move(manifest)}
+      , manifestJobCount{manifestJobCount}
+    {
+      if (!this->manifest.isEmpty())
+        manifestStamp = getStamp(this->manifest);
+      watchFiles();
+
+      debounce.setSingleShot(true);
+      debounce.setInterval(delayMs);
+      QObject::connect(&watcher, &QFileSystemWatcher::fileChanged, [this](const QString &){ debounce.start(); });
+      QObject::connect(&watcher, &QFileSystemWatcher::directoryChanged, [this](const QString &){ debounce.start(); });
+      QObject::connect(&debounce, &QTimer::timeout, [this]{ onQuiet(); });
+    }
+
+    // inputs and the manifest
+    int
+    getWatchedCount() const
+    {
+      return int(stamps.size()) + (manifest.isEmpty() ? 0 : 1);
+    }
+
+  private:
+    struct Stamp
+    {
+      bool exists = false;
+      QDateTime modified;
+      qint64 size = 0;
+
+      bool
+      operator!=(const Stamp &other) const
+      {
+        return exists != other.exists || modified != other.modified || size != other.size;
+      }
+    };
+
+    Runner &runner;
+    std::vector<Job> jobs;
+    const QString manifest; // empty if the jobs came from the command line
+    size_t manifestJobCount;
+    Stamp manifestStamp;
+    std::map<QString, Stamp> stamps; // of every input, as last composed from
+    QFileSystemWatcher watcher;
+    QTimer debounce;
+
+    static Stamp
+    getStamp(const QString &filename)
+    {
+      const QFileInfo info(filename);
+      return {info.exists(), info.lastModified(), info.size()};
+    }
+
+    // watches the inputs of the current jobs, taking the stamps of new ones as they are now
+    void
+    watchFiles()
+    {
+      std::set<QString> files;
+      for (const Job &job : jobs)
+        for (const ChannelSpec &channel : job.spec.channels)
+          if (channel.source == InputSource::Image)
+            files.insert(channel.filename);
+
+      for (auto it = stamps.begin(); it != stamps.end();)
+        it = files.count(it->first) ? std::next(it) : stamps.erase(it);
+      for (const QString &file : files)
+        if (!stamps.count(file))
+          stamps[file] = getStamp(file);
+
+      if (!manifest.isEmpty())
+        files.insert(manifest);
+
+      // a file that was replaced or removed has dropped out of the watcher and is added again once it exists
+      const QStringList watchedFiles = watcher.files(), watchedDirectories = watcher.directories();
+      QStringList paths;
+      for (const QString &file : files)
+      {
+        const QString directory = QFileInfo(file).absolutePath();
+        if (QFileInfo::exists(file) && !watchedFiles.contains(file))
+          paths.append(file);
+        if (!watchedDirectories.contains(directory) && !paths.contains(directory))
+          paths.append(directory);
+      }
+      if (!paths.isEmpty())
+        watcher.addPaths(paths);
+    }
+
+    void
+    onQuiet()
+    {
+      std::vector<Job> changedJobs;
+      const auto addJob = [&](const Job &job){
+        if (std::none_of(changedJobs.begin(), changedJobs.end(), [&](const Job &changed){ return changed.output == job.output; }))
+          changedJobs.push_back(job);
+      };
+
+      // a manifest that can't be read keeps the jobs it had
+      if (!manifest.isEmpty() && getStamp(manifest) != manifestStamp)
+      {
+        manifestStamp = getStamp(manifest);
+        QString error;
+        if (auto manifestJobs = readManifest(manifest, error))
+        {
+          for (const Job &job : *manifestJobs)
+            if (std::none_of(jobs.begin(), jobs.end(), [&](const Job &old){ return isSameJob(old, job); }))
+              addJob(job);
+          // the command line's own jobs follow the old manifest's, however many jobs the new one has
+          const size_t oldManifestJobCount = std::exchange(manifestJobCount, manifestJobs->size());
+          manifestJobs->insert(manifestJobs->end(), jobs.begin() + std::ptrdiff_t(oldManifestJobCount), jobs.end());
+          jobs = std::move(*manifestJobs);
+        }
+        else
+          printLine(stderr, "Couldn't read manifest " + QDir::toNativeSeparators(manifest) + ": " + error);
+      }
+
+      std::set<QString> changedFiles;
+      for (auto &[file, stamp] : stamps)
+        if (const Stamp now = getStamp(file); now != stamp)
+        {
+          stamp = now;
+          if (now.exists)
+            changedFiles.insert(file);
+        }
+      for (const Job &job : jobs)
+        for (const ChannelSpec &channel : job.spec.channels)
+          if (channel.source == InputSource::Image && changedFiles.count(channel.filename))
+            addJob(job);
+
+      watchFiles();
+      if (changedJobs.empty())
+        return;
+
+      QStringList names;
+      for (const QString &file : changedFiles)
+        names.append(QFileInfo(file).fileName());
+      printLine(stdout, QString("%1 changed; recomposing %2 outputs").arg(names.isEmpty() ? "manifest" : names.join(", ")).arg(changedJobs.size()));
+      runner.run(changedJobs);
+    }
+  };
+} // namespace
+
+bool
+isCommandLine(int argc, char *argv[])
+{
+  for (int i = 1; i < argc; ++i)
+    for (const char *option : {"-o", "--output", "-m", "--manifest", "-h", "--help"})
+      if (std::strcmp(argv[i], option) == 0 || (option[1] == '-' && std::strncmp(argv[i], option, std::strlen(option)) == 0 && argv[i][std::strlen(option)] == '='))
+        return true;
+  return false;
+}
+
+int
+runCommandLine(int argc, char *argv[])
+{
+  QCoreApplication app(argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+      "Combines channels of up to four images into the channels of a new image.\n\n"
+      "A channel is either a constant in [0, 255] or <file>[:r|g|b|a][:invert], e.g. ao.png:r or rough.tga:g:invert.\n"
+      "Channels that aren't given are 0, except alpha which is 255.\n\n"
+      "A manifest describes many outputs at once. JSON: [{\"output\": \"out.png\", \"r\": \"ao.png\", \"g\": 128, ...}, ...]\n"
+      "CSV: a header row such as output,r,g,b,a,size,precision,mipmaps followed by one row per output; fields holding\n"
+      "commas or quotes go in double quotes, with the quotes inside doubled: \"my, texture.png\",\"say \"\"hi\"\".png\":g.\n"
+      "Constants are whole numbers in [0, 255], and JSON numbers rather than strings.\n"
+      "Relative paths in a manifest are relative to the manifest.\n\n"
+      "With --watch the composer keeps running and recomposes only the outputs whose inputs change on disk; inputs that\n"
+      "didn't change stay decoded in the cache (see --cache-mib).");
+  parser.addHelpOption();
+
+  const QCommandLineOption channelOptions[4] = {
+    {{"r", "red"}, "Source of the red channel.", "spec"},
+    {{"g", "green"}, "Source of the green channel.", "spec"},
+    {{"b", "blue"}, "Source of the blue channel.", "spec"},
+    {{"a", "alpha"}, "Source of the alpha channel.", "spec"}};
+  const QCommandLineOption outputOption({"o", "output"}, "Output image file; the format follows the suffix.", "file");
+  const QCommandLineOption sizeOption({"s", "size"}, "Output size when no channel reads an image.", "WxH");
+  const QCommandLineOption resizeOption("resize", "Resample inputs of different sizes to the largest, the smallest or WxH; none makes differing sizes an error. Manifests give it per output.", "mode", "none");
+  const QCommandLineOption filterOption("filter", "Filter to resample inputs with: nearest, bilinear or lanczos. Manifests give it per output.", "filter", "bilinear");
+  const QCommandLineOption precisionOption({"p", "precision"}, "Bits per channel of the output: 8, 16 or float. Manifests give it per output.", "bits", "8");
+  const QCommandLineOption mipmapsOption("mipmaps", "Also save the mip levels of the output, down to 1x1, as <name>_mip1.<suffix> and so on, or inside .dds outputs. Manifests give it per output.");
+  const QCommandLineOption pngLevelOption("png-level", "zlib level of PNG outputs, from 0 (fastest) to 9 (smallest).", "level", "6");
+  const QCommandLineOption pngStrategyOption("png-strategy", "zlib strategy of PNG outputs: default, filtered, rle (fast) or huffman.", "strategy", "default");
+  const QCommandLineOption serialPngOption("serial-png", "Deflate PNG outputs in one stream with Qt's writer rather than in chunks on all threads.");
+  const QCommandLineOption qualityOption("quality", "Quality of JPEG and WebP outputs, 0 to 100 (default: the format's own).", "quality", "-1");
+  const QCommandLineOption ddsFormatOption("dds-format", "Block compression of .dds outputs: bc7 (RGBA), bc5 (red and green) or bc4 (red).", "format", "bc7");
+  const QCommandLineOption ddsQualityOption("dds-quality", "Effort of the .dds block encoder: fast, normal or best.", "quality", "normal");
+  const QCommandLineOption manifestOption({"m", "manifest"}, "JSON or CSV file listing many outputs to compose.", "file");
+  const QCommandLineOption jobsOption({"j", "jobs"}, "Outputs composed at the same time (default: one per CPU core); each stage of each uses every core.", "n", "0");
+  const QCommandLineOption memoryOption("memory-mib", "Image memory that concurrent jobs may use together.", "MiB", "4096");
+  const QCommandLineOption cacheOption("cache-mib", "Memory for decoded inputs shared between outputs.", "MiB", "512");
+  const QCommandLineOption bufferPoolOption("buffer-pool-mib", "Memory of finished jobs' image buffers kept for the jobs after them, so they don't have the system map fresh pages.", "MiB", "1024");
+  const QCommandLineOption hugePagesOption("huge-pages", "Advise the system to back big image buffers with huge pages (Linux only).");
+  const QCommandLineOption streamOption("stream", "Compose PNG and PPM outputs strip by strip, straight into the file, to keep memory low. Outputs bigger than --memory-mib are streamed anyway.");
+  const QCommandLineOption indexOption("index", "Skip outputs whose inputs and settings haven't changed since they were written, as recorded in this file, which is created if missing.", "file");
+  const QCommandLineOption stageLogOption("stage-log", "Append the time, bytes and image memory of each stage of every output to this file as JSON Lines.", "file");
+  const QCommandLineOption watchOption("watch", "After composing, keep running and recompose the outputs whose inputs change, and those a changed manifest adds or alters.");
+  const QCommandLineOption watchDelayOption("watch-delay", "With --watch, how long files must be left alone after a change before composing.", "ms", "500");
+
+  for (const QCommandLineOption &option : channelOptions)
+    parser.addOption(option);
+  parser.addOptions({outputOption, sizeOption, resizeOption, filterOption, precisionOption, mipmapsOption, pngLevelOption, pngStrategyOption, serialPngOption, qualityOption, ddsFormatOption, ddsQualityOption, manifestOption, jobsOption, memoryOption, cacheOption, bufferPoolOption, hugePagesOption, streamOption, indexOption, stageLogOption, watchOption, watchDelayOption});
+
+  parser.process(app);
+
+  std::vector<Job> jobs;
+  QString error;
+
+  SaveOptions saveOptions;
+  bool okLevel = false, okQuality = false;
+  saveOptions.pngLevel = parser.value(pngLevelOption).toInt(&okLevel);
+  saveOptions.quality = parser.value(qualityOption).toInt(&okQuality);
+  saveOptions.parallelPng = !parser.isSet(serialPngOption);
+  if (!okLevel || saveOptions.pngLevel < 0 || saveOptions.pngLevel > 9)
+  {
+    printLine(stderr, "bad PNG level '" + parser.value(pngLevelOption) + "', expected 0 to 9");
+    return 1;
+  }
+  if (!okQuality || saveOptions.quality < -1 || saveOptions.quality > 100)
+  {
+    printLine(stderr, "bad quality '" + parser.value(qualityOption) + "', expected 0 to 100");
+    return 1;
+  }
+  if (auto strategy = parsePngStrategy(parser.value(pngStrategyOption)))
+    saveOptions.pngStrategy = *strategy;
+  else
+  {
+    printLine(stderr, "bad PNG strategy '" + parser.value(pngStrategyOption) + "', expected default, filtered, rle or huffman");
+    return 1;
+  }
+  if (auto format = parseBlockFormat(parser.value(ddsFormatOption)))
+    saveOptions.ddsFormat = *format;
+  else
+  {
+    printLine(stderr, "bad DDS format '" + parser.value(ddsFormatOption) + "', expected bc7, bc5 or bc4");
+    return 1;
+  }
+  if (auto quality = parseBlockQuality(parser.value(ddsQualityOption)))
+    saveOptions.ddsQuality = *quality;
+  else
+  {
+    printLine(stderr, "bad DDS quality '" + parser.value(ddsQualityOption) + "', expected fast, normal or best");
+    return 1;
+  }
+
+  if (parser.isSet(manifestOption))
+  {
+    if (auto manifestJobs = readManifest(parser.value(manifestOption), error))
+      jobs = std::move(*manifestJobs);
+    else
+    {
+      printLine(stderr, "Couldn't read manifest " + QDir::toNativeSeparators(parser.value(manifestOption)) + ": " + error);
+      return 1;
+    }
+  }
+  const size_t manifestJobCount = jobs.size();
+
+  if (parser.isSet(outputOption))
+  {
+    auto field = [&](const QString &name) -> QString {
+      if (name == "output")
+        return parser.value(outputOption);
+      if (name == "size")
+        return parser.value(sizeOption);
+      if (name == "resize")
+        return parser.value(resizeOption);
+      if (name == "filter")
+        return parser.value(filterOption);
+      if (name == "precision")
+        return parser.value(precisionOption);
+      if (name == "mipmaps")
+        return parser.isSet(mipmapsOption) ? "yes" : QString();
+      for (int outputChannel : {0, 1, 2, 3})
+        if (name == channelOptionNames[outputChannel])
+          return parser.value(channelOptions[outputChannel]);
+      return {};
+    };
+
+    Job job;
+    if (!parseJobFields(field, QDir::current(), job, error))
+    {
+      printLine(stderr, error);
+      return 1;
+    }
+    jobs.push_back(std::move(job));
+  }
+
+  if (jobs.empty())
+  {
+    printLine(stderr, "Nothing to do: give an --output or a --manifest.");
+    return 1;
+  }
+
+  bool okDelay = false;
+  const int delayMs = parser.value(watchDelayOption).toInt(&okDelay);
+  if (!okDelay || delayMs < 0)
+  {
+    printLine(stderr, "bad watch delay '" + parser.value(watchDelayOption) + "', expected milliseconds");
+    return 1;
+  }
+
+  std::optional<OutputIndex> outputIndex;
+  if (parser.isSet(indexOption))
+  {
+    outputIndex.emplace(parser.value(indexOption));
+    if (!outputIndex->load(error))
+    {
+      printLine(stderr, "Couldn't read index " + QDir::toNativeSeparators(parser.value(indexOption)) + ": " + error);
+      return 1;
+    }
+  }
+
+  const qint64 memoryBytes = parser.value(memoryOption).toLongLong() * 1024 * 1024;
+  Runner runner(parser.value(jobsOption).toInt(), memoryBytes, parser.value(cacheOption).toLongLong() * 1024 * 1024, parser.value(bufferPoolOption).toLongLong() * 1024 * 1024,
+                parser.isSet(hugePagesOption), saveOptions, parser.value(stageLogOption), parser.isSet(streamOption), outputIndex ? &*outputIndex : nullptr);
+
+  // watching starts before the first run, so files that change during it are composed again afterwards
+  std::optional<Watcher> watcher;
+  if (parser.isSet(watchOption))
+    watcher.emplace(runner, jobs, parser.isSet(manifestOption) ? parser.value(manifestOption) : QString(), manifestJobCount, delayMs);
+
+  const int failures = runner.run(jobs);
+  if (!watcher)
+    return failures ? 2 : 0;
+
+  printLine(stdout, QString("Watching %1 files for changes; press Ctrl+C to stop").arg(watcher->getWatchedCount()));
+  return app.exec();
+}
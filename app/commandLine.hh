@@ -0,0 +1,9 @@
+#pragma once
+
+// True if the arguments ask for headless operation (an output file, a manifest or help) rather than the GUI.
+bool
+isCommandLine(int argc, char *argv[]);
+
+// Runs the headless composer with a QCoreApplication and returns the process exit code.
+int
+runCommandLine(int argc, char *argv[]);
@@ -11,6 +11,13 @@ getOutputImageFilenameFilter()
     for (const QByteArray &format : QImageWriter::supportedImageFormats())
       formats.append(format);
 
+    // written by saveResult() rather than QImageWriter
+    if (!formats.contains("dds"))
+    {
+      formats.append("dds");
+      formats.sort();
+    }
+
     QStringList filters;
     for (const QString &format : formats)
       filters.append(QString("%1 (*.%1)").arg(format));
@@ -1,3 +1,4 @@
+#include "commandLine.hh"
 #include "RgbaComposer.hh"
 
 #include <QApplication>
@@ -6,6 +7,10 @@ int main(int argc, char *argv[])
 {
   QCoreApplication::setOrganizationName("ExclusiveOrange");
   QCoreApplication::setApplicationName("RGBA Composer");
+
+  if (isCommandLine(argc, argv))
+    return runCommandLine(argc, argv);
+
   QApplication a(argc, argv);
   RgbaComposer w;
   w.show();
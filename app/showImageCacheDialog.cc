@@ -0,0 +1,80 @@
+#include "showImageCacheDialog.hh"
+
+#include "ImageCache.hh"
+#include "Settings.hh"
+
+#include <QtWidgets>
+
+namespace
+{
+  QString
+  toMiB(qint64 bytes)
+  {
+    return QString::number(double(bytes) / (1024 * 1024), 'f', 1) + " MiB";
+  }
+}
+
+void
+showImageCacheDialog(std::shared_ptr<ImageCache> imageCache, std::shared_ptr<Settings> settings, QWidget *parent)
+{
+  QDialog dialog(parent);
+  dialog.setWindowTitle("Image cache");
+
+  auto layout = new QVBoxLayout(&dialog);
+
+  auto statsLabel = new QLabel(&dialog);
+  layout->addWidget(statsLabel);
+
+  auto entryList = new QTreeWidget(&dialog);
+  entryList->setHeaderLabels({"file", "size", "memory", "file modified"});
+  entryList->setRootIsDecorated(false);
+  layout->addWidget(entryList);
+
+  auto budgetLayout = new QHBoxLayout;
+  budgetLayout->addWidget(new QLabel("memory budget (MiB):"));
+  auto budget = new QSpinBox(&dialog);
+  budget->setRange(0, 1024 * 1024);
+  budget->setValue(settings->getImageCacheBudgetMiB());
+  budgetLayout->addWidget(budget);
+  budgetLayout->addStretch();
+  layout->addLayout(budgetLayout);
+
+  auto buttons = new QDialogButtonBox(QDialogButtonBox::Close, &dialog);
+  auto clearButton = buttons->addButton("Clear", QDialogButtonBox::ActionRole);
+  layout->addWidget(buttons);
+
+  auto refresh = [=]{
+    const ImageCache::Stats stats = imageCache->getStats();
+    statsLabel->setText(QString("%1 of %2 used, %3 hits, %4 misses, %5 prefetches, %6 evictions, %7 duplicates")
+                        .arg(toMiB(stats.bytes), toMiB(stats.budgetBytes))
+                        .arg(stats.hits).arg(stats.misses).arg(stats.prefetches).arg(stats.evictions).arg(stats.duplicates));
+
+    entryList->clear();
+    for (const ImageCache::EntryInfo &entry : imageCache->getEntries())
+    {
+      // duplicates share the image, so they are listed with it
+      QStringList paths{QDir::toNativeSeparators(entry.path)};
+      for (const QString &duplicate : entry.duplicates)
+        paths.append(QDir::toNativeSeparators(duplicate));
+
+      entryList->addTopLevelItem(new QTreeWidgetItem({
+        paths.join(", "),
+        QString("%1 x %2").arg(entry.size.width()).arg(entry.size.height()),
+        toMiB(entry.bytes),
+        entry.fileModified.toString(Qt::ISODate)}));
+    }
+    entryList->resizeColumnToContents(0);
+  };
+
+  QObject::connect(clearButton, &QPushButton::clicked, [=](bool){ imageCache->clear(); refresh(); });
+  QObject::connect(budget, QOverload<int>::of(&QSpinBox::valueChanged), [=](int budgetMiB){
+    settings->setImageCacheBudgetMiB(budgetMiB);
+    imageCache->setBudgetBytes(qint64(budgetMiB) * 1024 * 1024);
+    refresh();
+  });
+  QObject::connect(buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
+
+  refresh();
+  dialog.resize(700, 300);
+  dialog.exec();
+}
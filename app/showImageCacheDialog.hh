@@ -0,0 +1,11 @@
+#pragma once
+
+#include <memory>
+
+class ImageCache;
+class QWidget;
+class Settings;
+
+// Modal dialog listing what the image cache holds, with its hit/miss counters, memory budget and a button to empty it.
+void
+showImageCacheDialog(std::shared_ptr<ImageCache>, std::shared_ptr<Settings>, QWidget *parent);
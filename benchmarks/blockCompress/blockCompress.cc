@@ -0,0 +1,215 @@
+// Compares writing a composed image as DDS, in each block format and quality, with encoding it as PNG: time, file
+// size and, for DDS, the PSNR of the decoded blocks over the channels each format keeps.
+//
+// usage: blockCompress [size=4096] [threads=0] [repeats=3]
+//
+// The image is synthetic: smooth gradients with a little noise in every channel, each channel different, as
+// channel-packed textures are.
+
+#include "BlockCompress.hh"
+#include "DdsFile.hh"
+#include "PngEncoder.hh"
+#include "TilePool.hh"
+
+#include <QBuffer>
+#include <QImage>
+#include <QImageWriter>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+
+namespace
+{
+  QImage
+  makeSyntheticImage(int size)
+  {
+    QImage image(size, size, QImage::Format_ARGB32);
+    for (int y = 0; y < size; ++y)
+    {
+      auto *row = (QRgb*)image.scanLine(y);
+      for (int x = 0; x < size; ++x)
+      {
+        quint32 hash = (quint32(x) * 73856093u) ^ (quint32(y) * 19349663u);
+        hash ^= hash >> 13;
+        hash *= 0x5bd1e995u;
+        hash ^= hash >> 15;
+
+        const int r = (x * 255 / size + (hash & 7)) & 255;
+        const int g = int(127.5 + 120 * std::sin(x * 0.01 + y * 0.02)) + ((hash >> 3) & 3);
+        const int b = ((x ^ y) >> 4 & 1) ? 230 - int((hash >> 6) & 15) : 25 + int((hash >> 6) & 15);
+        const int a = (y * 255 / size + ((hash >> 10) & 7)) & 255;
+        row[x] = qRgba(r, std::min(g, 255), b, a);
+      }
+    }
+    return image;
+  }
+
+  double
+  timeMs(const std::function<void()> &fn, int repeats)
+  {
+    double best = 0;
+    for (int repeat = 0; repeat < repeats; ++repeat)
+    {
+      const auto start = std::chrono::steady_clock::now();
+      fn();
+      const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      best = repeat ? std::min(best, ms) : ms;
+    }
+    return best;
+  }
+
+  // decoders for what BlockCompress writes: BC4 blocks and BC7 blocks of mode 6
+
+  void
+  decodeBc4(const uchar *block, quint8 (&values)[16])
+  {
+    const int e0 = block[0], e1 = block[1];
+    int palette[8] = {e0, e1};
+    if (e0 > e1)
+      for (int k = 1; k < 7; ++k)
+        palette[k + 1] = ((7 - k) * e0 + k * e1 + 3) / 7;
+    else
+    {
+      for (int k = 1; k < 5; ++k)
+        palette[k + 1] = ((5 - k) * e0 + k * e1 + 2) / 5;
+      palette[6] = 0;
+      palette[7] = 255;
+    }
+
+    quint64 bits = 0;
+    for (int b = 0; b < 6; ++b)
+      bits |= quint64(block[2 + b]) << (8 * b);
+    for (int i = 0; i < 16; ++i)
+      values[i] = quint8(palette[(bits >> (3 * i)) & 7]);
+  }
+
+  void
+  decodeBc7Mode6(const uchar *block, quint8 (&texels)[16][4])
+  {
+    int position = 0;
+    const auto read = [&](int bits){
+      int value = 0;
+      for (int i = 0; i < bits; ++i, ++position)
+        value |= ((block[position >> 3] >> (position & 7)) & 1) << i;
+      return value;
+    };
+
+    if (read(7) != 1 << 6)
+    {
+      std::fprintf(stderr, "not a mode 6 block\n");
+      std::exit(1);
+    }
+    int endpoints[2][4];
+    for (int c = 0; c < 4; ++c)
+      for (int e : {0, 1})
+        endpoints[e][c] = read(7) << 1;
+    for (int e : {0, 1})
+    {
+      const int pBit = read(1);
+      for (int c = 0; c < 4; ++c)
+        endpoints[e][c] |= pBit;
+    }
+
+    constexpr int weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+    for (int i = 0; i < 16; ++i)
+    {
+      const int w = weights[read(i == 0 ? 3 : 4)];
+      for (int c = 0; c < 4; ++c)
+        texels[i][c] = quint8(((64 - w) * endpoints[0][c] + w * endpoints[1][c] + 32) >> 6);
+    }
+  }
+
+  // over the channels format keeps; RGBA order
+  double
+  getPsnr(const QImage &image, const QByteArray &blocks, BlockFormat format)
+  {
+    const int blocksX = (image.width() + 3) / 4;
+    const int blockBytes = BlockCompress::getBlockBytes(format);
+    const int channels = format == BlockFormat::Bc7 ? 4 : format == BlockFormat::Bc5 ? 2 : 1;
+
+    double squaredError = 0;
+    for (int y = 0; y < image.height(); ++y)
+    {
+      const auto *row = (const QRgb*)image.constScanLine(y);
+      for (int x = 0; x < image.width(); ++x)
+      {
+        const uchar *block = (const uchar*)blocks.constData() + qsizetype(y / 4 * blocksX + x / 4) * blockBytes;
+        const int texel = y % 4 * 4 + x % 4;
+
+        quint8 decoded[4]{};
+        if (format == BlockFormat::Bc7)
+        {
+          quint8 texels[16][4];
+          decodeBc7Mode6(block, texels);
+          std::copy(texels[texel], texels[texel] + 4, decoded);
+        }
+        else
+          for (int c = 0; c < channels; ++c)
+          {
+            quint8 values[16];
+            decodeBc4(block + c * 8, values);
+            decoded[c] = values[texel];
+          }
+
+        const int original[4] = {qRed(row[x]), qGreen(row[x]), qBlue(row[x]), qAlpha(row[x])};
+        for (int c = 0; c < channels; ++c)
+          squaredError += (decoded[c] - original[c]) * (decoded[c] - original[c]);
+      }
+    }
+
+    const double mse = squaredError / (double(image.width()) * image.height() * channels);
+    return mse > 0 ? 10 * std::log10(255.0 * 255.0 / mse) : INFINITY;
+  }
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  const int size = argc > 1 ? std::atoi(argv[1]) : 4096;
+  TilePool pool(argc > 2 ? std::atoi(argv[2]) : 0);
+  const int repeats = std::max(1, argc > 3 ? std::atoi(argv[3]) : 3);
+  if (size <= 0)
+  {
+    std::fprintf(stderr, "bad size\n");
+    return 1;
+  }
+
+  const QImage image = makeSyntheticImage(size);
+  const double megapixels = double(size) * size / 1e6;
+  std::printf("%dx%d, %d threads, best of %d\n\n", size, size, pool.getThreadCount(), repeats);
+  std::printf("%-4s %-7s %10s %10s %12s %8s\n", "", "", "ms", "MPix/s", "bytes", "PSNR");
+
+  // PNG as saveImage() writes it by default, and through QImageWriter; into memory so disk speed doesn't count
+  qint64 pngBytes = 0;
+  const double pngMs = timeMs([&]{
+    QString error;
+    pngBytes = encodePng(image, SaveOptions().pngLevel, SaveOptions().pngStrategy, pool, error).size();
+  }, repeats);
+  std::printf("%-4s %-7s %10.1f %10.1f %12lld %8s\n", "png", "", pngMs, megapixels / pngMs * 1000, pngBytes, "lossless");
+
+  qint64 qtPngBytes = 0;
+  const double qtPngMs = timeMs([&]{
+    QBuffer buffer;
+    buffer.open(QIODevice::WriteOnly);
+    QImageWriter writer(&buffer, "png");
+    writer.write(image);
+    qtPngBytes = buffer.size();
+  }, repeats);
+  std::printf("%-4s %-7s %10.1f %10.1f %12lld %8s\n", "png", "qt", qtPngMs, megapixels / qtPngMs * 1000, qtPngBytes, "lossless");
+
+  const std::pair<BlockFormat, const char *> formats[] = {{BlockFormat::Bc7, "bc7"}, {BlockFormat::Bc5, "bc5"}, {BlockFormat::Bc4, "bc4"}};
+  const std::pair<BlockQuality, const char *> qualities[] = {{BlockQuality::Fast, "fast"}, {BlockQuality::Normal, "normal"}, {BlockQuality::Best, "best"}};
+  for (const auto &[format, formatName] : formats)
+    for (const auto &[quality, qualityName] : qualities)
+    {
+      QByteArray dds;
+      const double ms = timeMs([&]{ dds = encodeDds(image, {}, format, quality, pool); }, repeats);
+      const QByteArray blocks = BlockCompress::encode(image, format, quality, pool);
+      std::printf("%-4s %-7s %10.1f %10.1f %12lld %8.2f\n", formatName, qualityName, ms, megapixels / ms * 1000, qint64(dds.size()), getPsnr(image, blocks, format));
+    }
+
+  return 0;
+}
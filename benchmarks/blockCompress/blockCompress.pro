@@ -0,0 +1,11 @@
+QT       += core gui
+
+CONFIG += c++latest console
+CONFIG -= app_bundle
+
+TARGET = blockCompress
+
+include(../../engine/engine.pri)
+
+SOURCES += \
+    blockCompress.cc
@@ -0,0 +1,99 @@
+// Measures how composition scales with the number of worker threads.
+//
+// usage: composeScaling [size=8192] [maxThreads=hardware threads] [repeats=3]
+//
+// Composes a size x size image from four synthetic inputs (one channel inverted) with 1..maxThreads threads,
+// prints the best time of each, and checks that every thread count produced the same pixels.
+
+#include "ComposeKernel.hh"
+#include "TilePool.hh"
+
+#include <QImage>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+namespace
+{
+  QImage
+  makeNoise(int size, unsigned seed)
+  {
+    QImage image(size, size, QImage::Format_ARGB32);
+    std::mt19937 rng(seed);
+    for (int y = 0; y < size; ++y)
+    {
+      auto *row = (quint32*)image.scanLine(y);
+      for (int x = 0; x < size; ++x)
+        row[x] = rng();
+    }
+    return image;
+  }
+
+  bool
+  samePixels(const QImage &a, const QImage &b)
+  {
+    if (a.size() != b.size())
+      return false;
+    for (int y = 0; y < a.height(); ++y)
+      if (memcmp(a.constScanLine(y), b.constScanLine(y), a.width() * 4) != 0)
+        return false;
+    return true;
+  }
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  const int size = argc > 1 ? std::atoi(argv[1]) : 8192;
+  const int maxThreads = argc > 2 ? std::atoi(argv[2]) : TilePool::resolveThreadCount(0);
+  const int repeats = argc > 3 ? std::atoi(argv[3]) : 3;
+
+  ComposeKernel::LaneSource lanes[4]; // RGBA
+  for (int c : {0, 1, 2, 3})
+  {
+    lanes[c].image = makeNoise(size, c + 1);
+    lanes[c].inputChannel = (c + 1) % 4;
+  }
+  lanes[1].invert = true;
+
+  const ComposeKernel::Plan plan = ComposeKernel::makePlan(QSize(size, size), lanes);
+
+  std::printf("%dx%d, %s\n", size, size, plan.mergeFn ? "vector merge" : "scalar lanes");
+  std::printf("threads      ms  speedup\n");
+
+  QImage reference;
+  double singleThreadMs = 0;
+
+  for (int threads = 1; threads <= maxThreads; ++threads)
+  {
+    TilePool pool(threads);
+    double bestMs = 0;
+    QImage result;
+
+    for (int repeat = 0; repeat < repeats; ++repeat)
+    {
+      const auto start = std::chrono::steady_clock::now();
+      result = ComposeKernel::composeImage(plan, pool);
+      const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      if (repeat == 0 || ms < bestMs)
+        bestMs = ms;
+    }
+
+    if (threads == 1)
+    {
+      reference = result;
+      singleThreadMs = bestMs;
+    }
+    else if (!samePixels(reference, result))
+    {
+      std::printf("output with %d threads differs from 1 thread\n", threads);
+      return 1;
+    }
+
+    std::printf("%7d %7.1f %8.2f\n", threads, bestMs, singleThreadMs / bestMs);
+  }
+
+  return 0;
+}
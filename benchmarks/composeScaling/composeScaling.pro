@@ -0,0 +1,11 @@
+QT       += core gui
+
+CONFIG += c++latest console
+CONFIG -= app_bundle
+
+TARGET = composeScaling
+
+include(../../engine/engine.pri)
+
+SOURCES += \
+    composeScaling.cc
@@ -0,0 +1,300 @@
+// Times the decode, compose and encode stages separately, and the live preview, on reproducible synthetic inputs and
+// writes the results as JSON, so runs from different releases can be compared.
+//
+// usage: stages [--sizes 1024,4096,8192,16384] [--repeats 3] [--format png] [--threads 0] [--output results.json]
+
+#include "compose.hh"
+#include "ComposeKernel.hh"
+#include "ComposeSimd.hh"
+#include "PngEncoder.hh"
+#include "Preview.hh"
+#include "TilePool.hh"
+
+#include <QBuffer>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QFile>
+#include <QImageWriter>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <vector>
+
+namespace
+{
+  constexpr int previewSize = 320; // as in the GUI
+
+  struct Mapping
+  {
+    const char *name;
+    CompositionSpec (*makeSpec)(const QStringList &files, QSize size);
+  };
+
+  ChannelSpec
+  constant(quint8 value)
+  {
+    ChannelSpec channel;
+    channel.constant = value;
+    return channel;
+  }
+
+  ChannelSpec
+  image(const QString &filename, int inputChannel, bool invert = false)
+  {
+    ChannelSpec channel;
+    channel.source = InputSource::Image;
+    channel.filename = filename;
+    channel.inputChannel = inputChannel;
+    channel.invert = invert;
+    return channel;
+  }
+
+  const Mapping mappings[] = {
+    {"all-constant", [](const QStringList &, QSize size){
+      CompositionSpec spec{{constant(10), constant(20), constant(30), constant(255)}, size};
+      return spec;
+    }},
+    {"one-file", [](const QStringList &files, QSize){
+      CompositionSpec spec{{image(files[0], 0), image(files[0], 1), image(files[0], 2), image(files[0], 3)}, {}};
+      return spec;
+    }},
+    {"four-files", [](const QStringList &files, QSize){
+      CompositionSpec spec{{image(files[0], 0), image(files[1], 1), image(files[2], 2), image(files[3], 3)}, {}};
+      return spec;
+    }},
+    {"four-files-inverted", [](const QStringList &files, QSize){
+      CompositionSpec spec{{image(files[0], 0, true), image(files[1], 1, true), image(files[2], 2, true), image(files[3], 3, true)}, {}};
+      return spec;
+    }}};
+
+  // smooth gradients plus a little hashed noise, so codecs see something closer to a real texture than pure noise
+  QImage
+  makeSyntheticImage(int size, unsigned seed)
+  {
+    QImage image(size, size, QImage::Format_ARGB32);
+    for (int y = 0; y < size; ++y)
+    {
+      auto *row = (quint32*)image.scanLine(y);
+      for (int x = 0; x < size; ++x)
+      {
+        quint32 hash = (quint32(x) * 73856093u) ^ (quint32(y) * 19349663u) ^ (seed * 83492791u);
+        hash ^= hash >> 13;
+        hash *= 0x5bd1e995u;
+        hash ^= hash >> 15;
+
+        const int r = (x * 255 / size + (hash & 7)) & 255;
+        const int g = (y * 255 / size + ((hash >> 3) & 7)) & 255;
+        const int b = ((x + y) * 127 / size + ((hash >> 6) & 7)) & 255;
+        const int a = (255 - (x * 127 / size) + ((hash >> 9) & 7)) & 255;
+        row[x] = qRgba(r, g, b, a);
+      }
+    }
+    return image;
+  }
+
+  const char *
+  getLayoutName(QImage::Format format)
+  {
+    switch (format)
+    {
+      case QImage::Format_RGB888: return "RGB888";
+      case QImage::Format_RGBA8888: return "RGBA8888";
+      default: return "ARGB32";
+    }
+  }
+
+  double
+  median(std::vector<double> values)
+  {
+    std::sort(values.begin(), values.end());
+    const size_t n = values.size();
+    return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+  }
+
+  double
+  timeMs(const std::function<void()> &fn)
+  {
+    const auto start = std::chrono::steady_clock::now();
+    fn();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  QCoreApplication app(argc, argv);
+
+  QCommandLineParser parser;
+  parser.addHelpOption();
+  const QCommandLineOption sizesOption("sizes", "Comma-separated square image sizes.", "list", "1024,4096,8192,16384");
+  const QCommandLineOption repeatsOption("repeats", "Runs per measurement; the median is reported.", "n", "3");
+  const QCommandLineOption formatOption("format", "Image format of the inputs and the encoded output.", "format", "png");
+  const QCommandLineOption threadsOption("threads", "Worker threads (0 = one per CPU core).", "n", "0");
+  const QCommandLineOption outputOption("output", "Write JSON here instead of to standard output.", "file");
+  parser.addOptions({sizesOption, repeatsOption, formatOption, threadsOption, outputOption});
+  parser.process(app);
+
+  const int repeats = std::max(1, parser.value(repeatsOption).toInt());
+  const QString format = parser.value(formatOption);
+  TilePool pool(parser.value(threadsOption).toInt());
+
+  QTemporaryDir inputDir;
+  if (!inputDir.isValid())
+  {
+    std::fprintf(stderr, "couldn't create a temporary directory\n");
+    return 1;
+  }
+
+  QJsonArray results;
+
+  for (const QString &sizeText : parser.value(sizesOption).split(','))
+  {
+    const int size = sizeText.toInt();
+    if (size <= 0)
+      continue;
+
+    // inputs are written once per size; generating them isn't part of any measurement
+    QStringList files;
+    for (unsigned seed = 1; seed <= 4; ++seed)
+    {
+      const QString filename = inputDir.filePath(QString("input%1_%2.%3").arg(seed).arg(size).arg(format));
+      QImageWriter writer(filename, format.toLatin1());
+      if (!writer.write(makeSyntheticImage(size, seed)))
+      {
+        std::fprintf(stderr, "couldn't write %s: %s\n", qPrintable(filename), qPrintable(writer.errorString()));
+        return 1;
+      }
+      files.append(filename);
+    }
+
+    for (const Mapping &mapping : mappings)
+    {
+      const CompositionSpec spec = mapping.makeSpec(files, QSize(size, size));
+
+      QStringList distinctFiles;
+      for (const ChannelSpec &channel : spec.channels)
+        if (channel.source == InputSource::Image && !distinctFiles.contains(channel.filename))
+          distinctFiles.append(channel.filename);
+
+      std::vector<double> decodeMs, composeMs, encodeMs, parallelEncodeMs, thumbnailMs, previewUpdateMs;
+      qint64 encodedBytes = 0;
+      QImage::Format layout = QImage::Format_ARGB32;
+      qint64 composedBytes = 0;
+
+      for (int repeat = 0; repeat < repeats; ++repeat)
+      {
+        // decode: every distinct file concurrently, as compose() does
+        std::map<QString, QImage> images;
+        std::vector<QImage> decoded(distinctFiles.size());
+        decodeMs.push_back(timeMs([&]{
+          pool.run(int(distinctFiles.size()), [&](int i){
+            QString error;
+            decoded[i] = loadInputImage(distinctFiles[i], error);
+          });
+        }));
+        for (int i = 0; i < distinctFiles.size(); ++i)
+          images[distinctFiles[i]] = decoded[i];
+
+        // compose: preparing the lanes and the kernels, on already decoded inputs, into the layout compose() would
+        // pick for the encoder
+        ComposeKernel::LaneSource lanes[4]; // RGBA
+        for (int c : {0, 1, 2, 3})
+          if (spec.channels[c].source == InputSource::Image)
+          {
+            lanes[c].image = images[spec.channels[c].filename];
+            lanes[c].inputChannel = spec.channels[c].inputChannel;
+            lanes[c].invert = spec.channels[c].invert;
+          }
+          else
+            lanes[c].constant = spec.channels[c].constant;
+
+        QImage composition;
+        composeMs.push_back(timeMs([&]{
+          ComposeKernel::prepareLanes(lanes, pool);
+          layout = getComposeFormat(format.toLatin1(), lanes[3].image.isNull() && lanes[3].constant == 255);
+          composition = ComposeKernel::composeImage(ComposeKernel::makePlan(QSize(size, size), lanes, layout), pool);
+        }));
+        composedBytes = composition.sizeInBytes();
+
+        // preview: reducing the inputs to thumbnails once, then redrawing after one channel changes
+        Preview preview;
+        const QSize emptySize = Preview::getPreviewSize(QSize(size, size), previewSize);
+        thumbnailMs.push_back(timeMs([&]{
+          for (const QString &filename : distinctFiles)
+            preview.setThumbnail(filename, Preview::makeThumbnail(images[filename], Preview::getPreviewSize(QSize(size, size), previewSize), pool));
+        }));
+        preview.update(spec, emptySize);
+        CompositionSpec changed = spec;
+        changed.channels[0].invert = !changed.channels[0].invert;
+        changed.channels[0].constant = quint8(changed.channels[0].constant + 1);
+        previewUpdateMs.push_back(timeMs([&]{ preview.update(changed, emptySize); }));
+
+        // encode: into memory, so disk speed doesn't count
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+        encodeMs.push_back(timeMs([&]{
+          QImageWriter writer(&buffer, format.toLatin1());
+          writer.write(composition);
+        }));
+        encodedBytes = buffer.size();
+
+        // and for PNG with encodePng(), as saveImage() does by default
+        if (format == "png" && canEncodePng(composition.format()))
+          parallelEncodeMs.push_back(timeMs([&]{
+            QString error;
+            encodePng(composition, SaveOptions().pngLevel, SaveOptions().pngStrategy, pool, error);
+          }));
+      }
+
+      results.append(QJsonObject{
+        {"size", size},
+        {"mapping", mapping.name},
+        {"decodedFiles", int(distinctFiles.size())},
+        {"decodeMs", median(decodeMs)},
+        {"composeMs", median(composeMs)},
+        {"layout", getLayoutName(layout)},
+        {"composedBytes", composedBytes},
+        {"encodeMs", median(encodeMs)},
+        {"encodedBytes", encodedBytes},
+        {"parallelEncodeMs", parallelEncodeMs.empty() ? QJsonValue() : median(parallelEncodeMs)},
+        {"thumbnailMs", median(thumbnailMs)},
+        {"previewUpdateMs", median(previewUpdateMs)}});
+
+      std::fprintf(stderr, "%5d %-20s decode %8.1f ms  compose %7.1f ms (%-8s %6.1f MiB)  encode %8.1f ms (parallel %8.1f ms)  thumbnails %7.1f ms  preview update %5.2f ms\n",
+                   size, mapping.name, median(decodeMs), median(composeMs), getLayoutName(layout), composedBytes / 1048576.0, median(encodeMs),
+                   parallelEncodeMs.empty() ? 0.0 : median(parallelEncodeMs), median(thumbnailMs), median(previewUpdateMs));
+    }
+  }
+
+  const QJsonObject report{
+    {"qtVersion", qVersion()},
+    {"threads", pool.getThreadCount()},
+    {"mergePath", ComposeSimd::getBestMergeName()},
+    {"format", format},
+    {"repeats", repeats},
+    {"date", QDateTime::currentDateTimeUtc().toString(Qt::ISODate)},
+    {"results", results}};
+  const QByteArray json = QJsonDocument(report).toJson();
+
+  if (parser.isSet(outputOption))
+  {
+    QFile file(parser.value(outputOption));
+    if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size())
+    {
+      std::fprintf(stderr, "couldn't write %s\n", qPrintable(parser.value(outputOption)));
+      return 1;
+    }
+  }
+  else
+    std::fwrite(json.constData(), 1, size_t(json.size()), stdout);
+
+  return 0;
+}
@@ -0,0 +1,607 @@
+#include "BlockCompress.hh"
+
+#include "Progress.hh"
+#include "TilePool.hh"
+
+#include <QRgb>
+
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cmath>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BLOCK_COMPRESS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+  // RGBA texels of a block, row by row
+  struct Block
+  {
+    quint8 texels[16][4];
+  };
+
+  void
+  loadBlock(const QImage &image, int blockX, int blockY, Block &block)
+  {
+    const int lastX = image.width() - 1;
+    const int lastY = image.height() - 1;
+    for (int y = 0; y < 4; ++y)
+    {
+      const auto *row = (const QRgb*)image.constScanLine(std::min(blockY * 4 + y, lastY));
+      for (int x = 0; x < 4; ++x)
+      {
+        const QRgb pixel = row[std::min(blockX * 4 + x, lastX)];
+        quint8 *texel = block.texels[y * 4 + x];
+        texel[0] = quint8(qRed(pixel));
+        texel[1] = quint8(qGreen(pixel));
+        texel[2] = quint8(qBlue(pixel));
+        texel[3] = quint8(qAlpha(pixel));
+      }
+    }
+  }
+
+  // appends values to a zeroed block least significant bit first, which is how BC blocks are laid out
+  class BitWriter
+  {
+  public:
+    explicit BitWriter(uchar *bytes) : bytes{bytes} {}
+
+    void
+    write(quint32 value, int bits)
+    {
+      for (int i = 0; i < bits; ++i, ++position)
+        if ((value >> i) & 1)
+          bytes[position >> 3] |= uchar(1 << (position & 7));
+    }
+
+  private:
+    uchar *const bytes;
+    int position = 0;
+  };
+
+  // BC4: two 8-bit endpoints and a 3-bit index per texel
+
+  void
+  makeBc4Palette(int e0, int e1, int (&palette)[8])
+  {
+    palette[0] = e0;
+    palette[1] = e1;
+    if (e0 > e1)
+      for (int k = 1; k < 7; ++k)
+        palette[k + 1] = ((7 - k) * e0 + k * e1 + 3) / 7;
+    else
+    {
+      for (int k = 1; k < 5; ++k)
+        palette[k + 1] = ((5 - k) * e0 + k * e1 + 2) / 5;
+      palette[6] = 0;
+      palette[7] = 255;
+    }
+  }
+
+  // the nearest palette entry of each value; returns the summed squared error
+  int
+  findBc4Indices(const quint8 (&values)[16], const int (&palette)[8], quint8 (&indices)[16])
+  {
+#ifdef BLOCK_COMPRESS_SSE2
+    // all 16 values at once: |v - p| with saturating subtractions, keeping the first entry of the smallest
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i v = _mm_loadu_si128((const __m128i*)values);
+    const auto distance = [&](int k){
+      const __m128i p = _mm_set1_epi8(char(palette[k]));
+      return _mm_or_si128(_mm_subs_epu8(v, p), _mm_subs_epu8(p, v));
+    };
+
+    __m128i best = distance(0);
+    __m128i bestIndex = zero;
+    for (int k = 1; k < 8; ++k)
+    {
+      const __m128i d = distance(k);
+      const __m128i closer = _mm_andnot_si128(_mm_cmpeq_epi8(_mm_subs_epu8(best, d), zero), _mm_set1_epi8(-1));
+      best = _mm_min_epu8(best, d);
+      bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi8(char(k))), _mm_andnot_si128(closer, bestIndex));
+    }
+    _mm_storeu_si128((__m128i*)indices, bestIndex);
+
+    const __m128i low = _mm_unpacklo_epi8(best, zero);
+    const __m128i high = _mm_unpackhi_epi8(best, zero);
+    __m128i sums = _mm_add_epi32(_mm_madd_epi16(low, low), _mm_madd_epi16(high, high));
+    sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(1, 0, 3, 2)));
+    sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sums);
+#else
+    int error = 0;
+    for (int i = 0; i < 16; ++i)
+    {
+      int bestDistance = INT_MAX;
+      for (int k = 0; k < 8; ++k)
+        if (const int d = std::abs(values[i] - palette[k]); d < bestDistance)
+        {
+          bestDistance = d;
+          indices[i] = quint8(k);
+        }
+      error += bestDistance * bestDistance;
+    }
+    return error;
+#endif
+  }
+
+  void
+  encodeBc4(const Block &block, int channel, BlockQuality quality, uchar *out)
+  {
+    quint8 values[16];
+    int min = 255, max = 0;
+    int innerMin = 255, innerMax = 0; // without 0 and 255, which the 6-value palette has anyway
+    for (int i = 0; i < 16; ++i)
+    {
+      const int v = values[i] = block.texels[i][channel];
+      min = std::min(min, v);
+      max = std::max(max, v);
+      if (v != 0 && v != 255)
+      {
+        innerMin = std::min(innerMin, v);
+        innerMax = std::max(innerMax, v);
+      }
+    }
+
+    int bestError = INT_MAX;
+    int bestEndpoints[2]{};
+    quint8 bestIndices[16]{};
+    const auto tryEndpoints = [&](int e0, int e1){
+      int palette[8];
+      quint8 indices[16];
+      makeBc4Palette(e0, e1, palette);
+      if (const int error = findBc4Indices(values, palette, indices); error < bestError)
+      {
+        bestError = error;
+        bestEndpoints[0] = e0;
+        bestEndpoints[1] = e1;
+        std::copy(std::begin(indices), std::end(indices), bestIndices);
+      }
+    };
+
+    // 8 values spanning the block; a flat block ends up with e0 == e1, which is the 6-value palette with both ends equal
+    tryEndpoints(max, min);
+
+    if (quality != BlockQuality::Fast && bestError > 0)
+    {
+      // 6 values between the ends plus exact 0 and 255, for blocks that hit those besides a narrower range
+      if ((min == 0 || max == 255) && innerMin <= innerMax)
+        tryEndpoints(innerMin, innerMax);
+
+      // moving the ends inwards often fits the values in between better than the extremes themselves
+      const int reach = quality == BlockQuality::Best ? 4 : 1;
+      for (int a = 0; a <= reach; ++a)
+        for (int b = 0; b <= reach; ++b)
+          if ((a || b) && max - a > min + b)
+            tryEndpoints(max - a, min + b);
+    }
+
+    out[0] = uchar(bestEndpoints[0]);
+    out[1] = uchar(bestEndpoints[1]);
+    quint64 bits = 0;
+    for (int i = 0; i < 16; ++i)
+      bits |= quint64(bestIndices[i]) << (3 * i);
+    for (int b = 0; b < 6; ++b)
+      out[2 + b] = uchar(bits >> (8 * b));
+  }
+
+  // BC7 mode 6: RGBA endpoints of 7 bits plus a shared lowest bit (the p-bit) each, and a 4-bit index per texel
+
+  constexpr int bc7Weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+  // the index of the nearest of bc7Weights to each weight 0..64
+  constexpr std::array<quint8, 65> nearestBc7Index = []{
+    std::array<quint8, 65> table{};
+    for (int w = 0; w <= 64; ++w)
+      for (int i = 1; i < 16; ++i)
+        if (std::abs(bc7Weights[i] - w) < std::abs(bc7Weights[table[w]] - w))
+          table[w] = quint8(i);
+    return table;
+  }();
+
+  struct Bc7Params
+  {
+    int neighbors; // indices either side of the projected one that are checked; 15 checks all
+    bool allPBits; // all four p-bit pairs rather than the nearest for each endpoint
+    int refinements;
+    bool boxSeed; // also start from the corners of the block's bounding box
+  };
+
+  constexpr Bc7Params bc7Params[] = {
+    {0, false, 1, false}, // Fast
+    {1, true, 2, false}, // Normal
+    {15, true, 4, true}}; // Best
+
+  struct Bc7Candidate
+  {
+    int quantized[2][4]; // 7 bits each
+    int pBits[2];
+    quint8 indices[16];
+    int error = INT_MAX;
+  };
+
+  // the 8-bit value of a quantized endpoint channel
+  int
+  expandBc7(int quantized, int pBit)
+  {
+    return (quantized << 1) | pBit;
+  }
+
+  int
+  quantizeBc7(float value, int pBit)
+  {
+    return std::clamp(int(std::lround((value - float(pBit)) / 2)), 0, 127);
+  }
+
+#ifdef BLOCK_COMPRESS_SSE2
+  // how many entries past the first of a texel's range findBc7Index() is worth it from
+  constexpr int bc7VectorEntries = 4;
+
+  // the smaller of each 32-bit lane; SSE2 has no _mm_min_epi32
+  __m128i
+  min32(__m128i a, __m128i b)
+  {
+    const __m128i less = _mm_cmplt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(less, a), _mm_andnot_si128(less, b));
+  }
+
+  // The nearest of palette entries [first, last] to texel and its squared error, as the scalar loop finds them: all 16
+  // entries at once, pairs of them being 16-bit channels in one vector, with each error and index packed into one key
+  // so that the smallest key is the nearest entry and the first of equals.
+  int
+  findBc7Index(const __m128i (&palettePairs)[8], const quint8 *texel, int first, int last, quint8 &index)
+  {
+    const __m128i t = _mm_setr_epi16(texel[0], texel[1], texel[2], texel[3], texel[0], texel[1], texel[2], texel[3]);
+    const __m128i firsts = _mm_set1_epi32(first), lasts = _mm_set1_epi32(last);
+    const __m128i outsideKey = _mm_set1_epi32(INT_MAX);
+
+    __m128i best = outsideKey;
+    for (int quad = 0; quad < 4; ++quad)
+    {
+      // [rg, ba] of two entries in each, then summed per entry
+      const __m128i d0 = _mm_sub_epi16(t, palettePairs[quad * 2]);
+      const __m128i d1 = _mm_sub_epi16(t, palettePairs[quad * 2 + 1]);
+      const __m128 m0 = _mm_castsi128_ps(_mm_madd_epi16(d0, d0));
+      const __m128 m1 = _mm_castsi128_ps(_mm_madd_epi16(d1, d1));
+      const __m128i errors = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(m0, m1, _MM_SHUFFLE(2, 0, 2, 0))), _mm_castps_si128(_mm_shuffle_ps(m0, m1, _MM_SHUFFLE(3, 1, 3, 1))));
+
+      const __m128i entries = _mm_setr_epi32(quad * 4, quad * 4 + 1, quad * 4 + 2, quad * 4 + 3);
+      const __m128i outside = _mm_or_si128(_mm_cmplt_epi32(entries, firsts), _mm_cmpgt_epi32(entries, lasts));
+      best = min32(best, _mm_or_si128(_mm_or_si128(_mm_slli_epi32(errors, 4), entries), _mm_and_si128(outside, outsideKey)));
+    }
+    best = min32(best, _mm_shuffle_epi32(best, _MM_SHUFFLE(1, 0, 3, 2)));
+    best = min32(best, _mm_shuffle_epi32(best, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    const int key = _mm_cvtsi128_si32(best);
+    index = quint8(key & 15);
+    return key >> 4;
+  }
+#endif
+
+  // the nearest palette entry of each texel; returns the summed squared error
+  int
+  findBc7Indices(const Block &block, const int (&values)[2][4], int neighbors, quint8 (&indices)[16])
+  {
+    int palette[16][4];
+    for (int i = 0; i < 16; ++i)
+      for (int c = 0; c < 4; ++c)
+        palette[i][c] = ((64 - bc7Weights[i]) * values[0][c] + bc7Weights[i] * values[1][c] + 32) >> 6;
+
+#ifdef BLOCK_COMPRESS_SSE2
+    __m128i palettePairs[8];
+    for (int i = 0; i < 8; ++i)
+    {
+      const int (&p)[4] = palette[i * 2], (&q)[4] = palette[i * 2 + 1];
+      palettePairs[i] = _mm_setr_epi16(short(p[0]), short(p[1]), short(p[2]), short(p[3]), short(q[0]), short(q[1]), short(q[2]), short(q[3]));
+    }
+#endif
+
+    int axis[4];
+    int axisLength2 = 0;
+    for (int c = 0; c < 4; ++c)
+    {
+      axis[c] = values[1][c] - values[0][c];
+      axisLength2 += axis[c] * axis[c];
+    }
+
+    int error = 0;
+    for (int t = 0; t < 16; ++t)
+    {
+      const quint8 *texel = block.texels[t];
+
+      // the palette lies close to the line between the endpoints, so the texel's position along it nearly picks
+      // the index
+      int first = 0, last = 15;
+      if (neighbors < 15 && axisLength2 > 0)
+      {
+        int dot = 0;
+        for (int c = 0; c < 4; ++c)
+          dot += (texel[c] - values[0][c]) * axis[c];
+        const int weight = dot <= 0 ? 0 : std::min(64, (128 * dot + axisLength2) / (2 * axisLength2));
+        first = std::max(0, nearestBc7Index[weight] - neighbors);
+        last = std::min(15, nearestBc7Index[weight] + neighbors);
+      }
+
+#ifdef BLOCK_COMPRESS_SSE2
+      // checking every entry at once beats checking a handful one by one
+      if (last - first >= bc7VectorEntries)
+      {
+        error += findBc7Index(palettePairs, texel, first, last, indices[t]);
+        continue;
+      }
+#endif
+
+      int bestError = INT_MAX;
+      for (int i = first; i <= last; ++i)
+      {
+        int e = 0;
+        for (int c = 0; c < 4; ++c)
+          e += (texel[c] - palette[i][c]) * (texel[c] - palette[i][c]);
+        if (e < bestError)
+        {
+          bestError = e;
+          indices[t] = quint8(i);
+        }
+      }
+      error += bestError;
+    }
+    return error;
+  }
+
+  // quantizes endpoints with each p-bit pair params allows, keeping whichever beats best
+  void
+  tryBc7(const Block &block, const float (&endpoints)[2][4], const Bc7Params &params, Bc7Candidate &best)
+  {
+    int pairs[4][2] = {{0, 0}, {0, 1}, {1, 0}, {1, 1}};
+    int pairCount = 4;
+    if (!params.allPBits)
+    {
+      // the p-bit that puts each endpoint nearest to where it should be
+      for (int e : {0, 1})
+      {
+        float errors[2]{};
+        for (int p : {0, 1})
+          for (int c = 0; c < 4; ++c)
+          {
+            const float d = float(expandBc7(quantizeBc7(endpoints[e][c], p), p)) - endpoints[e][c];
+            errors[p] += d * d;
+          }
+        pairs[0][e] = errors[1] < errors[0];
+      }
+      pairCount = 1;
+    }
+
+    for (int pair = 0; pair < pairCount; ++pair)
+    {
+      Bc7Candidate candidate;
+      int values[2][4];
+      for (int e : {0, 1})
+      {
+        candidate.pBits[e] = pairs[pair][e];
+        for (int c = 0; c < 4; ++c)
+        {
+          candidate.quantized[e][c] = quantizeBc7(endpoints[e][c], candidate.pBits[e]);
+          values[e][c] = expandBc7(candidate.quantized[e][c], candidate.pBits[e]);
+        }
+      }
+      candidate.error = findBc7Indices(block, values, params.neighbors, candidate.indices);
+      if (candidate.error < best.error)
+        best = candidate;
+    }
+  }
+
+  // the ends of the block's principal axis, through its mean, as far as its texels reach along it
+  void
+  fitPrincipalAxis(const Block &block, float (&endpoints)[2][4])
+  {
+    float mean[4]{};
+    for (const auto &texel : block.texels)
+      for (int c = 0; c < 4; ++c)
+        mean[c] += texel[c] / 16.0f;
+
+    float covariance[4][4]{};
+    for (const auto &texel : block.texels)
+      for (int i = 0; i < 4; ++i)
+        for (int j = 0; j < 4; ++j)
+          covariance[i][j] += (texel[i] - mean[i]) * (texel[j] - mean[j]);
+
+    // power iteration, from the diagonal of the bounding box
+    float axis[4];
+    for (int c = 0; c < 4; ++c)
+    {
+      int min = 255, max = 0;
+      for (const auto &texel : block.texels)
+      {
+        min = std::min<int>(min, texel[c]);
+        max = std::max<int>(max, texel[c]);
+      }
+      axis[c] = float(max - min) + 1e-3f;
+    }
+    for (int iteration = 0; iteration < 8; ++iteration)
+    {
+      float next[4]{};
+      float length2 = 0;
+      for (int i = 0; i < 4; ++i)
+      {
+        for (int j = 0; j < 4; ++j)
+          next[i] += covariance[i][j] * axis[j];
+        length2 += next[i] * next[i];
+      }
+      if (length2 < 1e-12f)
+        break; // a flat block; both ends stay at the mean
+      for (int c = 0; c < 4; ++c)
+        axis[c] = next[c] / std::sqrt(length2);
+    }
+
+    float axisLength2 = 0;
+    for (float a : axis)
+      axisLength2 += a * a;
+
+    float tMin = 0, tMax = 0;
+    if (axisLength2 > 1e-6f)
+      for (const auto &texel : block.texels)
+      {
+        float t = 0;
+        for (int c = 0; c < 4; ++c)
+          t += (texel[c] - mean[c]) * axis[c];
+        t /= axisLength2;
+        tMin = std::min(tMin, t);
+        tMax = std::max(tMax, t);
+      }
+
+    for (int c = 0; c < 4; ++c)
+    {
+      endpoints[0][c] = std::clamp(mean[c] + tMin * axis[c], 0.0f, 255.0f);
+      endpoints[1][c] = std::clamp(mean[c] + tMax * axis[c], 0.0f, 255.0f);
+    }
+  }
+
+  // the endpoints that fit the texels best in the least-squares sense for the given indices; false if all texels
+  // have the same weight, which leaves them undetermined
+  bool
+  refineBc7(const Block &block, const quint8 (&indices)[16], float (&endpoints)[2][4])
+  {
+    float aa = 0, ab = 0, bb = 0;
+    float ax[4]{}, bx[4]{};
+    for (int t = 0; t < 16; ++t)
+    {
+      const float b = bc7Weights[indices[t]] / 64.0f;
+      const float a = 1 - b;
+      aa += a * a;
+      ab += a * b;
+      bb += b * b;
+      for (int c = 0; c < 4; ++c)
+      {
+        ax[c] += a * block.texels[t][c];
+        bx[c] += b * block.texels[t][c];
+      }
+    }
+
+    const float determinant = aa * bb - ab * ab;
+    if (std::abs(determinant) < 1e-6f)
+      return false;
+
+    for (int c = 0; c < 4; ++c)
+    {
+      endpoints[0][c] = std::clamp((bb * ax[c] - ab * bx[c]) / determinant, 0.0f, 255.0f);
+      endpoints[1][c] = std::clamp((aa * bx[c] - ab * ax[c]) / determinant, 0.0f, 255.0f);
+    }
+    return true;
+  }
+
+  void
+  encodeBc7(const Block &block, BlockQuality quality, uchar *out)
+  {
+    const Bc7Params &params = bc7Params[int(quality)];
+
+    Bc7Candidate best;
+    float endpoints[2][4];
+    fitPrincipalAxis(block, endpoints);
+    tryBc7(block, endpoints, params, best);
+
+    if (params.boxSeed)
+    {
+      for (int c = 0; c < 4; ++c)
+      {
+        endpoints[0][c] = 255;
+        endpoints[1][c] = 0;
+        for (const auto &texel : block.texels)
+        {
+          endpoints[0][c] = std::min<float>(endpoints[0][c], texel[c]);
+          endpoints[1][c] = std::max<float>(endpoints[1][c], texel[c]);
+        }
+      }
+      tryBc7(block, endpoints, params, best);
+    }
+
+    for (int refinement = 0; refinement < params.refinements && best.error > 0; ++refinement)
+    {
+      const int error = best.error;
+      if (!refineBc7(block, best.indices, endpoints))
+        break;
+      tryBc7(block, endpoints, params, best);
+      if (best.error >= error)
+        break;
+    }
+
+    // the first texel's index has an implied top bit of 0; swapping the endpoints mirrors the indices, as the
+    // weights are symmetric
+    if (best.indices[0] & 8)
+    {
+      std::swap(best.quantized[0], best.quantized[1]);
+      std::swap(best.pBits[0], best.pBits[1]);
+      for (quint8 &index : best.indices)
+        index = quint8(15 - index);
+    }
+
+    BitWriter bits(out);
+    bits.write(1 << 6, 7); // mode 6
+    for (int c = 0; c < 4; ++c)
+    {
+      bits.write(quint32(best.quantized[0][c]), 7);
+      bits.write(quint32(best.quantized[1][c]), 7);
+    }
+    bits.write(quint32(best.pBits[0]), 1);
+    bits.write(quint32(best.pBits[1]), 1);
+    bits.write(best.indices[0], 3);
+    for (int i = 1; i < 16; ++i)
+      bits.write(best.indices[i], 4);
+  }
+} // namespace
+
+namespace BlockCompress
+{
+  int
+  getBlockBytes(BlockFormat format)
+  {
+    return format == BlockFormat::Bc4 ? 8 : 16;
+  }
+
+  QByteArray
+  encode(const QImage &image, BlockFormat format, BlockQuality quality, TilePool &pool, Progress *progress)
+  {
+    const int blocksX = (image.width() + 3) / 4;
+    const int blocksY = (image.height() + 3) / 4;
+    const int blockBytes = getBlockBytes(format);
+
+    // zeroed, as BitWriter only sets bits
+    QByteArray data(qsizetype(blocksX) * blocksY * blockBytes, '\0');
+    uchar *bytes = (uchar*)data.data(); // data() detaches, so fetch it once here rather than from the worker threads
+
+    pool.run(blocksY, [&](int blockY){
+      if (progress && progress->isCancelled())
+        return;
+
+      Block block;
+      uchar *out = bytes + qsizetype(blockY) * blocksX * blockBytes;
+      for (int blockX = 0; blockX < blocksX; ++blockX, out += blockBytes)
+      {
+        loadBlock(image, blockX, blockY, block);
+        switch (format)
+        {
+          case BlockFormat::Bc7:
+            encodeBc7(block, quality, out);
+            break;
+          case BlockFormat::Bc5:
+            encodeBc4(block, 0, quality, out);
+            encodeBc4(block, 1, quality, out + 8);
+            break;
+          default:
+            encodeBc4(block, 0, quality, out);
+            break;
+        }
+      }
+
+      if (progress)
+        progress->advance(1);
+    });
+
+    if (progress && progress->isCancelled())
+      return {};
+    return data;
+  }
+}
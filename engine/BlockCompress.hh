@@ -0,0 +1,28 @@
+#pragma once
+
+#include "BlockFormat.hh"
+
+#include <QByteArray>
+#include <QImage>
+
+class Progress;
+class TilePool;
+
+// CPU encoders for the BC4, BC5 and BC7 blocks of Direct3D and Vulkan, as DDS files hold them.
+//
+// BC7 is written in mode 6: one pair of RGBA endpoints of 7 bits and a shared lowest bit each, and 4-bit indices,
+// which suits channel-packed textures whose channels don't follow each other. Endpoints start on the principal axis
+// of the block and are refined by least squares; BC4 endpoints are searched around the block's range. Quality trades
+// how many candidates are tried for time.
+namespace BlockCompress
+{
+  // 8 for BC4, 16 for the others
+  int
+  getBlockBytes(BlockFormat format);
+
+  // The blocks of image, left to right and top to bottom; texels past the right and bottom edges repeat the last
+  // column and row. image is Format_ARGB32 or Format_RGB32. Rows of blocks are spread over the pool and each is
+  // counted into progress, if given. Empty if progress was cancelled.
+  QByteArray
+  encode(const QImage &image, BlockFormat format, BlockQuality quality, TilePool &pool, Progress *progress = nullptr);
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+// GPU block compression of 4 x 4 texels: BC7 keeps RGBA, BC5 red and green (e.g. a two-channel normal map) and BC4
+// red alone (e.g. a mask).
+enum class BlockFormat { Bc7, Bc5, Bc4, NUM };
+
+// How hard the block encoder searches for endpoints and indices.
+enum class BlockQuality { Fast, Normal, Best, NUM };
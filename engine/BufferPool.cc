@@ -0,0 +1,288 @@
+#include "BufferPool.hh"
+
+#include "StageLog.hh"
+
+#include <QtGlobal>
+
+#include <cstdlib>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#if defined(Q_OS_WIN)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <malloc.h>
+#include <windows.h>
+#include <psapi.h>
+#elif defined(Q_OS_UNIX)
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+
+namespace
+{
+  thread_local BufferPool *currentPool = nullptr;
+
+  constexpr size_t alignment = 64;
+
+  // images smaller than this come and go too cheaply to be worth holding on to
+  constexpr qint64 minPooledBytes = 256 * 1024;
+
+  // buffers from this size up are mapped on their own when huge pages are asked for
+  constexpr qint64 hugePageBytes = 2 * 1024 * 1024;
+
+  struct Buffer
+  {
+    uchar *data = nullptr;
+    qint64 bytes = 0; // of its bucket
+    bool mapped = false;
+  };
+
+  // bytes rounded up to a quarter of the largest power of two below them
+  qint64
+  getBucketBytes(qint64 bytes)
+  {
+    qint64 power = 4096;
+    while (power * 2 < bytes)
+      power *= 2;
+    const qint64 step = power / 4;
+    return (bytes + step - 1) / step * step;
+  }
+
+  Buffer
+  allocateBuffer(qint64 bytes, bool hugePages)
+  {
+#if defined(Q_OS_UNIX)
+    if (hugePages && bytes >= hugePageBytes)
+    {
+      void *data = mmap(nullptr, size_t(bytes), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (data == MAP_FAILED)
+        return {};
+#if defined(MADV_HUGEPAGE)
+      madvise(data, size_t(bytes), MADV_HUGEPAGE);
+#endif
+      return {(uchar*)data, bytes, true};
+    }
+#else
+    // large pages need a privilege on Windows that users rarely have
+    Q_UNUSED(hugePages);
+#endif
+
+#if defined(Q_OS_WIN)
+    return {(uchar*)_aligned_malloc(size_t(bytes), alignment), bytes, false};
+#else
+    return {(uchar*)std::aligned_alloc(alignment, size_t(bytes)), bytes, false};
+#endif
+  }
+
+  void
+  freeBuffer(const Buffer &buffer)
+  {
+#if defined(Q_OS_UNIX)
+    if (buffer.mapped)
+    {
+      munmap(buffer.data, size_t(buffer.bytes));
+      return;
+    }
+#endif
+#if defined(Q_OS_WIN)
+    _aligned_free(buffer.data);
+#else
+    std::free(buffer.data);
+#endif
+  }
+} // namespace
+
+struct BufferPool::State
+{
+  std::mutex mutex;
+  std::map<qint64, std::vector<Buffer>> free; // by the bytes of their bucket
+  qint64 retainBytes = 0;
+  bool hugePages = false;
+  Stats stats;
+
+  ~State()
+  {
+    for (const auto &[bytes, buffers] : free)
+      for (const Buffer &buffer : buffers)
+        freeBuffer(buffer);
+  }
+
+  // frees the biggest buffers until the rest fit in retainBytes; called under the lock
+  void
+  trim()
+  {
+    while (stats.heldBytes > retainBytes && !free.empty())
+    {
+      const auto it = std::prev(free.end());
+      freeBuffer(it->second.back());
+      stats.heldBytes -= it->first;
+      it->second.pop_back();
+      if (it->second.empty())
+        free.erase(it);
+    }
+  }
+};
+
+struct BufferPool::Lease
+{
+  std::shared_ptr<State> state;
+  Buffer buffer;
+};
+
+BufferPool::Scope::Scope(BufferPool *pool)
+  : previous{std::exchange(currentPool, pool)}
+{
+}
+
+BufferPool::Scope::~Scope()
+{
+  currentPool = previous;
+}
+
+BufferPool *
+BufferPool::current()
+{
+  return currentPool;
+}
+
+BufferPool::BufferPool(qint64 retainBytes, bool hugePages)
+  : state{std::make_shared<State>()}
+{
+  state->retainBytes = retainBytes;
+  state->hugePages = hugePages;
+}
+
+BufferPool::~BufferPool() = default;
+
+QImage
+BufferPool::makeImage(QSize size, QImage::Format format)
+{
+  const int depth = QImage::toPixelFormat(format).bitsPerPixel();
+  if (size.isEmpty() || depth <= 0)
+    return {};
+
+  // what QImage itself would use, so that nothing tells these images from others
+  const qsizetype bytesPerLine = (qsizetype(size.width()) * depth + 31) / 32 * 4;
+  const qint64 bucketBytes = getBucketBytes(qint64(bytesPerLine) * size.height());
+
+  Buffer buffer;
+  bool hugePages = false;
+  {
+    std::lock_guard lock(state->mutex);
+    if (auto it = state->free.find(bucketBytes); it != state->free.end())
+    {
+      buffer = it->second.back();
+      it->second.pop_back();
+      if (it->second.empty())
+        state->free.erase(it);
+      state->stats.heldBytes -= bucketBytes;
+    }
+    hugePages = state->hugePages;
+  }
+
+  // allocated outside the lock, since the system may take a while to find that much memory
+  const bool reused = buffer.data != nullptr;
+  if (!reused)
+    buffer = allocateBuffer(bucketBytes, hugePages);
+  if (!buffer.data)
+    return {};
+
+  {
+    std::lock_guard lock(state->mutex);
+    ++(reused ? state->stats.reuses : state->stats.allocations);
+    state->stats.usedBytes += bucketBytes;
+  }
+
+  auto lease = new Lease{state, buffer};
+  QImage image(buffer.data, size.width(), size.height(), bytesPerLine, format, &BufferPool::release, lease);
+  if (image.isNull())
+  {
+    release(lease); // the cleanup function isn't called for an image that wasn't made
+    return {};
+  }
+
+  if (StageLog *log = StageLog::current())
+    log->addImageBuffer(reused);
+  return image;
+}
+
+void
+BufferPool::setRetainBytes(qint64 retainBytes)
+{
+  std::lock_guard lock(state->mutex);
+  state->retainBytes = retainBytes;
+  state->trim();
+}
+
+void
+BufferPool::setHugePages(bool hugePages)
+{
+  std::lock_guard lock(state->mutex);
+  state->hugePages = hugePages;
+}
+
+BufferPool::Stats
+BufferPool::getStats() const
+{
+  std::lock_guard lock(state->mutex);
+  return state->stats;
+}
+
+void
+BufferPool::release(void *lease)
+{
+  const std::unique_ptr<Lease> owned{(Lease*)lease};
+  State &state = *owned->state;
+
+  std::lock_guard lock(state.mutex);
+  state.stats.usedBytes -= owned->buffer.bytes;
+  if (state.stats.heldBytes + owned->buffer.bytes > state.retainBytes)
+  {
+    freeBuffer(owned->buffer);
+    return;
+  }
+  state.free[owned->buffer.bytes].push_back(owned->buffer);
+  state.stats.heldBytes += owned->buffer.bytes;
+}
+
+QImage
+allocateImage(QSize size, QImage::Format format)
+{
+  BufferPool *pool = BufferPool::current();
+  if (pool && qint64(size.width()) * size.height() * QImage::toPixelFormat(format).bitsPerPixel() / 8 >= minPooledBytes)
+    if (QImage image = pool->makeImage(size, format); !image.isNull())
+      return image;
+  return QImage(size, format);
+}
+
+ProcessMemory
+getProcessMemory()
+{
+  ProcessMemory memory;
+#if defined(Q_OS_WIN)
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+  {
+    memory.peakResidentBytes = qint64(counters.PeakWorkingSetSize);
+    memory.pageFaults = qint64(counters.PageFaultCount);
+  }
+#elif defined(Q_OS_UNIX)
+  rusage usage{};
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+  {
+    // bytes on macOS, KiB elsewhere
+#if defined(Q_OS_DARWIN)
+    memory.peakResidentBytes = qint64(usage.ru_maxrss);
+#else
+    memory.peakResidentBytes = qint64(usage.ru_maxrss) * 1024;
+#endif
+    memory.pageFaults = qint64(usage.ru_minflt) + qint64(usage.ru_majflt);
+  }
+#endif
+  return memory;
+}
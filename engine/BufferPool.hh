@@ -0,0 +1,91 @@
+#pragma once
+
+#include <QImage>
+#include <QSize>
+
+#include <memory>
+
+// Pixel memory of big images, kept once an image is done with it and handed to the next image that needs as much, so
+// that the saves and batch jobs after the first don't have the system map and zero fresh pages for every input,
+// output and mip level. Buffers come in size buckets a quarter of a power of two apart, so at most a fifth of one
+// goes unused, and start on 64-byte boundaries for SIMD loads. With huge pages, big buffers are mapped on their own
+// and, on Linux, advised to be backed by huge pages.
+//
+// Images keep their buffer's pool state alive, so they may outlive the pool. All methods may be called from any
+// thread.
+class BufferPool
+{
+public:
+  struct Stats
+  {
+    quint64 allocations = 0; // buffers newly allocated
+    quint64 reuses = 0; // images given a buffer an earlier image had
+    qint64 heldBytes = 0; // in buffers waiting for an image
+    qint64 usedBytes = 0; // in buffers of live images
+  };
+
+  // Makes pool the one current() returns on this thread until the scope ends; lets code that can't be handed a
+  // pool, such as an ImageCache::Loader or the kernels, still draw from it through allocateImage().
+  class Scope
+  {
+  public:
+    explicit Scope(BufferPool *pool);
+    ~Scope();
+
+    Scope(const Scope&) = delete;
+    Scope &operator=(const Scope&) = delete;
+
+  private:
+    BufferPool *const previous;
+  };
+
+  static BufferPool *
+  current();
+
+  // keeps at most retainBytes in buffers no image uses; 0 keeps none
+  explicit BufferPool(qint64 retainBytes, bool hugePages = false);
+  ~BufferPool();
+
+  BufferPool(const BufferPool &) = delete;
+  BufferPool &operator=(const BufferPool &) = delete;
+
+  // An image of size and format over a buffer of the pool, reused if one of its bucket is free; null if it couldn't
+  // be allocated. Counted into StageLog::current(), if any.
+  QImage
+  makeImage(QSize size, QImage::Format format);
+
+  // frees the buffers beyond retainBytes that no image uses
+  void
+  setRetainBytes(qint64 retainBytes);
+
+  // for buffers allocated from now on
+  void
+  setHugePages(bool hugePages);
+
+  Stats
+  getStats() const;
+
+private:
+  struct State;
+  struct Lease;
+
+  // the cleanup function of the pool's images
+  static void
+  release(void *lease);
+
+  const std::shared_ptr<State> state;
+};
+
+// QImage(size, format), from BufferPool::current() for images big enough to be worth pooling.
+QImage
+allocateImage(QSize size, QImage::Format format);
+
+// What the system tells of this process's memory so far; zeroes where it doesn't.
+struct ProcessMemory
+{
+  qint64 peakResidentBytes = 0;
+  qint64 pageFaults = 0; // including those served without I/O, such as first touches of fresh pages
+};
+
+ProcessMemory
+getProcessMemory();
@@ -0,0 +1,435 @@
+#include "ComposeKernel.hh"
+
+#include "BufferPool.hh"
+#include "MipChain.hh"
+#include "Progress.hh"
+#include "TilePool.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+  using ComposeKernel::LaneFn;
+
+  // QRgb: An ARGB quadruplet on the format #AARRGGBB; these are the bit offsets of each channel, indexed RGBA.
+  constexpr int channelShifts[4] = {16, 8, 0, 24};
+
+  // Format_RGBA8888 on a little-endian machine is ARGB32 with red and blue swapped, so it is composed with the
+  // ARGB32 lanes of these channels; indexed RGBA
+  constexpr int rgba8888Lanes[4] = {2, 1, 0, 3};
+
+  template<int outputChannel, int inputChannel, bool invert>
+  void
+  imageLane(QRgb *dst, const uchar *src, int width)
+  {
+    constexpr QRgb mask = QRgb(255) << channelShifts[outputChannel];
+    auto *pixels = (const QRgb*)src;
+
+    for (int x = 0; x < width; ++x)
+    {
+      quint8 v = quint8(pixels[x] >> channelShifts[inputChannel]);
+      if constexpr (invert)
+        v = 255 - v;
+      dst[x] = (dst[x] & ~mask) | (QRgb(v) << channelShifts[outputChannel]);
+    }
+  }
+
+  template<int outputChannel, bool invert>
+  void
+  planeLane(QRgb *dst, const uchar *src, int width)
+  {
+    constexpr QRgb mask = QRgb(255) << channelShifts[outputChannel];
+
+    for (int x = 0; x < width; ++x)
+    {
+      quint8 v = src[x];
+      if constexpr (invert)
+        v = 255 - v;
+      dst[x] = (dst[x] & ~mask) | (QRgb(v) << channelShifts[outputChannel]);
+    }
+  }
+
+  // what QImage::pixel() makes of a 16-bit gray value
+  quint8
+  from16(quint16 v)
+  {
+    return quint8((v - (v >> 8) + 0x80) >> 8);
+  }
+
+  // one channel of a row of a native format as QImage::pixel() gives it; lookup maps Indexed8 indices to it
+  void
+  extractRow(quint8 *dst, const uchar *src, int width, QImage::Format format, int inputChannel, const quint8 (&lookup)[256])
+  {
+    switch (format)
+    {
+      case QImage::Format_Grayscale16:
+        for (int x = 0; x < width; ++x)
+          dst[x] = from16(((const quint16*)src)[x]);
+        break;
+
+      case QImage::Format_RGB888: // R, G, B in memory order
+        for (int x = 0; x < width; ++x)
+          dst[x] = src[x * 3 + inputChannel];
+        break;
+
+      case QImage::Format_BGR888: // B, G, R in memory order
+        for (int x = 0; x < width; ++x)
+          dst[x] = src[x * 3 + 2 - inputChannel];
+        break;
+
+      case QImage::Format_RGBA8888: // R, G, B, A in memory order
+      case QImage::Format_RGBA8888_Premultiplied:
+        for (int x = 0; x < width; ++x)
+          dst[x] = src[x * 4 + inputChannel];
+        break;
+
+      case QImage::Format_Indexed8:
+        for (int x = 0; x < width; ++x)
+          dst[x] = lookup[src[x]];
+        break;
+
+      default: // the 32-bit formats
+        for (int x = 0; x < width; ++x)
+          dst[x] = quint8(((const QRgb*)src)[x] >> channelShifts[inputChannel]);
+        break;
+    }
+  }
+
+  // formats the kernels read as they are
+  bool
+  isKernelFormat(QImage::Format format)
+  {
+    switch (format)
+    {
+      case QImage::Format_RGB32:
+      case QImage::Format_ARGB32:
+      case QImage::Format_ARGB32_Premultiplied:
+      case QImage::Format_Grayscale8:
+        return true;
+
+      default:
+        return false;
+    }
+  }
+
+  // the R, G, B bytes of Format_RGB888 from ARGB32 pixels
+  void
+  packRgb888(uchar *dst, const QRgb *src, int width)
+  {
+    for (int x = 0; x < width; ++x)
+    {
+      dst[x * 3] = uchar(qRed(src[x]));
+      dst[x * 3 + 1] = uchar(qGreen(src[x]));
+      dst[x * 3 + 2] = uchar(qBlue(src[x]));
+    }
+  }
+
+  // big enough to amortize scheduling, small enough to balance across threads and stay in cache
+  constexpr qsizetype bandBytes = 256 * 1024;
+
+  template<int outputChannel>
+  constexpr LaneFn imageLanes[4][2]{ // [inputChannel][invert]
+    {imageLane<outputChannel, 0, false>, imageLane<outputChannel, 0, true>},
+    {imageLane<outputChannel, 1, false>, imageLane<outputChannel, 1, true>},
+    {imageLane<outputChannel, 2, false>, imageLane<outputChannel, 2, true>},
+    {imageLane<outputChannel, 3, false>, imageLane<outputChannel, 3, true>}};
+
+  constexpr const LaneFn (*allImageLanes[4])[2]{imageLanes<0>, imageLanes<1>, imageLanes<2>, imageLanes<3>};
+
+  constexpr LaneFn planeLanes[4][2]{ // [outputChannel][invert]
+    {planeLane<0, false>, planeLane<0, true>},
+    {planeLane<1, false>, planeLane<1, true>},
+    {planeLane<2, false>, planeLane<2, true>},
+    {planeLane<3, false>, planeLane<3, true>}};
+
+  // a Grayscale8 plane of one channel of image, rows spread over the pool
+  QImage
+  extractPlane(const QImage &image, int inputChannel, TilePool &pool)
+  {
+    QImage plane = allocateImage(image.size(), QImage::Format_Grayscale8);
+    if (plane.isNull())
+      return plane;
+
+    quint8 lookup[256]{}; // indices past the color table are 0, like QImage::pixel() gives for them
+    const QList<QRgb> colors = image.colorTable();
+    for (qsizetype i = 0; i < std::min<qsizetype>(colors.size(), 256); ++i)
+      lookup[i] = quint8(colors[i] >> channelShifts[inputChannel]);
+
+    // bits() detaches, so fetch it once here rather than from the worker threads
+    uchar *planeBits = plane.bits();
+    const qsizetype planeBytesPerLine = plane.bytesPerLine();
+    const int height = image.height();
+    const int bandRows = int(std::clamp<qsizetype>(bandBytes / image.bytesPerLine(), 1, std::max(height, 1)));
+
+    pool.run((height + bandRows - 1) / bandRows, [&](int band){
+      const int yEnd = std::min(height, (band + 1) * bandRows);
+      for (int y = band * bandRows; y < yEnd; ++y)
+        extractRow(planeBits + y * planeBytesPerLine, image.constScanLine(y), image.width(), image.format(), inputChannel, lookup);
+    });
+
+    return plane;
+  }
+} // namespace
+
+namespace ComposeKernel
+{
+  bool
+  isNativeFormat(QImage::Format format)
+  {
+    switch (format)
+    {
+      case QImage::Format_Grayscale16:
+      case QImage::Format_RGB888:
+      case QImage::Format_BGR888:
+      case QImage::Format_RGBA8888:
+      case QImage::Format_RGBA8888_Premultiplied:
+      case QImage::Format_Indexed8:
+        return true;
+
+      default:
+        return isKernelFormat(format);
+    }
+  }
+
+  bool
+  isOutputFormat(QImage::Format format)
+  {
+    return format == QImage::Format_ARGB32 || format == QImage::Format_RGB888
+      || (format == QImage::Format_RGBA8888 && Q_BYTE_ORDER == Q_LITTLE_ENDIAN);
+  }
+
+  QImage
+  toKernelFormat(QImage image)
+  {
+    switch (image.format())
+    {
+      case QImage::Format_RGB32: // stored as 0xffRRGGBB, which is what pixel() returns
+      case QImage::Format_ARGB32:
+      case QImage::Format_ARGB32_Premultiplied:
+        return image;
+
+      default:
+        break;
+    }
+
+    // QImage::pixel() hands back premultiplied formats still premultiplied, and everything else (including
+    // indexed color tables and opaque formats, whose alpha it forces to 255) as plain ARGB32.
+    if (image.pixelFormat().premultiplied() == QPixelFormat::Premultiplied)
+      return image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+    return image.convertToFormat(QImage::Format_ARGB32);
+  }
+
+  bool
+  prepareLanes(LaneSource (&lanes)[4], TilePool &pool, qint64 *bytes)
+  {
+    if (bytes)
+      *bytes = 0;
+
+    for (LaneSource &lane : lanes)
+    {
+      if (lane.image.isNull())
+        continue;
+
+      const QImage::Format format = lane.image.format();
+
+      // pixel() gives 255 for the alpha of formats without one; Indexed8 takes it from its color table
+      if ((lane.inputChannel & 3) == 3 && !lane.image.hasAlphaChannel() && format != QImage::Format_Indexed8)
+      {
+        lane.constant = lane.invert ? 0 : 255;
+        lane.image = {};
+        lane.invert = false;
+      }
+      // gray is the same in R, G and B, so lanes reading either share a plane
+      else if (format == QImage::Format_Grayscale8 || format == QImage::Format_Grayscale16)
+        lane.inputChannel = 0;
+    }
+
+    for (int i : {0, 1, 2, 3})
+    {
+      const QImage image = lanes[i].image;
+      if (image.isNull() || isKernelFormat(image.format()))
+        continue;
+
+      bool oneChannel = true;
+      for (int j = i + 1; j < 4; ++j)
+        if (lanes[j].image.cacheKey() == image.cacheKey() && (lanes[j].inputChannel & 3) != (lanes[i].inputChannel & 3))
+          oneChannel = false;
+
+      // a plane is a quarter of a 32-bit image to hold and to read
+      const bool plane = oneChannel && isNativeFormat(image.format());
+      const QImage prepared = plane ? extractPlane(image, lanes[i].inputChannel & 3, pool) : toKernelFormat(image);
+      if (prepared.isNull())
+        return false;
+      if (bytes)
+        *bytes += prepared.sizeInBytes();
+
+      for (int j = i; j < 4; ++j)
+        if (lanes[j].image.cacheKey() == image.cacheKey())
+        {
+          lanes[j].image = prepared;
+          if (plane)
+            lanes[j].inputChannel = 0;
+        }
+    }
+
+    return true;
+  }
+
+  Plan
+  makePlan(QSize size, const LaneSource (&lanes)[4], QImage::Format format, bool useSimd)
+  {
+    Q_ASSERT(isOutputFormat(format));
+
+    Plan plan;
+    plan.size = size;
+    plan.format = format;
+
+    for (int outputChannel : {0, 1, 2, 3})
+    {
+      const LaneSource &lane = lanes[outputChannel];
+      const int slot = format == QImage::Format_RGBA8888 ? rgba8888Lanes[outputChannel] : outputChannel;
+
+      if (lane.image.isNull())
+        plan.constantBits |= QRgb(lane.constant) << channelShifts[slot];
+      else if (lane.image.format() == QImage::Format_Grayscale8)
+      {
+        plan.laneFns[outputChannel] = planeLanes[slot][lane.invert];
+        plan.images[outputChannel] = lane.image;
+      }
+      else
+      {
+        plan.laneFns[outputChannel] = allImageLanes[slot][lane.inputChannel & 3][lane.invert];
+        plan.images[outputChannel] = lane.image;
+      }
+    }
+
+    plan.solid = !plan.laneFns[0] && !plan.laneFns[1] && !plan.laneFns[2] && !plan.laneFns[3];
+
+    // a solid row is one fill, which no merge beats
+    if (useSimd && !plan.solid)
+      plan.mergeFn = ComposeSimd::getBestMergeFn();
+
+    if (plan.mergeFn)
+    {
+      ComposeSimd::MergeSpec &spec = plan.mergeSpec;
+      for (auto &shuffle : spec.shuffles)
+        for (quint8 &from : shuffle)
+          from = ComposeSimd::MergeSpec::none;
+
+      for (int outputChannel : {0, 1, 2, 3})
+      {
+        const LaneSource &lane = lanes[outputChannel];
+        const int slot = format == QImage::Format_RGBA8888 ? rgba8888Lanes[outputChannel] : outputChannel;
+        const int outputShift = channelShifts[slot];
+
+        if (lane.image.isNull())
+        {
+          spec.orBits |= QRgb(lane.constant) << outputShift;
+          continue;
+        }
+
+        // lanes reading the same image share one load and shuffle
+        int s = 0;
+        while (s < spec.sourceCount && plan.mergeSources[s].cacheKey() != lane.image.cacheKey())
+          ++s;
+        if (s == spec.sourceCount)
+        {
+          spec.planes[spec.sourceCount] = lane.image.format() == QImage::Format_Grayscale8;
+          plan.mergeSources[spec.sourceCount++] = lane.image;
+        }
+
+        spec.shuffles[s][outputShift / 8] = spec.planes[s] ? 0 : quint8(channelShifts[lane.inputChannel & 3] / 8);
+        if (lane.invert)
+          spec.xorBits |= QRgb(255) << outputShift;
+      }
+    }
+
+    return plan;
+  }
+
+  void
+  composeRows(const Plan &plan, uchar *outputBits, qsizetype outputBytesPerLine, int yBegin, int yEnd)
+  {
+    const int width = plan.size.width();
+
+    // RGB888 rows are composed as ARGB32 into this one and then packed
+    std::vector<QRgb> packRow(plan.format == QImage::Format_RGB888 ? size_t(width) : 0);
+
+    for (int y = yBegin; y < yEnd; ++y)
+    {
+      uchar *outputRow = outputBits + y * outputBytesPerLine;
+      auto *dst = packRow.empty() ? (QRgb*)outputRow : packRow.data();
+
+      // rows after the first of a solid image are copies of it, whatever the format
+      if (plan.solid && y > yBegin)
+      {
+        std::memcpy(outputRow, outputRow - outputBytesPerLine, size_t(width) * (packRow.empty() ? 4 : 3));
+        continue;
+      }
+
+      if (plan.mergeFn)
+      {
+        const uchar *sources[4]{};
+        for (int s = 0; s < plan.mergeSpec.sourceCount; ++s)
+          sources[s] = plan.mergeSources[s].constScanLine(y);
+        plan.mergeFn(dst, sources, plan.mergeSpec, width);
+      }
+      else
+      {
+        std::fill_n(dst, width, plan.constantBits);
+        for (int c : {0, 1, 2, 3})
+          if (plan.laneFns[c])
+            plan.laneFns[c](dst, plan.images[c].constScanLine(y), width);
+      }
+
+      if (!packRow.empty())
+        packRgb888(outputRow, dst, width);
+    }
+  }
+
+  void
+  composeInto(const Plan &plan, uchar *outputBits, qsizetype outputBytesPerLine, TilePool &pool, Progress *progress, MipChain *mips)
+  {
+    const int height = plan.size.height();
+    int bandRows = int(std::clamp<qsizetype>(bandBytes / outputBytesPerLine, 1, std::max(height, 1)));
+    int bandCount = (height + bandRows - 1) / bandRows;
+    if (mips)
+    {
+      bandRows = mips->alignBandRows(bandRows);
+      bandCount = mips->getBandCount();
+    }
+
+    pool.run(bandCount, [&](int band){
+      if (progress && progress->isCancelled())
+        return;
+      const int yBegin = band * bandRows;
+      const int yEnd = band == bandCount - 1 ? height : yBegin + bandRows;
+      composeRows(plan, outputBits, outputBytesPerLine, yBegin, yEnd);
+      if (mips)
+        mips->downsampleBand(outputBits, outputBytesPerLine, yBegin, yEnd);
+      if (progress)
+        progress->advance(yEnd - yBegin);
+    });
+
+    if (mips && !(progress && progress->isCancelled()))
+      mips->finish(pool);
+  }
+
+  QImage
+  composeImage(const Plan &plan, TilePool &pool, Progress *progress, MipChain *mips)
+  {
+    QImage image = allocateImage(plan.size, plan.format);
+    if (image.isNull())
+      return image;
+
+    // bits() detaches, so fetch it once here rather than from the worker threads
+    composeInto(plan, image.bits(), image.bytesPerLine(), pool, progress, mips);
+
+    if (progress && progress->isCancelled())
+      return {};
+    return image;
+  }
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "ComposeSimd.hh"
+
+#include <QImage>
+
+class MipChain;
+class Progress;
+class TilePool;
+
+namespace ComposeKernel
+{
+  // Where one output channel (a "lane" of the output pixel) gets its value from.
+  struct LaneSource
+  {
+    QImage image; // null for a constant lane; otherwise already passed through prepareLanes()
+    int inputChannel = 0; // RGBA
+    bool invert = false;
+    quint8 constant = 0;
+  };
+
+  // Writes one image lane of `width` output pixels from src, the matching row of the lane's image; the other three
+  // lanes of dst are left untouched.
+  using LaneFn = void (*)(QRgb *dst, const uchar *src, int width);
+
+  // Everything needed to compose, resolved once per save so the row loop has no per-pixel dispatch.
+  struct Plan
+  {
+    QSize size;
+    QImage::Format format = QImage::Format_ARGB32; // of the output; see isOutputFormat()
+    LaneFn laneFns[4]{}; // RGBA; null for constant lanes
+    QImage images[4]; // RGBA; null for constant lanes
+
+    // The constant lanes where they go in an output pixel, with 0 in the image lanes: rows are filled with it before
+    // the image lanes are written, so constants cost one store per pixel however many there are.
+    QRgb constantBits = 0;
+
+    // every lane is constant, so every row is the same
+    bool solid = false;
+
+    // vector path; when mergeFn is set it is used instead of laneFns
+    ComposeSimd::MergeFn mergeFn{};
+    ComposeSimd::MergeSpec mergeSpec;
+    QImage mergeSources[4]; // the distinct images, indexed like mergeSpec.shuffles
+  };
+
+  // Whether prepareLanes() takes images of format as they are, without converting them whole first: the 32-bit
+  // formats, Grayscale8 and Grayscale16, RGB888, BGR888, RGBA8888 and Indexed8.
+  bool
+  isNativeFormat(QImage::Format format);
+
+  // Returns a 32-bit image whose raw pixels are exactly what QImage::pixel() returns for the given image,
+  // so the kernels can read scanLine()s directly without changing the output.
+  QImage
+  toKernelFormat(QImage image);
+
+  // Gets the lanes' images into what the kernels read: 32-bit images as they are, and Grayscale8 planes of one byte
+  // per pixel. An image of another native format that the lanes read one channel of is reduced to a plane of that
+  // channel; anything else goes through toKernelFormat(). Lanes reading the alpha of an image without one become
+  // constants. Values are those of QImage::pixel() throughout. Rows are spread over the pool.
+  // Returns false if an image couldn't be allocated; bytes, if given, is set to the size of the images made.
+  bool
+  prepareLanes(LaneSource (&lanes)[4], TilePool &pool, qint64 *bytes = nullptr);
+
+  // Whether the kernels can write format: Format_ARGB32, Format_RGB888 (which drops the alpha lane) and, on
+  // little-endian machines, Format_RGBA8888.
+  bool
+  isOutputFormat(QImage::Format format);
+
+  // useSimd = false forces the scalar lanes, e.g. to compare against the vector path
+  Plan
+  makePlan(QSize size, const LaneSource (&lanes)[4], QImage::Format format = QImage::Format_ARGB32, bool useSimd = true);
+
+  // Composes rows [yBegin, yEnd) into a buffer of plan.size in plan.format.
+  // Takes the raw buffer rather than a QImage so that several threads can write disjoint rows at once.
+  void
+  composeRows(const Plan &plan, uchar *outputBits, qsizetype outputBytesPerLine, int yBegin, int yEnd);
+
+  // Composes all rows of plan.size into a buffer in plan.format in bands of rows spread over the pool; every band is
+  // written by exactly one thread, so the result doesn't depend on the thread count.
+  // Rows are counted into progress, if given; if it is cancelled the remaining bands are skipped.
+  // mips, if given, is made from each band as soon as it is composed; it must be of plan.size and plan.format.
+  void
+  composeInto(const Plan &plan, uchar *outputBits, qsizetype outputBytesPerLine, TilePool &pool, Progress *progress = nullptr, MipChain *mips = nullptr);
+
+  // The above into a new image; null if it couldn't be allocated or progress was cancelled.
+  QImage
+  composeImage(const Plan &plan, TilePool &pool, Progress *progress = nullptr, MipChain *mips = nullptr);
+}
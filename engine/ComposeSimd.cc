@@ -0,0 +1,219 @@
+#include "ComposeSimd.hh"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define COMPOSE_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define COMPOSE_TARGET(isa)
+#else
+#define COMPOSE_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+namespace
+{
+  using ComposeSimd::MergeSpec;
+
+#ifdef COMPOSE_SIMD_X86
+
+  // builds the pshufb control for four consecutive pixels from the per-pixel byte shuffle; a plane holds their
+  // four bytes next to each other, from firstPlaneByte of the loaded vector on
+  void
+  makeShuffleControl(const quint8 (&shuffle)[4], bool plane, int firstPlaneByte, quint8 (&control)[16])
+  {
+    for (int pixel = 0; pixel < 4; ++pixel)
+      for (int byte = 0; byte < 4; ++byte)
+        if (shuffle[byte] == MergeSpec::none)
+          control[pixel * 4 + byte] = MergeSpec::none;
+        else
+          control[pixel * 4 + byte] = plane ? quint8(firstPlaneByte + pixel) : quint8(pixel * 4 + shuffle[byte]);
+  }
+
+  // 16 pixels per iteration: every source is shuffled so its bytes land in their output lanes with zeros elsewhere,
+  // which lets the lanes be merged with a plain OR since no two sources ever write the same output byte.
+  // A plane's 16 bytes come in one load and are spread over the four output vectors by their own controls.
+  template<int sourceCount>
+  COMPOSE_TARGET("ssse3")
+  int
+  mergeSsse3(quint32 *dst, const uchar *const *sources, const MergeSpec &spec, int width)
+  {
+    __m128i controls[sourceCount > 0 ? sourceCount : 1][4];
+    for (int s = 0; s < sourceCount; ++s)
+      for (int i = 0; i < 4; ++i)
+      {
+        alignas(16) quint8 control[16];
+        makeShuffleControl(spec.shuffles[s], spec.planes[s], i * 4, control);
+        controls[s][i] = _mm_load_si128((const __m128i*)control);
+      }
+
+    const __m128i orBits = _mm_set1_epi32(int(spec.orBits));
+    const __m128i xorBits = _mm_set1_epi32(int(spec.xorBits));
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+      __m128i out[4]{orBits, orBits, orBits, orBits};
+
+      for (int s = 0; s < sourceCount; ++s)
+        if (spec.planes[s])
+        {
+          const __m128i bytes = _mm_loadu_si128((const __m128i*)(sources[s] + x));
+          for (int i = 0; i < 4; ++i)
+            out[i] = _mm_or_si128(out[i], _mm_shuffle_epi8(bytes, controls[s][i]));
+        }
+        else
+          for (int i = 0; i < 4; ++i)
+            out[i] = _mm_or_si128(out[i], _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(sources[s] + (x + i * 4) * 4)), controls[s][i]));
+
+      for (int i = 0; i < 4; ++i)
+        _mm_storeu_si128((__m128i*)(dst + x + i * 4), _mm_xor_si128(out[i], xorBits));
+    }
+
+    return x;
+  }
+
+  // same as mergeSsse3 but 32 pixels per iteration; pshufb works within each 128-bit half, which is all a pixel needs.
+  // Planes are loaded 16 bytes at a time into both halves, each half picking its own four pixels.
+  template<int sourceCount>
+  COMPOSE_TARGET("avx2")
+  int
+  mergeAvx2(quint32 *dst, const uchar *const *sources, const MergeSpec &spec, int width)
+  {
+    __m256i controls[sourceCount > 0 ? sourceCount : 1][4];
+    for (int s = 0; s < sourceCount; ++s)
+      for (int i = 0; i < 4; ++i)
+      {
+        alignas(16) quint8 low[16], high[16];
+        makeShuffleControl(spec.shuffles[s], spec.planes[s], (i % 2) * 8, low);
+        makeShuffleControl(spec.shuffles[s], spec.planes[s], (i % 2) * 8 + 4, high);
+        controls[s][i] = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_load_si128((const __m128i*)low)), _mm_load_si128((const __m128i*)high), 1);
+      }
+
+    const __m256i orBits = _mm256_set1_epi32(int(spec.orBits));
+    const __m256i xorBits = _mm256_set1_epi32(int(spec.xorBits));
+
+    int x = 0;
+    for (; x + 32 <= width; x += 32)
+    {
+      __m256i out[4]{orBits, orBits, orBits, orBits};
+
+      for (int s = 0; s < sourceCount; ++s)
+        if (spec.planes[s])
+          for (int half = 0; half < 2; ++half)
+          {
+            const __m256i bytes = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(sources[s] + x + half * 16)));
+            out[half * 2] = _mm256_or_si256(out[half * 2], _mm256_shuffle_epi8(bytes, controls[s][half * 2]));
+            out[half * 2 + 1] = _mm256_or_si256(out[half * 2 + 1], _mm256_shuffle_epi8(bytes, controls[s][half * 2 + 1]));
+          }
+        else
+          for (int i = 0; i < 4; ++i)
+            out[i] = _mm256_or_si256(out[i], _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(sources[s] + (x + i * 8) * 4)), controls[s][i]));
+
+      for (int i = 0; i < 4; ++i)
+        _mm256_storeu_si256((__m256i*)(dst + x + i * 8), _mm256_xor_si256(out[i], xorBits));
+    }
+
+    return x;
+  }
+
+  template<int (&...vectorBody)(quint32 *, const uchar *const *, const MergeSpec &, int)>
+  void
+  mergeWith(quint32 *dst, const uchar *const *sources, const MergeSpec &spec, int width)
+  {
+    constexpr decltype(&mergeSsse3<0>) bodies[]{vectorBody...};
+
+    // finish the pixels that don't fill a whole iteration with the scalar version
+    const int x = bodies[spec.sourceCount](dst, sources, spec, width);
+    if (x < width)
+    {
+      const uchar *tailSources[4]{};
+      for (int s = 0; s < spec.sourceCount; ++s)
+        tailSources[s] = sources[s] + (spec.planes[s] ? x : x * 4);
+      ComposeSimd::mergeScalar(dst + x, tailSources, spec, width - x);
+    }
+  }
+
+  bool
+  cpuHasSsse3()
+  {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+#else
+    return __builtin_cpu_supports("ssse3");
+#endif
+  }
+
+  bool
+  cpuHasAvx2()
+  {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 1);
+    const bool osSavesYmm = (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return osSavesYmm && (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+  }
+
+#endif // COMPOSE_SIMD_X86
+} // namespace
+
+namespace ComposeSimd
+{
+  MergeFn
+  getBestMergeFn()
+  {
+    static const MergeFn best = getMergeFn(getBestMergeName());
+    return best;
+  }
+
+  const char *
+  getBestMergeName()
+  {
+#ifdef COMPOSE_SIMD_X86
+    if (cpuHasAvx2())
+      return "avx2";
+    if (cpuHasSsse3())
+      return "ssse3";
+#endif
+    return "scalar";
+  }
+
+  MergeFn
+  getMergeFn(const char *name)
+  {
+#ifdef COMPOSE_SIMD_X86
+    if (std::strcmp(name, "avx2") == 0 && cpuHasAvx2())
+      return mergeWith<mergeAvx2<0>, mergeAvx2<1>, mergeAvx2<2>, mergeAvx2<3>, mergeAvx2<4>>;
+    if (std::strcmp(name, "ssse3") == 0 && cpuHasSsse3())
+      return mergeWith<mergeSsse3<0>, mergeSsse3<1>, mergeSsse3<2>, mergeSsse3<3>, mergeSsse3<4>>;
+#endif
+    return nullptr;
+  }
+
+  void
+  mergeScalar(quint32 *dst, const uchar *const *sources, const MergeSpec &spec, int width)
+  {
+    for (int x = 0; x < width; ++x)
+    {
+      quint32 out = spec.orBits;
+
+      for (int s = 0; s < spec.sourceCount; ++s)
+      {
+        const quint32 pixel = spec.planes[s] ? sources[s][x] : ((const quint32*)sources[s])[x];
+        for (int byte = 0; byte < 4; ++byte)
+          if (quint8 from = spec.shuffles[s][byte]; from != MergeSpec::none)
+            out |= ((pixel >> (from * 8)) & 255) << (byte * 8);
+      }
+
+      dst[x] = out ^ spec.xorBits;
+    }
+  }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <QtGlobal>
+
+namespace ComposeSimd
+{
+  // Byte-level description of how each composed pixel is built from up to four source pixels:
+  // every output byte is taken from one byte of one source or is constant, and is then optionally inverted.
+  // Byte indices count from the least significant byte of a 32-bit pixel, which is memory order on the
+  // little-endian CPUs the vector paths run on. A source is either 32-bit pixels or a plane of one byte per pixel,
+  // which is byte 0 to the shuffles.
+  struct MergeSpec
+  {
+    static constexpr quint8 none = 0x80; // matches the pshufb "zero this byte" bit
+
+    int sourceCount = 0;
+    quint8 shuffles[4][4]{}; // [source][output byte] -> source byte, or none
+    bool planes[4]{}; // [source]
+    quint32 orBits = 0; // constant lanes
+    quint32 xorBits = 0; // 255 in every inverted lane
+  };
+
+  // sources are rows of 32-bit pixels or of plane bytes, as spec.planes says
+  using MergeFn = void (*)(quint32 *dst, const uchar *const *sources, const MergeSpec &spec, int width);
+
+  // Returns the widest vector path this CPU supports, or nullptr if there is none;
+  // callers should then use the scalar ComposeKernel lanes.
+  MergeFn
+  getBestMergeFn();
+
+  // "avx2", "ssse3" or "scalar", matching getBestMergeFn(); for logs and benchmark results
+  const char *
+  getBestMergeName();
+
+  // The vector path of the instruction set getBestMergeName() calls name, whether or not it is the best one, or
+  // nullptr if this CPU lacks it; lets tests check every path against mergeScalar().
+  MergeFn
+  getMergeFn(const char *name);
+
+  // Plain C++ version of the merge; used for the tail pixels of the vector paths.
+  void
+  mergeScalar(quint32 *dst, const uchar *const *sources, const MergeSpec &spec, int width);
+}
@@ -0,0 +1,460 @@
+#include "ComposeWide.hh"
+
+#include "BufferPool.hh"
+#include "MipChain.hh"
+#include "Progress.hh"
+#include "TilePool.hh"
+
+#include <QFloat16>
+
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define COMPOSE_WIDE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+  using ComposeKernel::LaneSource;
+
+  // QRgb: An ARGB quadruplet on the format #AARRGGBB; these are the bit offsets of each channel, indexed RGBA.
+  constexpr int channelShifts[4] = {16, 8, 0, 24};
+
+  // big enough to amortize scheduling, small enough to balance across threads and stay in cache
+  constexpr qsizetype bandBytes = 256 * 1024;
+
+  template<typename T>
+  constexpr T maxSample = std::is_same_v<T, quint16> ? T(65535) : T(1);
+
+  template<typename T>
+  T
+  from8(quint8 v)
+  {
+    if constexpr (std::is_same_v<T, quint16>)
+      return quint16(v * 257);
+    else
+      return v / 255.0f;
+  }
+
+  template<typename T>
+  T
+  from16(quint16 v)
+  {
+    if constexpr (std::is_same_v<T, quint16>)
+      return v;
+    else
+      return v / 65535.0f;
+  }
+
+  // floats outside [0, 1] (and NaN) are clamped when they have to fit in 16 bits
+  template<typename T>
+  T
+  fromFloat(float v)
+  {
+    if constexpr (std::is_same_v<T, quint16>)
+      return v > 0 ? (v < 1 ? quint16(std::lround(v * 65535.0)) : quint16(65535)) : quint16(0);
+    else
+      return v;
+  }
+
+  // An input lane resolved for one format; fetch returns one channel of a row, either in dst or, when the row
+  // already is that, the row itself.
+  template<typename T>
+  struct Lane
+  {
+    using FetchFn = const T *(*)(T *dst, const uchar *src, int width, const Lane &lane);
+
+    QImage image; // null for a constant lane
+    FetchFn fetch = nullptr;
+    int offset = 0; // of the channel: a sample index within the pixel, or a QRgb shift for 32-bit formats
+    T lookup[256]{}; // Indexed8
+    T constant{};
+    bool invert = false;
+  };
+
+  template<typename T>
+  const T *
+  fetchGray8(T *dst, const uchar *src, int width, const Lane<T> &)
+  {
+    for (int x = 0; x < width; ++x)
+      dst[x] = from8<T>(src[x]);
+    return dst;
+  }
+
+  // RGB888 and RGBA8888: R, G, B(, A) in memory order
+  template<typename T, int bytesPerPixel>
+  const T *
+  fetchBytes(T *dst, const uchar *src, int width, const Lane<T> &lane)
+  {
+    for (int x = 0; x < width; ++x)
+      dst[x] = from8<T>(src[x * bytesPerPixel + lane.offset]);
+    return dst;
+  }
+
+  template<typename T>
+  const T *
+  fetchArgb32(T *dst, const uchar *src, int width, const Lane<T> &lane)
+  {
+    for (int x = 0; x < width; ++x)
+      dst[x] = from8<T>(quint8(((const QRgb*)src)[x] >> lane.offset));
+    return dst;
+  }
+
+  template<typename T>
+  const T *
+  fetchIndexed8(T *dst, const uchar *src, int width, const Lane<T> &lane)
+  {
+    for (int x = 0; x < width; ++x)
+      dst[x] = lane.lookup[src[x]];
+    return dst;
+  }
+
+  template<typename T>
+  const T *
+  fetchGray16(T *dst, const uchar *src, int width, const Lane<T> &)
+  {
+    if constexpr (std::is_same_v<T, quint16>)
+      return (const quint16*)src;
+
+    for (int x = 0; x < width; ++x)
+      dst[x] = from16<T>(((const quint16*)src)[x]);
+    return dst;
+  }
+
+  template<typename T>
+  const T *
+  fetchRgba64(T *dst, const uchar *src, int width, const Lane<T> &lane)
+  {
+    for (int x = 0; x < width; ++x)
+      dst[x] = from16<T>(((const quint16*)src)[x * 4 + lane.offset]);
+    return dst;
+  }
+
+  template<typename T>
+  const T *
+  fetchRgba16f(T *dst, const uchar *src, int width, const Lane<T> &lane)
+  {
+    for (int x = 0; x < width; ++x)
+      dst[x] = fromFloat<T>(float(((const qfloat16*)src)[x * 4 + lane.offset]));
+    return dst;
+  }
+
+  template<typename T>
+  const T *
+  fetchRgba32f(T *dst, const uchar *src, int width, const Lane<T> &lane)
+  {
+    for (int x = 0; x < width; ++x)
+      dst[x] = fromFloat<T>(((const float*)src)[x * 4 + lane.offset]);
+    return dst;
+  }
+
+  // returns false if the image had to be converted and couldn't be
+  template<typename T>
+  bool
+  setUpLane(Lane<T> &lane, const LaneSource &source)
+  {
+    lane.invert = source.invert;
+    if (source.image.isNull())
+    {
+      lane.constant = from8<T>(source.constant);
+      return true;
+    }
+
+    QImage image = source.image;
+    const int channel = source.inputChannel & 3;
+
+    // QImage::pixel() gives full alpha for formats without one; Indexed8 takes it from its color table
+    if (channel == 3 && !image.hasAlphaChannel() && image.format() != QImage::Format_Indexed8)
+    {
+      lane.constant = source.invert ? T(0) : maxSample<T>;
+      lane.invert = false;
+      return true;
+    }
+
+    lane.offset = channel;
+    switch (image.format())
+    {
+      case QImage::Format_Grayscale8:
+        lane.fetch = fetchGray8<T>;
+        break;
+
+      case QImage::Format_RGB888:
+        lane.fetch = fetchBytes<T, 3>;
+        break;
+
+      case QImage::Format_BGR888:
+        lane.fetch = fetchBytes<T, 3>;
+        lane.offset = 2 - channel;
+        break;
+
+      case QImage::Format_RGBA8888:
+      case QImage::Format_RGBA8888_Premultiplied:
+        lane.fetch = fetchBytes<T, 4>;
+        break;
+
+      case QImage::Format_RGB32:
+      case QImage::Format_ARGB32:
+      case QImage::Format_ARGB32_Premultiplied:
+        lane.fetch = fetchArgb32<T>;
+        lane.offset = channelShifts[channel];
+        break;
+
+      case QImage::Format_Indexed8:
+      {
+        // indices past the color table are 0, like QImage::pixel() gives for them
+        const QList<QRgb> colors = image.colorTable();
+        for (qsizetype i = 0; i < std::min<qsizetype>(colors.size(), 256); ++i)
+          lane.lookup[i] = from8<T>(quint8(colors[i] >> channelShifts[channel]));
+        lane.fetch = fetchIndexed8<T>;
+        break;
+      }
+
+      case QImage::Format_Grayscale16:
+        lane.fetch = fetchGray16<T>;
+        break;
+
+      case QImage::Format_RGBX64:
+      case QImage::Format_RGBA64:
+      case QImage::Format_RGBA64_Premultiplied:
+        lane.fetch = fetchRgba64<T>;
+        break;
+
+      case QImage::Format_RGBX16FPx4:
+      case QImage::Format_RGBA16FPx4:
+      case QImage::Format_RGBA16FPx4_Premultiplied:
+        lane.fetch = fetchRgba16f<T>;
+        break;
+
+      case QImage::Format_RGBX32FPx4:
+      case QImage::Format_RGBA32FPx4:
+      case QImage::Format_RGBA32FPx4_Premultiplied:
+        lane.fetch = fetchRgba32f<T>;
+        break;
+
+      default:
+        // the remaining formats have at most 16 bits per channel, so this loses nothing; premultiplied ones stay so
+        image = image.convertToFormat(image.pixelFormat().premultiplied() == QPixelFormat::Premultiplied ? QImage::Format_RGBA64_Premultiplied : QImage::Format_RGBA64);
+        if (image.isNull())
+          return false;
+        lane.fetch = fetchRgba64<T>;
+        break;
+    }
+
+    lane.image = image;
+    return true;
+  }
+
+  // Writes width RGBA pixels from one row per lane; a null row is the lane's constant.
+  template<typename T>
+  void
+  interleaveScalar(T *dst, const T *const (&rows)[4], const Lane<T> (&lanes)[4], int x, int width)
+  {
+    for (; x < width; ++x)
+      for (int c : {0, 1, 2, 3})
+      {
+        if (!rows[c])
+          dst[x * 4 + c] = lanes[c].constant;
+        else
+          dst[x * 4 + c] = lanes[c].invert ? T(maxSample<T> - rows[c][x]) : rows[c][x];
+      }
+  }
+
+#ifdef COMPOSE_WIDE_SSE2
+
+  // 8 pixels per iteration: the four lanes are zipped into RG and BA pairs, then the pairs into pixels
+  int
+  interleaveSse2(quint16 *dst, const quint16 *const (&rows)[4], const Lane<quint16> (&lanes)[4], int width)
+  {
+    __m128i values[4], masks[4];
+    for (int c : {0, 1, 2, 3})
+    {
+      values[c] = _mm_set1_epi16(short(lanes[c].constant));
+      masks[c] = _mm_set1_epi16(short(lanes[c].invert ? 0xffff : 0)); // 65535 - v
+    }
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+      __m128i channels[4];
+      for (int c : {0, 1, 2, 3})
+        channels[c] = rows[c] ? _mm_xor_si128(_mm_loadu_si128((const __m128i*)(rows[c] + x)), masks[c]) : values[c];
+
+      const __m128i rgLow = _mm_unpacklo_epi16(channels[0], channels[1]);
+      const __m128i rgHigh = _mm_unpackhi_epi16(channels[0], channels[1]);
+      const __m128i baLow = _mm_unpacklo_epi16(channels[2], channels[3]);
+      const __m128i baHigh = _mm_unpackhi_epi16(channels[2], channels[3]);
+
+      auto *out = (__m128i*)(dst + x * 4);
+      _mm_storeu_si128(out, _mm_unpacklo_epi32(rgLow, baLow));
+      _mm_storeu_si128(out + 1, _mm_unpackhi_epi32(rgLow, baLow));
+      _mm_storeu_si128(out + 2, _mm_unpacklo_epi32(rgHigh, baHigh));
+      _mm_storeu_si128(out + 3, _mm_unpackhi_epi32(rgHigh, baHigh));
+    }
+
+    return x;
+  }
+
+  // 4 pixels per iteration, the same way
+  int
+  interleaveSse2(float *dst, const float *const (&rows)[4], const Lane<float> (&lanes)[4], int width)
+  {
+    const __m128 one = _mm_set1_ps(1);
+    __m128 values[4];
+    for (int c : {0, 1, 2, 3})
+      values[c] = _mm_set1_ps(lanes[c].constant);
+
+    int x = 0;
+    for (; x + 4 <= width; x += 4)
+    {
+      __m128 channels[4];
+      for (int c : {0, 1, 2, 3})
+        if (!rows[c])
+          channels[c] = values[c];
+        else
+        {
+          channels[c] = _mm_loadu_ps(rows[c] + x);
+          if (lanes[c].invert)
+            channels[c] = _mm_sub_ps(one, channels[c]);
+        }
+
+      const __m128 rgLow = _mm_unpacklo_ps(channels[0], channels[1]);
+      const __m128 rgHigh = _mm_unpackhi_ps(channels[0], channels[1]);
+      const __m128 baLow = _mm_unpacklo_ps(channels[2], channels[3]);
+      const __m128 baHigh = _mm_unpackhi_ps(channels[2], channels[3]);
+
+      float *out = dst + x * 4;
+      _mm_storeu_ps(out, _mm_movelh_ps(rgLow, baLow));
+      _mm_storeu_ps(out + 4, _mm_movehl_ps(baLow, rgLow));
+      _mm_storeu_ps(out + 8, _mm_movelh_ps(rgHigh, baHigh));
+      _mm_storeu_ps(out + 12, _mm_movehl_ps(baHigh, rgHigh));
+    }
+
+    return x;
+  }
+
+#endif // COMPOSE_WIDE_SSE2
+
+  template<typename T>
+  void
+  interleave(T *dst, const T *const (&rows)[4], const Lane<T> (&lanes)[4], int width)
+  {
+    int x = 0;
+#ifdef COMPOSE_WIDE_SSE2
+    x = interleaveSse2(dst, rows, lanes, width);
+#endif
+    interleaveScalar(dst, rows, lanes, x, width);
+  }
+
+  template<typename T>
+  QImage
+  composeWide(QSize size, const LaneSource (&sources)[4], QImage::Format format, TilePool &pool, Progress *progress, MipChain *mips)
+  {
+    Lane<T> lanes[4]; // RGBA
+    for (int c : {0, 1, 2, 3})
+      if (!setUpLane(lanes[c], sources[c]))
+        return {};
+
+    QImage image = allocateImage(size, format);
+    if (image.isNull())
+      return image;
+
+    // bits() detaches, so fetch it once here rather than from the worker threads
+    uchar *outputBits = image.bits();
+    const qsizetype outputBytesPerLine = image.bytesPerLine();
+    const int width = size.width();
+    const int height = size.height();
+    int bandRows = int(std::clamp<qsizetype>(bandBytes / outputBytesPerLine, 1, std::max(height, 1)));
+    int bandCount = (height + bandRows - 1) / bandRows;
+    if (mips)
+    {
+      bandRows = mips->alignBandRows(bandRows);
+      bandCount = mips->getBandCount();
+    }
+
+    pool.run(bandCount, [&](int band){
+      if (progress && progress->isCancelled())
+        return;
+
+      std::vector<T> scratch(size_t(width) * 4); // a row per lane
+      const int yBegin = band * bandRows;
+      const int yEnd = band == bandCount - 1 ? height : yBegin + bandRows;
+      for (int y = yBegin; y < yEnd; ++y)
+      {
+        const T *rows[4]{};
+        for (int c : {0, 1, 2, 3})
+          if (!lanes[c].image.isNull())
+            rows[c] = lanes[c].fetch(scratch.data() + size_t(c) * width, lanes[c].image.constScanLine(y), width, lanes[c]);
+        interleave((T*)(outputBits + y * outputBytesPerLine), rows, lanes, width);
+      }
+
+      if (mips)
+        mips->downsampleBand(outputBits, outputBytesPerLine, yBegin, yEnd);
+      if (progress)
+        progress->advance(yEnd - yBegin);
+    });
+
+    if (progress && progress->isCancelled())
+      return {};
+    if (mips)
+      mips->finish(pool);
+    return image;
+  }
+} // namespace
+
+namespace ComposeWide
+{
+  bool
+  isNativeFormat(QImage::Format format)
+  {
+    switch (format)
+    {
+      case QImage::Format_Grayscale16:
+      case QImage::Format_RGBX64:
+      case QImage::Format_RGBA64:
+      case QImage::Format_RGBA64_Premultiplied:
+      case QImage::Format_RGBX16FPx4:
+      case QImage::Format_RGBA16FPx4:
+      case QImage::Format_RGBA16FPx4_Premultiplied:
+      case QImage::Format_RGBX32FPx4:
+      case QImage::Format_RGBA32FPx4:
+      case QImage::Format_RGBA32FPx4_Premultiplied:
+        return true;
+
+      default:
+        return false;
+    }
+  }
+
+  QImage::Format
+  getOutputFormat(Precision precision)
+  {
+    switch (precision)
+    {
+      case Precision::Uint16:
+        return QImage::Format_RGBA64;
+      case Precision::Float32:
+        return QImage::Format_RGBA32FPx4;
+      default:
+        return QImage::Format_ARGB32;
+    }
+  }
+
+  QImage
+  composeImage(QSize size, const ComposeKernel::LaneSource (&lanes)[4], Precision precision, TilePool &pool, Progress *progress, MipChain *mips)
+  {
+    switch (precision)
+    {
+      case Precision::Uint16:
+        return composeWide<quint16>(size, lanes, getOutputFormat(precision), pool, progress, mips);
+      case Precision::Float32:
+        return composeWide<float>(size, lanes, getOutputFormat(precision), pool, progress, mips);
+      default:
+        Q_ASSERT(false);
+        return {};
+    }
+  }
+}
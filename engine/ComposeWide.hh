@@ -0,0 +1,32 @@
+#pragma once
+
+#include "ComposeKernel.hh"
+#include "Precision.hh"
+
+#include <QImage>
+
+class MipChain;
+class Progress;
+class TilePool;
+
+// Composition at 16 bits or in float per channel, for inputs with more than 8 bits per channel whose precision
+// ComposeKernel would lose. Inputs of any format are read as they are: 8-bit values are widened exactly (v * 257,
+// v / 255), 16-bit ones are kept and float ones are kept in float mode or rounded to 16 bits. Like ComposeKernel,
+// premultiplied inputs are read as stored and formats without alpha read 255 (1.0) there.
+namespace ComposeWide
+{
+  // Whether keeping images of format as decoded preserves precision that ComposeKernel::toKernelFormat() would lose.
+  bool
+  isNativeFormat(QImage::Format format);
+
+  // Format_ARGB32, Format_RGBA64 or Format_RGBA32FPx4
+  QImage::Format
+  getOutputFormat(Precision precision);
+
+  // Composes the lanes into a new image of getOutputFormat(precision), which must not be Precision::Uint8, in bands
+  // of rows spread over the pool. Lane images are in any format; constants are 8-bit values.
+  // Rows are counted into progress, if given. Null if the image couldn't be allocated or progress was cancelled.
+  // mips, if given, is made as in ComposeKernel::composeInto().
+  QImage
+  composeImage(QSize size, const ComposeKernel::LaneSource (&lanes)[4], Precision precision, TilePool &pool, Progress *progress = nullptr, MipChain *mips = nullptr);
+}
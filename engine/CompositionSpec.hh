@@ -0,0 +1,54 @@
+#pragma once
+
+#include "InputSource.hh"
+#include "Precision.hh"
+#include "ResizeMode.hh"
+
+#include <QByteArray>
+#include <QSize>
+#include <QString>
+
+#include <optional>
+
+// Where one output channel gets its value from; mirrors the per-channel controls of the GUI.
+struct ChannelSpec
+{
+  InputSource source = InputSource::Constant;
+  quint8 constant = 0;
+  QString filename;
+  int inputChannel = 0; // RGBA
+  bool invert = false;
+};
+
+// Everything needed to produce one composite image.
+struct CompositionSpec
+{
+  ChannelSpec channels[4]; // RGBA
+
+  // required when no channel reads an image, and the size inputs are resampled to for ResizeMode::Explicit;
+  // otherwise the images' size is used
+  std::optional<QSize> size;
+
+  // inputs that differ in size are resampled to one as resize says, with filter; see Resample
+  ResizeMode resize = ResizeMode::None;
+  ResampleFilter filter = ResampleFilter::Bilinear;
+
+  // of the output; 16-bit and float keep the precision of 16-bit and float inputs
+  Precision precision = Precision::Uint8;
+
+  // also make the mip chain below the output, see MipChain
+  bool mipmaps = false;
+
+  // the QImageWriter format the output is going to be saved in, e.g. "png"; 8-bit output is then composed in the
+  // layout that writer encodes from, see getComposeFormat(). Empty for Format_ARGB32.
+  QByteArray saveFormat = {};
+
+  bool
+  usesImages() const
+  {
+    for (const ChannelSpec &channel : channels)
+      if (channel.source == InputSource::Image)
+        return true;
+    return false;
+  }
+};
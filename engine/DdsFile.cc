@@ -0,0 +1,111 @@
+#include "DdsFile.hh"
+
+#include "BlockCompress.hh"
+
+#include <QtEndian>
+
+namespace
+{
+  // DDS_HEADER flags
+  constexpr quint32 ddsdCaps = 0x1;
+  constexpr quint32 ddsdHeight = 0x2;
+  constexpr quint32 ddsdWidth = 0x4;
+  constexpr quint32 ddsdPixelFormat = 0x1000;
+  constexpr quint32 ddsdMipMapCount = 0x20000;
+  constexpr quint32 ddsdLinearSize = 0x80000;
+
+  // DDS_PIXELFORMAT flags
+  constexpr quint32 ddpfFourCc = 0x4;
+
+  // DDS_HEADER caps
+  constexpr quint32 ddsCapsComplex = 0x8;
+  constexpr quint32 ddsCapsTexture = 0x1000;
+  constexpr quint32 ddsCapsMipMap = 0x400000;
+
+  constexpr quint32 d3d10ResourceDimensionTexture2d = 3;
+
+  quint32
+  getDxgiFormat(BlockFormat format)
+  {
+    switch (format)
+    {
+      case BlockFormat::Bc7:
+        return 98; // DXGI_FORMAT_BC7_UNORM
+      case BlockFormat::Bc5:
+        return 83; // DXGI_FORMAT_BC5_UNORM
+      default:
+        return 80; // DXGI_FORMAT_BC4_UNORM
+    }
+  }
+
+  quint32
+  makeFourCc(const char (&code)[5])
+  {
+    return quint32(uchar(code[0])) | quint32(uchar(code[1])) << 8 | quint32(uchar(code[2])) << 16 | quint32(uchar(code[3])) << 24;
+  }
+
+  void
+  append32(QByteArray &data, quint32 value)
+  {
+    value = qToLittleEndian(value);
+    data.append((const char*)&value, sizeof value);
+  }
+} // namespace
+
+QByteArray
+encodeDds(const QImage &image, const std::vector<QImage> &mipLevels, BlockFormat format, BlockQuality quality, TilePool &pool, Progress *progress)
+{
+  const bool hasMips = !mipLevels.empty();
+  const int blockBytes = BlockCompress::getBlockBytes(format);
+
+  QByteArray data("DDS ");
+
+  // DDS_HEADER
+  append32(data, 124);
+  append32(data, ddsdCaps | ddsdHeight | ddsdWidth | ddsdPixelFormat | ddsdLinearSize | (hasMips ? ddsdMipMapCount : 0));
+  append32(data, quint32(image.height()));
+  append32(data, quint32(image.width()));
+  append32(data, quint32((image.width() + 3) / 4) * quint32((image.height() + 3) / 4) * quint32(blockBytes)); // top level
+  append32(data, 0); // depth
+  append32(data, hasMips ? quint32(mipLevels.size() + 1) : 0);
+  for (int i = 0; i < 11; ++i)
+    append32(data, 0); // reserved
+
+  // DDS_PIXELFORMAT: only the FourCC, which defers to the DX10 header
+  append32(data, 32);
+  append32(data, ddpfFourCc);
+  append32(data, makeFourCc("DX10"));
+  for (int i = 0; i < 5; ++i)
+    append32(data, 0); // bit count and masks
+
+  append32(data, ddsCapsTexture | (hasMips ? ddsCapsComplex | ddsCapsMipMap : 0));
+  for (int i = 0; i < 4; ++i)
+    append32(data, 0); // caps2 to caps4 and reserved
+
+  // DDS_HEADER_DXT10
+  append32(data, getDxgiFormat(format));
+  append32(data, d3d10ResourceDimensionTexture2d);
+  append32(data, 0); // misc flags
+  append32(data, 1); // array size
+  append32(data, 0); // alpha mode unknown, as channels are often not alpha at all
+
+  for (size_t level = 0; level <= mipLevels.size(); ++level)
+  {
+    const QImage &levelImage = level == 0 ? image : mipLevels[level - 1];
+    const bool native = levelImage.format() == QImage::Format_ARGB32 || levelImage.format() == QImage::Format_RGB32;
+    const QByteArray blocks = BlockCompress::encode(native ? levelImage : levelImage.convertToFormat(QImage::Format_ARGB32), format, quality, pool, progress);
+    if (blocks.isEmpty())
+      return {};
+    data.append(blocks);
+  }
+  return data;
+}
+
+qint64
+getDdsBlockRows(const QImage &image, const std::vector<QImage> &mipLevels)
+{
+  qint64 rows = (image.height() + 3) / 4;
+  for (const QImage &level : mipLevels)
+    rows += (level.height() + 3) / 4;
+  return rows;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "BlockFormat.hh"
+
+#include <QByteArray>
+#include <QImage>
+
+#include <vector>
+
+class Progress;
+class TilePool;
+
+// A DDS file of image and its mip levels (level 1, half the size, first; may be empty) block-compressed in format,
+// with the DX10 header that BC7 needs and every current reader takes. Images of formats other than Format_ARGB32 and
+// Format_RGB32 are converted first. Each row of blocks is counted into progress, if given; empty if it was cancelled.
+QByteArray
+encodeDds(const QImage &image, const std::vector<QImage> &mipLevels, BlockFormat format, BlockQuality quality, TilePool &pool, Progress *progress = nullptr);
+
+// The rows of blocks encodeDds() counts into progress for image and its mip levels.
+qint64
+getDdsBlockRows(const QImage &image, const std::vector<QImage> &mipLevels);
@@ -0,0 +1,347 @@
+#include "ImageCache.hh"
+
+#include "StageLog.hh"
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QFileInfo>
+#include <QThreadPool>
+
+#include <algorithm>
+
+namespace
+{
+  QByteArray
+  hashFile(const QString &filename, QString &error)
+  {
+    StageLog::Timer timer(StageLog::current(), "hash", filename);
+
+    QFile file(filename);
+    QCryptographicHash hash(QCryptographicHash::Blake2b_256);
+    if (!file.open(QIODevice::ReadOnly) || !hash.addData(&file))
+    {
+      error = file.errorString();
+      return {};
+    }
+    timer.setBytes(file.size());
+    return hash.result();
+  }
+} // namespace
+
+ImageCache::ImageCache(Loader loader, qint64 budgetBytes)
+  : loader{std::move(loader)}
+{
+  stats.budgetBytes = budgetBytes;
+}
+
+QImage
+ImageCache::get(const QString &filename, QString &error)
+{
+  const FileKey key = getFileKey(filename);
+
+  std::unique_lock lock(mutex);
+
+  if (const Entry *entry = findFresh(key))
+  {
+    ++stats.hits;
+    return entry->image;
+  }
+
+  if (const Loading *pending = findLoading(key))
+  {
+    // somebody else is decoding it right now; wait for their result rather than decoding it twice
+    ++stats.hits;
+    std::shared_future<Loaded> future = pending->future;
+    lock.unlock();
+
+    const Loaded &loaded = future.get();
+    error = loaded.error;
+    return loaded.image;
+  }
+
+  ++stats.misses;
+  const Loading started = startLoading(key);
+  lock.unlock();
+
+  Loaded loaded = load(filename, started);
+  error = loaded.error;
+  QImage image = loaded.image;
+  finishLoading(started, std::move(loaded));
+  return image;
+}
+
+void
+ImageCache::prefetch(const QString &filename)
+{
+  const FileKey key = getFileKey(filename);
+
+  std::unique_lock lock(mutex);
+
+  if (findFresh(key) || findLoading(key))
+    return;
+
+  ++stats.prefetches;
+  const Loading started = startLoading(key);
+  lock.unlock();
+
+  // the task keeps the cache alive until it is done
+  QThreadPool::globalInstance()->start([self = shared_from_this(), started, filename]{
+    self->finishLoading(started, self->load(filename, started));
+  });
+}
+
+QByteArray
+ImageCache::getContentHash(const QString &filename, QString &error)
+{
+  const FileKey key = getFileKey(filename);
+
+  {
+    std::lock_guard lock(mutex);
+    auto it = hashes.find(key.path);
+    if (it != hashes.end() && it->second.modified == key.modified && it->second.size == key.size)
+      return it->second.hash;
+  }
+
+  const QByteArray hash = hashFile(filename, error);
+
+  // not kept if the file changed while it was read
+  const FileKey after = getFileKey(filename);
+  if (!hash.isEmpty() && after.modified == key.modified && after.size == key.size)
+  {
+    std::lock_guard lock(mutex);
+    hashes[key.path] = {key.modified, key.size, hash};
+  }
+  return hash;
+}
+
+void
+ImageCache::clear()
+{
+  std::lock_guard lock(mutex);
+  entries.clear();
+  byPath.clear();
+  stats.bytes = 0;
+}
+
+void
+ImageCache::setBudgetBytes(qint64 budgetBytes)
+{
+  std::lock_guard lock(mutex);
+  stats.budgetBytes = budgetBytes;
+  evictToBudget();
+}
+
+ImageCache::Stats
+ImageCache::getStats() const
+{
+  std::lock_guard lock(mutex);
+  return stats;
+}
+
+std::vector<ImageCache::EntryInfo>
+ImageCache::getEntries() const
+{
+  std::lock_guard lock(mutex);
+
+  std::vector<EntryInfo> infos;
+  for (const Entry &entry : entries)
+  {
+    infos.push_back(entry.info);
+    for (const FileKey &duplicate : entry.duplicates)
+      infos.back().duplicates.append(duplicate.path);
+  }
+  return infos;
+}
+
+ImageCache::FileKey
+ImageCache::getFileKey(const QString &filename)
+{
+  const QFileInfo fileInfo(filename);
+
+  // canonicalFilePath() is empty for missing files; let the loader report those
+  return {fileInfo.exists() ? fileInfo.canonicalFilePath() : fileInfo.absoluteFilePath(), fileInfo.lastModified(), fileInfo.size()};
+}
+
+const ImageCache::Entry *
+ImageCache::findFresh(const FileKey &key)
+{
+  auto it = byPath.find(key.path);
+  if (it == byPath.end())
+    return nullptr;
+
+  const Entry &entry = *it->second;
+  QDateTime modified = entry.info.fileModified;
+  qint64 size = entry.fileSize;
+  for (const FileKey &duplicate : entry.duplicates)
+    if (duplicate.path == key.path)
+    {
+      modified = duplicate.modified;
+      size = duplicate.size;
+    }
+
+  if (modified != key.modified || size != key.size)
+  {
+    // changed on disk
+    forgetPath(key.path);
+    return nullptr;
+  }
+
+  entries.splice(entries.begin(), entries, it->second);
+  return &entries.front();
+}
+
+const ImageCache::Loading *
+ImageCache::findLoading(const FileKey &key) const
+{
+  auto it = loading.find(key.path);
+  if (it == loading.end() || it->second.key.modified != key.modified || it->second.key.size != key.size)
+    return nullptr;
+  return &it->second;
+}
+
+ImageCache::Loading &
+ImageCache::startLoading(const FileKey &key)
+{
+  auto promise = std::make_shared<std::promise<Loaded>>();
+  std::shared_future<Loaded> future = promise->get_future().share();
+  return loading[key.path] = Loading{key, ++loadsStarted, std::move(promise), std::move(future)};
+}
+
+void
+ImageCache::evictToBudget()
+{
+  // an image bigger than the whole budget is still returned to the caller, just not kept
+  while (!entries.empty() && stats.bytes > stats.budgetBytes)
+  {
+    ++stats.evictions;
+    eraseEntry(std::prev(entries.end()));
+  }
+}
+
+void
+ImageCache::eraseEntry(std::list<Entry>::iterator entry)
+{
+  stats.bytes -= entry->info.bytes;
+  byPath.erase(entry->info.path);
+  for (const FileKey &duplicate : entry->duplicates)
+    byPath.erase(duplicate.path);
+  entries.erase(entry);
+}
+
+void
+ImageCache::forgetPath(const QString &path)
+{
+  auto it = byPath.find(path);
+  if (it == byPath.end())
+    return;
+
+  // the image goes with the file it was decoded from, but not with a duplicate
+  const auto entry = it->second;
+  if (entry->info.path == path)
+  {
+    eraseEntry(entry);
+    return;
+  }
+  entry->duplicates.erase(std::remove_if(entry->duplicates.begin(), entry->duplicates.end(), [&](const FileKey &duplicate){ return duplicate.path == path; }), entry->duplicates.end());
+  byPath.erase(it);
+}
+
+ImageCache::Loaded
+ImageCache::load(const QString &filename, const Loading &started)
+{
+  const FileKey &key = started.key;
+
+  // only files of the same size can have the same content
+  std::vector<QString> candidates;
+  std::vector<Loading> loadingCandidates;
+  {
+    std::lock_guard lock(mutex);
+    for (const Entry &entry : entries)
+      if (entry.fileSize == key.size && entry.info.path != key.path)
+        candidates.push_back(entry.info.path);
+    for (const auto &[path, pending] : loading)
+      if (pending.key.size == key.size && path != key.path && pending.sequence < started.sequence)
+        loadingCandidates.push_back(pending);
+  }
+
+  QString hashError;
+  const QByteArray hash = candidates.empty() && loadingCandidates.empty() ? QByteArray() : getContentHash(filename, hashError);
+  for (const QString &candidate : candidates)
+  {
+    if (hash.isEmpty() || getContentHash(candidate, hashError) != hash)
+      continue;
+
+    // the entry may have been dropped meanwhile, or its file changed after it was decoded
+    std::lock_guard lock(mutex);
+    const auto it = byPath.find(candidate);
+    const auto record = hashes.find(candidate);
+    if (it != byPath.end() && it->second->info.path == candidate && record != hashes.end()
+        && record->second.modified == it->second->info.fileModified && record->second.size == it->second->fileSize)
+      return {it->second->image, {}, candidate};
+  }
+
+  for (const Loading &pending : loadingCandidates)
+  {
+    if (hash.isEmpty() || getContentHash(pending.key.path, hashError) != hash)
+      continue;
+
+    // only if what was hashed is the file as it is being decoded
+    {
+      std::lock_guard lock(mutex);
+      const auto record = hashes.find(pending.key.path);
+      if (record == hashes.end() || record->second.modified != pending.key.modified || record->second.size != pending.key.size)
+        continue;
+    }
+
+    // a failed decode is reported for the file it failed on; this one is decoded itself
+    const Loaded &other = pending.future.get();
+    if (!other.image.isNull())
+      return {other.image, {}, pending.key.path};
+  }
+
+  Loaded loaded;
+  loaded.image = loader(filename, loaded.error);
+  return loaded;
+}
+
+void
+ImageCache::finishLoading(const Loading &finished, Loaded loaded)
+{
+  {
+    std::lock_guard lock(mutex);
+
+    // a newer load of a changed file may have replaced this one meanwhile
+    if (auto it = loading.find(finished.key.path); it != loading.end() && it->second.promise == finished.promise)
+      loading.erase(it);
+
+    if (!loaded.image.isNull())
+    {
+      forgetPath(finished.key.path);
+
+      // a duplicate joins the entry of the file it has the same content as, if that is still cached
+      if (auto it = loaded.duplicateOf.isEmpty() ? byPath.end() : byPath.find(loaded.duplicateOf);
+          it != byPath.end() && it->second->image.cacheKey() == loaded.image.cacheKey())
+      {
+        ++stats.duplicates;
+        it->second->duplicates.push_back(finished.key);
+        entries.splice(entries.begin(), entries, it->second);
+        byPath[finished.key.path] = entries.begin();
+      }
+      else
+      {
+        Entry entry;
+        entry.info = {finished.key.path, loaded.image.size(), qint64(loaded.image.sizeInBytes()), finished.key.modified, {}};
+        entry.fileSize = finished.key.size;
+        entry.image = loaded.image;
+
+        entries.push_front(std::move(entry));
+        byPath[finished.key.path] = entries.begin();
+        stats.bytes += entries.front().info.bytes;
+
+        evictToBudget();
+      }
+    }
+  }
+
+  finished.promise->set_value(std::move(loaded));
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <QDateTime>
+#include <QByteArray>
+#include <QImage>
+#include <QString>
+#include <QStringList>
+
+#include <functional>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Decoded input images kept across saves, keyed by canonical path and invalidated when the file's
+// modification time or size changes. Least recently used images are dropped to stay within a memory budget.
+// A file with the same content as one whose image is cached, such as a copy under another name, is served that
+// image rather than decoded again, as is one with the same content as a file being decoded when it is asked for, which
+// waits for that; files are only hashed to find those when a cached or decoding image comes from a file of the same
+// size. All methods may be called from any thread.
+class ImageCache : public std::enable_shared_from_this<ImageCache>
+{
+public:
+  // decodes filename, or returns a null image and sets error
+  using Loader = std::function<QImage(const QString &filename, QString &error)>;
+
+  struct Stats
+  {
+    quint64 hits = 0;
+    quint64 misses = 0;
+    quint64 prefetches = 0;
+    quint64 evictions = 0;
+    quint64 duplicates = 0; // misses served the image of another file with the same content
+    qint64 bytes = 0;
+    qint64 budgetBytes = 0;
+  };
+
+  struct EntryInfo
+  {
+    QString path;
+    QSize size;
+    qint64 bytes = 0;
+    QDateTime fileModified;
+    QStringList duplicates; // other files with the same content that are served this image
+  };
+
+  ImageCache(Loader loader, qint64 budgetBytes);
+
+  // Returns the cached image if the file hasn't changed since it was decoded, otherwise decodes it.
+  // If the file is already being decoded (e.g. by prefetch) this waits for that instead of decoding it again.
+  // Decoding happens outside the lock, so different files load in parallel.
+  QImage
+  get(const QString &filename, QString &error);
+
+  // Starts decoding filename on Qt's global thread pool unless it is already cached or being decoded,
+  // so that a later get() finds it ready. Must be called on a cache owned by a shared_ptr.
+  void
+  prefetch(const QString &filename);
+
+  // A hash of the file's content, kept until its modification time or size changes. Reports hashing to
+  // StageLog::current() as a "hash" stage. Returns an empty array and sets error if the file can't be read.
+  QByteArray
+  getContentHash(const QString &filename, QString &error);
+
+  void
+  clear();
+
+  void
+  setBudgetBytes(qint64 budgetBytes);
+
+  Stats
+  getStats() const;
+
+  // most recently used first
+  std::vector<EntryInfo>
+  getEntries() const;
+
+private:
+  struct FileKey
+  {
+    QString path;
+    QDateTime modified;
+    qint64 size = 0;
+  };
+
+  struct Loaded
+  {
+    QImage image;
+    QString error;
+    QString duplicateOf; // the path of the cached entry image came from, if it wasn't decoded
+  };
+
+  struct Entry
+  {
+    EntryInfo info; // of the file the image was decoded from
+    qint64 fileSize = 0;
+    QImage image;
+    std::vector<FileKey> duplicates; // other files found to have the same content
+  };
+
+  struct HashRecord
+  {
+    QDateTime modified;
+    qint64 size = 0;
+    QByteArray hash;
+  };
+
+  struct Loading
+  {
+    FileKey key;
+    quint64 sequence = 0; // loads only wait for ones started before them, so that two never wait for each other
+    std::shared_ptr<std::promise<Loaded>> promise;
+    std::shared_future<Loaded> future;
+  };
+
+  const Loader loader;
+
+  mutable std::mutex mutex;
+  std::list<Entry> entries; // most recently used first
+  std::map<QString, std::list<Entry>::iterator> byPath; // by the path of the entry and of each of its duplicates
+  std::map<QString, Loading> loading; // by path
+  std::map<QString, HashRecord> hashes; // by path
+  quint64 loadsStarted = 0;
+  Stats stats;
+
+  static FileKey
+  getFileKey(const QString &filename);
+
+  // these expect the mutex to be held
+  const Entry *
+  findFresh(const FileKey &key);
+  const Loading *
+  findLoading(const FileKey &key) const;
+  Loading &
+  startLoading(const FileKey &key);
+  void
+  evictToBudget();
+  void
+  eraseEntry(std::list<Entry>::iterator entry);
+  void
+  forgetPath(const QString &path);
+
+  // serves a file of the same content if one is cached or was being decoded first, or else decodes filename; without
+  // holding the mutex
+  Loaded
+  load(const QString &filename, const Loading &started);
+
+  void
+  finishLoading(const Loading &finished, Loaded loaded);
+};
@@ -0,0 +1,177 @@
+#include "MappedImage.hh"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QtEndian>
+
+#include <cctype>
+#include <limits>
+#include <memory>
+
+namespace
+{
+  // where the rows are in the file and what they hold
+  struct Layout
+  {
+    qint64 offset = 0;
+    int width = 0;
+    int height = 0;
+    qsizetype bytesPerLine = 0;
+    QImage::Format format = QImage::Format_Invalid;
+  };
+
+  quint16
+  read16(const uchar *data)
+  {
+    return qFromLittleEndian<quint16>(data);
+  }
+
+  quint32
+  read32(const uchar *data)
+  {
+    return qFromLittleEndian<quint32>(data);
+  }
+
+  // a decimal number after whitespace and # comments, as in StripIO's reader
+  bool
+  readNumber(const uchar *data, qint64 size, qint64 &pos, int &value)
+  {
+    for (;;)
+    {
+      if (pos >= size)
+        return false;
+      if (data[pos] == '#')
+      {
+        while (pos < size && data[pos] != '\n' && data[pos] != '\r')
+          ++pos;
+      }
+      else if (std::isspace(data[pos]))
+        ++pos;
+      else
+        break;
+    }
+
+    if (!std::isdigit(data[pos]))
+      return false;
+
+    qint64 number = 0;
+    for (; pos < size && std::isdigit(data[pos]); ++pos)
+    {
+      number = number * 10 + (data[pos] - '0');
+      if (number > 0x7fffffff)
+        return false;
+    }
+    value = int(number);
+    return true;
+  }
+
+  bool
+  parseNetpbm(const uchar *data, qint64 size, Layout &layout)
+  {
+    if (size < 2 || data[0] != 'P' || (data[1] != '5' && data[1] != '6'))
+      return false;
+    const int channels = data[1] == '5' ? 1 : 3;
+
+    // other maximum values make QImageReader rescale
+    qint64 pos = 2;
+    int maxValue = 0;
+    if (!readNumber(data, size, pos, layout.width) || !readNumber(data, size, pos, layout.height)
+      || !readNumber(data, size, pos, maxValue) || maxValue != 255)
+      return false;
+
+    // exactly one whitespace character separates the header from the pixels
+    if (pos >= size || !std::isspace(data[pos]))
+      return false;
+
+    layout.offset = pos + 1;
+    layout.bytesPerLine = qsizetype(layout.width) * channels;
+    layout.format = channels == 1 ? QImage::Format_Grayscale8 : QImage::Format_RGB888;
+    return true;
+  }
+
+  bool
+  parseTga(const uchar *data, qint64 size, Layout &layout)
+  {
+    constexpr int headerBytes = 18;
+    if (size < headerBytes)
+      return false;
+
+    // no color map, uncompressed 24-bit true color with no alpha bits, top-left origin
+    if (data[1] != 0 || data[2] != 2 || data[16] != 24 || (data[17] & 0x3f) != 0x20)
+      return false;
+
+    layout.offset = headerBytes + data[0];
+    layout.width = read16(data + 12);
+    layout.height = read16(data + 14);
+    layout.bytesPerLine = qsizetype(layout.width) * 3;
+    layout.format = QImage::Format_BGR888;
+    return true;
+  }
+
+  bool
+  parseBmp(const uchar *data, qint64 size, Layout &layout)
+  {
+    constexpr int fileHeaderBytes = 14;
+    if (size < fileHeaderBytes + 40 || data[0] != 'B' || data[1] != 'M')
+      return false;
+
+    // 24-bit BI_RGB, top-down
+    const uchar *info = data + fileHeaderBytes;
+    const qint32 width = qint32(read32(info + 4));
+    const qint32 height = qint32(read32(info + 8));
+    if (read32(info) < 40 || read16(info + 12) != 1 || read16(info + 14) != 24 || read32(info + 16) != 0 || height >= 0
+      || height == std::numeric_limits<qint32>::min())
+      return false;
+
+    // rows are padded to 4 bytes
+    layout.offset = read32(data + 10);
+    layout.width = width;
+    layout.height = -height;
+    layout.bytesPerLine = (qsizetype(width) * 3 + 3) & ~qsizetype(3);
+    layout.format = QImage::Format_BGR888;
+    return true;
+  }
+
+  bool
+  parse(const QString &filename, const uchar *data, qint64 size, Layout &layout)
+  {
+    // TGA has no signature, so it goes by the suffix
+    if (parseNetpbm(data, size, layout) || parseBmp(data, size, layout))
+      return true;
+    return QFileInfo(filename).suffix().compare("tga", Qt::CaseInsensitive) == 0 && parseTga(data, size, layout);
+  }
+
+  void
+  unmapFile(void *file)
+  {
+    delete static_cast<QFile*>(file); // closing unmaps
+  }
+} // namespace
+
+QImage
+mapImageFile(const QString &filename)
+{
+  auto file = std::make_unique<QFile>(filename);
+  if (!file->open(QIODevice::ReadOnly))
+    return {};
+
+  const qint64 size = file->size();
+  const uchar *data = size > 0 ? file->map(0, size) : nullptr;
+  if (!data)
+    return {};
+
+  Layout layout;
+  if (!parse(filename, data, size, layout) || layout.width <= 0 || layout.height <= 0 || layout.offset < 0)
+    return {};
+
+  // the last row needs only its pixels, not its padding
+  const qsizetype pixelBytes = qsizetype(layout.width) * (QImage::toPixelFormat(layout.format).bitsPerPixel() / 8);
+  if (layout.offset + qint64(layout.bytesPerLine) * (layout.height - 1) + pixelBytes > size)
+    return {};
+
+  QImage image(data + layout.offset, layout.width, layout.height, layout.bytesPerLine, layout.format, unmapFile, file.get());
+  if (image.isNull())
+    return {}; // the cleanup function isn't called for an image that wasn't made
+  file.release();
+  return image;
+}
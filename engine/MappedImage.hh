@@ -0,0 +1,19 @@
+#pragma once
+
+#include <QImage>
+#include <QString>
+
+// Uncompressed image files whose pixel rows can be used where they lie, so that composing reads them straight from
+// the page cache with no decoding and no copy. The image wraps a read-only mapping of the file, which stays mapped
+// until the last copy of the image is gone; truncating the file in place meanwhile is not safe, and writing it changes
+// the image. Such images are therefore only held for as long as one composition runs, and never cached.
+//
+// Mapped layouts, each giving the values QImageReader would:
+// - PGM/PPM: binary (P5/P6) with a maximum value of 255, as Format_Grayscale8 and Format_RGB888
+// - TGA: uncompressed 24-bit true color with a top-left origin, as Format_BGR888
+// - BMP: 24-bit BI_RGB stored top-down (with a negative height), as Format_BGR888
+// Their pixels are read a byte at a time, so rows may start anywhere; the 32-bit pixels of TGA and BMP files follow
+// headers that leave them unaligned, so those are decoded. Anything else gives a null image, and callers decode the
+// file instead.
+QImage
+mapImageFile(const QString &filename);
@@ -0,0 +1,229 @@
+#include "MipChain.hh"
+
+#include "BufferPool.hh"
+#include "TilePool.hh"
+
+#include <type_traits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIP_CHAIN_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+  // bands of fewer rows would leave too many levels to finish()
+  constexpr int minBandLevels = 4;
+
+  template<typename T>
+  using Sum = std::conditional_t<std::is_floating_point_v<T>, float, quint32>;
+
+  template<typename T>
+  T
+  average(Sum<T> sum, int count)
+  {
+    if constexpr (std::is_floating_point_v<T>)
+      return sum / float(count);
+    else
+      return T((sum + quint32(count) / 2) / quint32(count));
+  }
+
+#ifdef MIP_CHAIN_SSE2
+
+  // 4 texels of 8-bit RGBA from 2 x 2 each per iteration, summed at 16 bits; returns how many it made
+  int
+  downsampleSse2(quint8 *dst, const quint8 *const (&src)[2], int pairs)
+  {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+
+    int x = 0;
+    for (; x + 4 <= pairs; x += 4)
+    {
+      // each of these holds two source texels, both rows added
+      __m128i sums[4];
+      for (int i : {0, 1})
+      {
+        const __m128i top = _mm_loadu_si128((const __m128i*)(src[0] + x * 8 + i * 16));
+        const __m128i bottom = _mm_loadu_si128((const __m128i*)(src[1] + x * 8 + i * 16));
+        sums[i * 2] = _mm_add_epi16(_mm_unpacklo_epi8(top, zero), _mm_unpacklo_epi8(bottom, zero));
+        sums[i * 2 + 1] = _mm_add_epi16(_mm_unpackhi_epi8(top, zero), _mm_unpackhi_epi8(bottom, zero));
+      }
+
+      const __m128i low = _mm_add_epi16(_mm_unpacklo_epi64(sums[0], sums[1]), _mm_unpackhi_epi64(sums[0], sums[1]));
+      const __m128i high = _mm_add_epi16(_mm_unpacklo_epi64(sums[2], sums[3]), _mm_unpackhi_epi64(sums[2], sums[3]));
+      _mm_storeu_si128((__m128i*)(dst + x * 4), _mm_packus_epi16(_mm_srli_epi16(_mm_add_epi16(low, two), 2), _mm_srli_epi16(_mm_add_epi16(high, two), 2)));
+    }
+
+    return x;
+  }
+
+#endif // MIP_CHAIN_SSE2
+
+  template<typename T, int channels, int rows>
+  void
+  downsampleRow(T *dst, const T *const (&src)[rows], int srcWidth, int dstWidth)
+  {
+    // every texel but the last averages two columns; that one takes what is left, one to three columns
+    const int pairs = dstWidth - 1;
+    int x = 0;
+#ifdef MIP_CHAIN_SSE2
+    if constexpr (std::is_same_v<T, quint8> && channels == 4 && rows == 2)
+      x = downsampleSse2(dst, src, pairs);
+#endif
+    for (; x < pairs; ++x)
+      for (int c = 0; c < channels; ++c)
+      {
+        Sum<T> sum = 0;
+        for (int r = 0; r < rows; ++r)
+          sum += Sum<T>(src[r][2 * x * channels + c]) + Sum<T>(src[r][(2 * x + 1) * channels + c]);
+        dst[x * channels + c] = average<T>(sum, 2 * rows);
+      }
+
+    for (int c = 0; c < channels; ++c)
+    {
+      Sum<T> sum = 0;
+      for (int r = 0; r < rows; ++r)
+        for (int x = 2 * pairs; x < srcWidth; ++x)
+          sum += Sum<T>(src[r][x * channels + c]);
+      dst[pairs * channels + c] = average<T>(sum, (srcWidth - 2 * pairs) * rows);
+    }
+  }
+
+  template<typename T, int channels>
+  void
+  downsampleRow(uchar *dst, const uchar *const *srcRows, int srcRowCount, int srcWidth, int dstWidth)
+  {
+    const auto row = [&](int r){ return (const T*)srcRows[r]; };
+    switch (srcRowCount)
+    {
+      case 1:
+        return downsampleRow<T, channels, 1>((T*)dst, {row(0)}, srcWidth, dstWidth);
+      case 2:
+        return downsampleRow<T, channels, 2>((T*)dst, {row(0), row(1)}, srcWidth, dstWidth);
+      default:
+        return downsampleRow<T, channels, 3>((T*)dst, {row(0), row(1), row(2)}, srcWidth, dstWidth);
+    }
+  }
+} // namespace
+
+MipChain::MipChain(QSize size, QImage::Format format)
+  : size{size}
+{
+  switch (format)
+  {
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+    case QImage::Format_RGBA8888:
+      rowFn = downsampleRow<quint8, 4>;
+      break;
+    case QImage::Format_RGB888:
+      rowFn = downsampleRow<quint8, 3>;
+      break;
+    case QImage::Format_RGBX64:
+    case QImage::Format_RGBA64:
+      rowFn = downsampleRow<quint16, 4>;
+      break;
+    case QImage::Format_RGBX32FPx4:
+    case QImage::Format_RGBA32FPx4:
+      rowFn = downsampleRow<float, 4>;
+      break;
+    default:
+      return;
+  }
+
+  for (QSize levelSize = size; levelSize.width() > 1 || levelSize.height() > 1;)
+  {
+    levelSize = QSize(std::max(1, levelSize.width() / 2), std::max(1, levelSize.height() / 2));
+    levels.push_back(allocateImage(levelSize, format));
+    if (levels.back().isNull())
+    {
+      levels.clear();
+      levelBits.clear();
+      return;
+    }
+    levelBits.push_back(levels.back().bits());
+  }
+}
+
+int
+MipChain::alignBandRows(int bandRows)
+{
+  int rows = 1 << minBandLevels;
+  int rowLevels = minBandLevels;
+  while (rows * 2 <= bandRows)
+  {
+    rows *= 2;
+    ++rowLevels;
+  }
+
+  if (rows >= size.height())
+  {
+    this->bandRows = size.height();
+    bandLevels = int(levels.size());
+  }
+  else
+  {
+    this->bandRows = rows;
+    bandLevels = std::min(int(levels.size()), rowLevels);
+  }
+  return this->bandRows;
+}
+
+void
+MipChain::downsampleBand(const uchar *imageBits, qsizetype imageBytesPerLine, int yBegin, int yEnd)
+{
+  // bands are a power of two rows, at least 2^bandLevels, so each level's share of a band starts on an even row of
+  // the level above; the last band also gets the odd row at the bottom
+  const bool lastBand = yEnd == size.height();
+  const uchar *srcBits = imageBits;
+  qsizetype srcBytesPerLine = imageBytesPerLine;
+  QSize srcSize = size;
+
+  for (int level = 1; level <= bandLevels; ++level)
+  {
+    const QImage &dst = levels[level - 1];
+    downsampleRows(srcBits, srcBytesPerLine, srcSize, level, yBegin >> level, lastBand ? dst.height() : yEnd >> level);
+    srcBits = levelBits[level - 1];
+    srcBytesPerLine = dst.bytesPerLine();
+    srcSize = dst.size();
+  }
+}
+
+void
+MipChain::finish(TilePool &pool)
+{
+  for (int level = bandLevels + 1; level <= int(levels.size()); ++level)
+  {
+    const QImage &src = levels[level - 2];
+    pool.run(levels[level - 1].height(), [&](int y){
+      downsampleRows(levelBits[level - 2], src.bytesPerLine(), src.size(), level, y, y + 1);
+    });
+  }
+}
+
+qint64
+MipChain::getBytes() const
+{
+  qint64 bytes = 0;
+  for (const QImage &level : levels)
+    bytes += level.sizeInBytes();
+  return bytes;
+}
+
+void
+MipChain::downsampleRows(const uchar *srcBits, qsizetype srcBytesPerLine, QSize srcSize, int level, int yBegin, int yEnd) const
+{
+  const QImage &dst = levels[level - 1];
+
+  for (int y = yBegin; y < yEnd; ++y)
+  {
+    // like the columns: two rows each, and whatever is left for the last
+    const int srcBegin = 2 * y;
+    const int srcEnd = y == dst.height() - 1 ? srcSize.height() : srcBegin + 2;
+    const uchar *srcRows[3]{};
+    for (int r = srcBegin; r < srcEnd; ++r)
+      srcRows[r - srcBegin] = srcBits + r * srcBytesPerLine;
+    rowFn(levelBits[level - 1] + y * dst.bytesPerLine(), srcRows, srcEnd - srcBegin, srcSize.width(), dst.width());
+  }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <QImage>
+
+#include <algorithm>
+#include <vector>
+
+class TilePool;
+
+// The mip levels below a composed image, each made from the one above by averaging boxes of 2 x 2 texels, or 3 wide
+// or high along an odd edge so that no texel is dropped. Levels halve (rounding down) to 1 x 1, as in Direct3D and
+// OpenGL. Channels are averaged on their own, without premultiplying or linearizing: channel-packed textures hold
+// data such as roughness or height rather than colors.
+//
+// The composers make the levels of each band of rows right after composing it, while it is still in cache; only the
+// few smallest levels are made afterwards. Any 3- or 4-channel layout of 8-bit, 16-bit or float samples they write
+// is taken as it is.
+class MipChain
+{
+public:
+  // The levels below an image of size and format; null if the image is 1 x 1 or a level couldn't be allocated.
+  MipChain(QSize size, QImage::Format format);
+
+  MipChain(const MipChain &) = delete;
+  MipChain &operator=(const MipChain &) = delete;
+
+  bool
+  isNull() const { return levels.empty(); }
+
+  // Rounds bandRows (at most the image height) to a power of two that downsampleBand() can make as many levels from
+  // as possible, or to the whole height, and returns it. To be called before the first band.
+  int
+  alignBandRows(int bandRows);
+
+  // Bands of alignBandRows() rows, the last of which also takes the rows left over, so that no level row needs image
+  // rows of two bands.
+  int
+  getBandCount() const { return std::max(1, size.height() / bandRows); }
+
+  // Makes the rows of the levels that band [yBegin, yEnd) of the image covers. Different bands can be done at once.
+  void
+  downsampleBand(const uchar *imageBits, qsizetype imageBytesPerLine, int yBegin, int yEnd);
+
+  // Makes the levels too small to make by bands, rows spread over the pool. To be called after the last band.
+  void
+  finish(TilePool &pool);
+
+  // level 1 (half the size) first
+  const std::vector<QImage> &
+  getLevels() const { return levels; }
+
+  qint64
+  getBytes() const;
+
+private:
+  using RowFn = void (*)(uchar *dst, const uchar *const *srcRows, int srcRowCount, int srcWidth, int dstWidth);
+
+  QSize size;
+  std::vector<QImage> levels;
+  std::vector<uchar*> levelBits; // bits() detaches, so they are fetched once rather than from the worker threads
+  RowFn rowFn = nullptr;
+  int bandRows = 1;
+  int bandLevels = 0; // levels made by downsampleBand()
+
+  void
+  downsampleRows(const uchar *srcBits, qsizetype srcBytesPerLine, QSize srcSize, int level, int yBegin, int yEnd) const;
+};
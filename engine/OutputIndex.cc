@@ -0,0 +1,216 @@
+#include "OutputIndex.hh"
+
+#include "ImageCache.hh"
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+
+#include <utility>
+#include <vector>
+
+namespace
+{
+  // to change whenever the same spec and inputs would compose or encode to something else, or the records change;
+  // version 1 didn't record the mip level files written beside an output
+  constexpr int indexVersion = 2;
+
+  QJsonObject
+  toJson(const QDateTime &modified, qint64 size, const QByteArray &hash, const QStringList &companions)
+  {
+    QJsonObject object{{"modified", double(modified.toMSecsSinceEpoch())}, {"size", double(size)}, {"hash", QString::fromLatin1(hash.toHex())}};
+    if (!companions.isEmpty())
+      object.insert("companions", QJsonArray::fromStringList(companions));
+    return object;
+  }
+} // namespace
+
+OutputIndex::OutputIndex(QString filename)
+  : filename{std::move(filename)}
+{
+}
+
+bool
+OutputIndex::load(QString &error)
+{
+  std::lock_guard lock(mutex);
+  inputs.clear();
+  outputs.clear();
+
+  QFile file(filename);
+  if (!file.exists())
+    return true;
+  if (!file.open(QIODevice::ReadOnly))
+  {
+    error = file.errorString();
+    return false;
+  }
+
+  QJsonParseError parseError;
+  const QJsonDocument document = QJsonDocument::fromJson(file.readAll(), &parseError);
+  if (!document.isObject())
+  {
+    error = "not an index: " + parseError.errorString();
+    return false;
+  }
+
+  // an index from another version says nothing about what this one would write
+  const QJsonObject object = document.object();
+  if (object.value("version").toInt() != indexVersion)
+    return true;
+
+  for (auto [key, records] : {std::pair{"inputs", &inputs}, std::pair{"outputs", &outputs}})
+  {
+    const QJsonObject byPath = object.value(key).toObject();
+    for (auto it = byPath.begin(); it != byPath.end(); ++it)
+    {
+      const QJsonObject record = it.value().toObject();
+      QStringList companions;
+      for (const QJsonValue companion : record.value("companions").toArray())
+        companions.append(companion.toString());
+      (*records)[it.key()] = {QDateTime::fromMSecsSinceEpoch(qint64(record.value("modified").toDouble())), qint64(record.value("size").toDouble()),
+                              QByteArray::fromHex(record.value("hash").toString().toLatin1()), companions};
+    }
+  }
+  return true;
+}
+
+bool
+OutputIndex::save(QString &error) const
+{
+  QJsonObject object{{"version", indexVersion}};
+  {
+    std::lock_guard lock(mutex);
+    for (auto [key, records] : {std::pair{"inputs", &inputs}, std::pair{"outputs", &outputs}})
+    {
+      QJsonObject byPath;
+      for (const auto &[path, record] : *records)
+        byPath.insert(path, toJson(record.modified, record.size, record.hash, record.companions));
+      object.insert(key, byPath);
+    }
+  }
+
+  QSaveFile file(filename);
+  const QByteArray bytes = QJsonDocument(object).toJson(QJsonDocument::Compact);
+  if (!file.open(QIODevice::WriteOnly) || file.write(bytes) != bytes.size() || !file.commit())
+  {
+    error = file.errorString();
+    return false;
+  }
+  return true;
+}
+
+QByteArray
+OutputIndex::makeFingerprint(const CompositionSpec &spec, const SaveOptions &options, ImageCache &imageCache, QString &error)
+{
+  QCryptographicHash hash(QCryptographicHash::Blake2b_256);
+  const auto addNumber = [&](qint64 number){ hash.addData(QByteArray::number(number) + ';'); };
+
+  // a different Qt may encode differently
+  addNumber(indexVersion);
+  hash.addData(QByteArray(qVersion()) + ';');
+
+  for (const ChannelSpec &channel : spec.channels)
+  {
+    addNumber(int(channel.source));
+    if (channel.source == InputSource::Constant)
+    {
+      addNumber(channel.constant);
+      continue;
+    }
+
+    const QByteArray inputHash = getInputHash(channel.filename, imageCache, error);
+    if (inputHash.isEmpty())
+      return {};
+    hash.addData(inputHash);
+    addNumber(channel.inputChannel);
+    addNumber(channel.invert);
+  }
+
+  addNumber(spec.size ? spec.size->width() : -1);
+  addNumber(spec.size ? spec.size->height() : -1);
+  addNumber(int(spec.resize));
+  if (spec.resize != ResizeMode::None)
+    addNumber(int(spec.filter));
+  addNumber(int(spec.precision));
+  addNumber(spec.mipmaps);
+  hash.addData(spec.saveFormat + ';');
+
+  addNumber(options.pngLevel);
+  addNumber(int(options.pngStrategy));
+  addNumber(options.parallelPng);
+  addNumber(options.quality);
+  addNumber(int(options.ddsFormat));
+  addNumber(int(options.ddsQuality));
+
+  return hash.result();
+}
+
+bool
+OutputIndex::isUpToDate(const QString &output, const QByteArray &fingerprint) const
+{
+  const QString path = QFileInfo(output).absoluteFilePath();
+
+  std::lock_guard lock(mutex);
+  if (!isUnchanged(path, fingerprint))
+    return false;
+  for (const QString &companion : outputs.at(path).companions)
+    if (!isUnchanged(companion, fingerprint))
+      return false;
+  return true;
+}
+
+void
+OutputIndex::setWritten(const QStringList &files, const QByteArray &fingerprint)
+{
+  std::vector<std::pair<QString, Record>> written;
+  for (const QString &file : files)
+  {
+    const QFileInfo info(file);
+    if (!info.exists())
+      return;
+    written.push_back({info.absoluteFilePath(), {info.lastModified(), info.size(), fingerprint, {}}});
+  }
+  if (written.empty())
+    return;
+
+  for (size_t i = 1; i < written.size(); ++i)
+    written.front().second.companions.append(written[i].first);
+
+  std::lock_guard lock(mutex);
+  for (auto &[path, record] : written)
+    outputs[path] = std::move(record);
+}
+
+bool
+OutputIndex::isUnchanged(const QString &path, const QByteArray &fingerprint) const
+{
+  const QFileInfo info(path);
+  const auto it = outputs.find(path);
+  return info.exists() && it != outputs.end() && it->second.hash == fingerprint && it->second.modified == info.lastModified() && it->second.size == info.size();
+}
+
+QByteArray
+OutputIndex::getInputHash(const QString &input, ImageCache &imageCache, QString &error)
+{
+  const QFileInfo info(input);
+  const QString path = info.absoluteFilePath();
+  {
+    std::lock_guard lock(mutex);
+    const auto it = inputs.find(path);
+    if (it != inputs.end() && info.exists() && it->second.modified == info.lastModified() && it->second.size == info.size())
+      return it->second.hash;
+  }
+
+  const QByteArray hash = imageCache.getContentHash(input, error);
+  if (!hash.isEmpty())
+  {
+    std::lock_guard lock(mutex);
+    inputs[path] = {info.lastModified(), info.size(), hash};
+  }
+  return hash;
+}
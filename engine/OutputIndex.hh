@@ -0,0 +1,74 @@
+#pragma once
+
+#include "CompositionSpec.hh"
+#include "SaveOptions.hh"
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QString>
+#include <QStringList>
+
+#include <map>
+#include <mutex>
+
+class ImageCache;
+
+// What each output was last written from, so that an output whose inputs and settings haven't changed since can be
+// skipped rather than decoded, composed and encoded again. An output's fingerprint hashes the content of every input
+// it reads, not their paths, together with everything else its bytes depend on: the channels, size, resizing,
+// precision, mipmaps, format and save options. The index is a JSON file that also keeps the content hash of each
+// input by its modification time and size, so that a later run only reads the inputs that changed. An output is only
+// up to date if every file written for it, such as its mip levels, is as it was written.
+//
+// All methods may be called from any thread.
+class OutputIndex
+{
+public:
+  explicit OutputIndex(QString filename);
+
+  // replaces the index with the file's; a missing file is an empty index
+  bool
+  load(QString &error);
+
+  // writes the index to its file, replacing it only once it is completely written
+  bool
+  save(QString &error) const;
+
+  // Hashes of inputs not in the index are taken from imageCache and added. Returns an empty array and sets error
+  // if an input can't be read.
+  QByteArray
+  makeFingerprint(const CompositionSpec &spec, const SaveOptions &options, ImageCache &imageCache, QString &error);
+
+  // whether output and the other files written with it were written from fingerprint and haven't been changed since
+  bool
+  isUpToDate(const QString &output, const QByteArray &fingerprint) const;
+
+  // records that files, the output first and then the others written with it (see getWrittenFiles()), have just
+  // been written from fingerprint
+  void
+  setWritten(const QStringList &files, const QByteArray &fingerprint);
+
+private:
+  // of an input, its content hash; of an output, its fingerprint
+  struct Record
+  {
+    QDateTime modified;
+    qint64 size = 0;
+    QByteArray hash;
+    QStringList companions; // of an output, the absolute paths of the other files written with it
+  };
+
+  const QString filename;
+
+  QByteArray
+  getInputHash(const QString &input, ImageCache &imageCache, QString &error);
+
+  // whether the file at path is as it was when the record of outputs under path was written from fingerprint;
+  // expects the mutex to be held
+  bool
+  isUnchanged(const QString &path, const QByteArray &fingerprint) const;
+
+  mutable std::mutex mutex;
+  std::map<QString, Record> inputs; // by absolute path
+  std::map<QString, Record> outputs; // by absolute path
+};
@@ -0,0 +1,409 @@
+#include "PngEncoder.hh"
+
+#include "Progress.hh"
+#include "TilePool.hh"
+
+#include <QRgb>
+#include <QtZlib/zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+
+namespace
+{
+  constexpr uchar signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+
+  // filtered bytes deflated by one task, and the dictionary each chunk starts from; pigz uses 128 KiB and deflate's
+  // whole window
+  constexpr qsizetype chunkBytes = 256 * 1024;
+  constexpr qsizetype windowBytes = 32 * 1024;
+
+  uchar
+  paeth(int a, int b, int c)
+  {
+    const int p = a + b - c;
+    const int pa = std::abs(p - a);
+    const int pb = std::abs(p - b);
+    const int pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc)
+      return uchar(a);
+    return uchar(pb <= pc ? b : c);
+  }
+
+  void
+  appendBigEndian32(QByteArray &data, quint32 value)
+  {
+    const char bytes[4] = {char(value >> 24), char(value >> 16), char(value >> 8), char(value)};
+    data.append(bytes, 4);
+  }
+
+  void
+  appendChunk(QByteArray &data, const char *type, const QByteArray &payload)
+  {
+    appendBigEndian32(data, quint32(payload.size()));
+    const qsizetype typeOffset = data.size();
+    data.append(type, 4);
+    data.append(payload);
+    appendBigEndian32(data, quint32(crc32(crc32(0, nullptr, 0), (const Bytef*)data.constData() + typeOffset, uInt(payload.size() + 4))));
+  }
+
+  // the second byte of the zlib header, whose level hint follows zlib's own choice
+  uchar
+  getZlibFlags(int level)
+  {
+    if (level <= 1)
+      return 0x01;
+    if (level <= 5)
+      return 0x5e;
+    return level == 6 ? 0x9c : 0xda;
+  }
+
+  // Rows of the image in PNG byte order: RGBA8888 and RGB888 are that already; ARGB32 and RGB32 are reordered into
+  // a scratch row.
+  class RowSource
+  {
+  public:
+    RowSource(const QImage &image, int channels)
+      : image{image}, swap{image.format() == QImage::Format_ARGB32 || image.format() == QImage::Format_RGB32}, channels{channels}
+    {
+      if (swap)
+        for (auto &row : rows)
+          row.resize(size_t(image.width()) * channels);
+    }
+
+    // valid until the next call but one, so a row and the one above can be held at once
+    const uchar *
+    getRow(int y)
+    {
+      if (!swap)
+        return image.constScanLine(y);
+
+      std::vector<uchar> &row = rows[next];
+      next ^= 1;
+      const auto *pixels = (const QRgb*)image.constScanLine(y);
+      uchar *out = row.data();
+      for (int x = 0; x < image.width(); ++x, out += channels)
+      {
+        out[0] = uchar(qRed(pixels[x]));
+        out[1] = uchar(qGreen(pixels[x]));
+        out[2] = uchar(qBlue(pixels[x]));
+        if (channels == 4)
+          out[3] = uchar(qAlpha(pixels[x]));
+      }
+      return row.data();
+    }
+
+  private:
+    const QImage &image;
+    const bool swap;
+    const int channels;
+    std::vector<uchar> rows[2];
+    int next = 0;
+  };
+
+  struct Chunk
+  {
+    std::vector<uchar> deflated;
+    quint32 adler = 0; // of the filtered rows
+    qsizetype bytes = 0; // filtered
+  };
+
+  // Deflates the filtered rows [yBegin, yEnd) as a raw deflate stream that ends on a byte boundary, or with the final
+  // block if last, starting from the filtered rows before yBegin as the dictionary.
+  bool
+  deflateChunk(const QImage &image, int channels, int level, PngStrategy strategy, int yBegin, int yEnd, bool last, Chunk &chunk)
+  {
+    const qsizetype rowBytes = qsizetype(image.width()) * channels;
+    RowSource source(image, channels);
+    PngRowFilter filter(rowBytes, channels);
+
+    z_stream stream{};
+    if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, getZlibStrategy(strategy)) != Z_OK)
+      return false;
+
+    // what the previous chunk ended with, filtered again rather than waited for
+    if (yBegin > 0)
+    {
+      const int dictionaryRows = int(std::min<qsizetype>(yBegin, (windowBytes + rowBytes) / (rowBytes + 1)));
+      std::vector<uchar> dictionary;
+      const uchar *previous = yBegin - dictionaryRows > 0 ? source.getRow(yBegin - dictionaryRows - 1) : nullptr;
+      for (int y = yBegin - dictionaryRows; y < yBegin; ++y)
+      {
+        const uchar *row = source.getRow(y);
+        const std::vector<uchar> &filtered = filter.filter(row, previous);
+        dictionary.insert(dictionary.end(), filtered.begin(), filtered.end());
+        previous = row;
+      }
+      const qsizetype skip = std::max<qsizetype>(0, qsizetype(dictionary.size()) - windowBytes);
+      deflateSetDictionary(&stream, dictionary.data() + skip, uInt(dictionary.size() - skip));
+    }
+
+    chunk.deflated.resize(deflateBound(&stream, uLong((yEnd - yBegin) * (rowBytes + 1))) + 64);
+    stream.next_out = chunk.deflated.data();
+    stream.avail_out = uInt(chunk.deflated.size());
+    chunk.adler = quint32(adler32(0, nullptr, 0));
+
+    bool ok = true;
+    const uchar *previous = yBegin > 0 ? source.getRow(yBegin - 1) : nullptr;
+    for (int y = yBegin; y < yEnd && ok; ++y)
+    {
+      const uchar *row = source.getRow(y);
+      const std::vector<uchar> &filtered = filter.filter(row, previous);
+      previous = row;
+
+      chunk.adler = quint32(adler32(chunk.adler, filtered.data(), uInt(filtered.size())));
+      chunk.bytes += qsizetype(filtered.size());
+
+      const int flush = y + 1 < yEnd ? Z_NO_FLUSH : last ? Z_FINISH : Z_SYNC_FLUSH;
+      stream.next_in = const_cast<uchar*>(filtered.data());
+      stream.avail_in = uInt(filtered.size());
+      for (;;)
+      {
+        if (stream.avail_out == 0)
+        {
+          // deflateBound() is for one Z_FINISH; a sync flush can need a little more
+          const size_t used = chunk.deflated.size();
+          chunk.deflated.resize(used * 2);
+          stream.next_out = chunk.deflated.data() + used;
+          stream.avail_out = uInt(chunk.deflated.size() - used);
+        }
+        const int result = deflate(&stream, flush);
+        if (result == Z_STREAM_ERROR)
+        {
+          ok = false;
+          break;
+        }
+        if (stream.avail_out > 0 && (flush == Z_FINISH ? result == Z_STREAM_END : stream.avail_in == 0))
+          break;
+      }
+    }
+
+    chunk.deflated.resize(chunk.deflated.size() - stream.avail_out);
+    deflateEnd(&stream);
+    return ok;
+  }
+
+  // the color of every pixel of image, a format canEncodePng() takes, if they are all the same; a pass that stops at
+  // the first pixel that differs, which comes early in any image with content
+  std::optional<QRgb>
+  getSolidPixel(const QImage &image)
+  {
+    const int bytesPerPixel = image.format() == QImage::Format_RGB888 ? 3 : 4;
+    const size_t rowBytes = size_t(image.width()) * bytesPerPixel;
+    const uchar *first = image.constScanLine(0);
+
+    for (size_t i = bytesPerPixel; i < rowBytes; i += bytesPerPixel)
+      if (std::memcmp(first + i, first, size_t(bytesPerPixel)) != 0)
+        return std::nullopt;
+    for (int y = 1; y < image.height(); ++y)
+      if (std::memcmp(image.constScanLine(y), first, rowBytes) != 0)
+        return std::nullopt;
+
+    switch (image.format())
+    {
+      case QImage::Format_RGB888:
+        return qRgb(first[0], first[1], first[2]);
+      case QImage::Format_RGBA8888:
+        return qRgba(first[0], first[1], first[2], first[3]);
+      default:
+        return *(const QRgb*)first;
+    }
+  }
+} // namespace
+
+PngRowFilter::PngRowFilter(qsizetype rowBytes, int bytesPerPixel)
+  : bytesPerPixel{bytesPerPixel}, zeros(size_t(rowBytes), 0)
+{
+  for (auto &candidate : filtered)
+    candidate.assign(size_t(rowBytes) + 1, 0);
+}
+
+const std::vector<uchar> &
+PngRowFilter::filter(const uchar *row, const uchar *previous)
+{
+  const qsizetype n = qsizetype(zeros.size());
+  const uchar *cur = row;
+  const uchar *prev = previous ? previous : zeros.data();
+  const int bpp = bytesPerPixel;
+
+  uchar *out[5];
+  for (int type = 0; type < 5; ++type)
+  {
+    filtered[type][0] = uchar(type);
+    out[type] = filtered[type].data() + 1;
+  }
+
+  // the first pixel has nothing to its left; the rest of the row runs without that check
+  quint64 sums[5]{};
+  const auto filterByte = [&](qsizetype i, int left, int up, int upLeft){
+    out[0][i] = cur[i];
+    out[1][i] = uchar(cur[i] - left);
+    out[2][i] = uchar(cur[i] - up);
+    out[3][i] = uchar(cur[i] - (left + up) / 2);
+    out[4][i] = uchar(cur[i] - paeth(left, up, upLeft));
+
+    for (int type = 0; type < 5; ++type)
+      sums[type] += std::abs(int(qint8(out[type][i])));
+  };
+  for (qsizetype i = 0; i < std::min<qsizetype>(bpp, n); ++i)
+    filterByte(i, 0, prev[i], 0);
+  for (qsizetype i = bpp; i < n; ++i)
+    filterByte(i, cur[i - bpp], prev[i], prev[i - bpp]);
+
+  const int best = int(std::min_element(sums, sums + 5) - sums);
+  return filtered[best];
+}
+
+int
+getZlibStrategy(PngStrategy strategy)
+{
+  switch (strategy)
+  {
+    case PngStrategy::Filtered: return Z_FILTERED;
+    case PngStrategy::Rle: return Z_RLE;
+    case PngStrategy::HuffmanOnly: return Z_HUFFMAN_ONLY;
+    default: return Z_DEFAULT_STRATEGY;
+  }
+}
+
+bool
+canEncodePng(QImage::Format format)
+{
+  return format == QImage::Format_ARGB32 || format == QImage::Format_RGB32 || format == QImage::Format_RGBA8888 || format == QImage::Format_RGB888;
+}
+
+QByteArray
+encodePng(const QImage &image, int level, PngStrategy strategy, TilePool &pool, QString &error, Progress *progress)
+{
+  const int channels = image.format() == QImage::Format_ARGB32 || image.format() == QImage::Format_RGBA8888 ? 4 : 3;
+  level = std::clamp(level, 0, 9);
+
+  if (const std::optional<QRgb> pixel = getSolidPixel(image))
+  {
+    QByteArray data = encodeSolidPng(image.size(), *pixel, channels == 4, level, error);
+    if (progress)
+      progress->advance(image.height());
+    return data;
+  }
+
+  const qsizetype filteredRowBytes = qsizetype(image.width()) * channels + 1;
+  const int rowsPerChunk = int(std::clamp<qsizetype>(chunkBytes / filteredRowBytes, 1, image.height()));
+  const int chunkCount = (image.height() + rowsPerChunk - 1) / rowsPerChunk;
+
+  std::vector<Chunk> chunks(chunkCount);
+  std::atomic<bool> failed{false};
+  pool.run(chunkCount, [&](int i){
+    if (failed || (progress && progress->isCancelled()))
+      return;
+
+    const int yBegin = i * rowsPerChunk;
+    const int yEnd = std::min(image.height(), yBegin + rowsPerChunk);
+    if (!deflateChunk(image, channels, level, strategy, yBegin, yEnd, i == chunkCount - 1, chunks[size_t(i)]))
+      failed = true;
+
+    if (progress)
+      progress->advance(yEnd - yBegin);
+  });
+
+  if (progress && progress->isCancelled())
+    return {};
+  if (failed)
+  {
+    error = "Compressing the PNG file failed";
+    return {};
+  }
+
+  QByteArray header;
+  appendBigEndian32(header, quint32(image.width()));
+  appendBigEndian32(header, quint32(image.height()));
+  header.append(char(8)); // bits per channel
+  header.append(char(channels == 4 ? 6 : 2)); // RGBA or RGB
+  header.append(3, '\0'); // deflate, adaptive filtering, not interlaced
+
+  QByteArray data((const char*)signature, 8);
+  appendChunk(data, "IHDR", header);
+
+  // an IDAT chunk per deflated chunk, the first with the zlib header and the last with the Adler-32 of them all
+  quint32 adler = quint32(adler32(0, nullptr, 0));
+  for (int i = 0; i < chunkCount; ++i)
+  {
+    const Chunk &chunk = chunks[size_t(i)];
+    adler = quint32(adler32_combine(adler, chunk.adler, chunk.bytes));
+
+    QByteArray payload;
+    if (i == 0)
+    {
+      payload.append(char(0x78));
+      payload.append(char(getZlibFlags(level)));
+    }
+    payload.append((const char*)chunk.deflated.data(), qsizetype(chunk.deflated.size()));
+    if (i == chunkCount - 1)
+      appendBigEndian32(payload, adler);
+    appendChunk(data, "IDAT", payload);
+  }
+  appendChunk(data, "IEND", {});
+  return data;
+}
+
+QByteArray
+encodeSolidPng(QSize size, QRgb pixel, bool alpha, int level, QString &error)
+{
+  // every row is filter type 0 (none) followed by the indices, all 0, so the image data is just zeros
+  qint64 remaining = (1 + (qint64(size.width()) + 7) / 8) * size.height();
+  const std::vector<uchar> zeros(size_t(std::min<qint64>(remaining, 64 * 1024)), 0);
+  std::vector<uchar> out(64 * 1024);
+
+  z_stream stream{};
+  if (deflateInit(&stream, std::clamp(level, 0, 9)) != Z_OK)
+  {
+    error = "Compressing the PNG file failed";
+    return {};
+  }
+
+  QByteArray deflated;
+  int result = Z_OK;
+  while (remaining > 0 && result != Z_STREAM_ERROR)
+  {
+    const uInt in = uInt(std::min<qint64>(remaining, qint64(zeros.size())));
+    remaining -= in;
+    stream.next_in = const_cast<uchar*>(zeros.data());
+    stream.avail_in = in;
+    do
+    {
+      stream.next_out = out.data();
+      stream.avail_out = uInt(out.size());
+      result = deflate(&stream, remaining > 0 ? Z_NO_FLUSH : Z_FINISH);
+      deflated.append((const char*)out.data(), qsizetype(out.size() - stream.avail_out));
+    } while (stream.avail_out == 0 && result != Z_STREAM_ERROR);
+  }
+  deflateEnd(&stream);
+  if (result != Z_STREAM_END)
+  {
+    error = "Compressing the PNG file failed";
+    return {};
+  }
+
+  QByteArray header;
+  appendBigEndian32(header, quint32(size.width()));
+  appendBigEndian32(header, quint32(size.height()));
+  header.append(char(1)); // bits per index
+  header.append(char(3)); // palette
+  header.append(3, '\0'); // deflate, adaptive filtering, not interlaced
+
+  QByteArray palette;
+  palette.append(char(qRed(pixel)));
+  palette.append(char(qGreen(pixel)));
+  palette.append(char(qBlue(pixel)));
+
+  QByteArray data((const char*)signature, 8);
+  appendChunk(data, "IHDR", header);
+  appendChunk(data, "PLTE", palette);
+  if (alpha && qAlpha(pixel) != 255)
+    appendChunk(data, "tRNS", QByteArray(1, char(qAlpha(pixel))));
+  appendChunk(data, "IDAT", deflated);
+  appendChunk(data, "IEND", {});
+  return data;
+}
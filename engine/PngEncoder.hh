@@ -0,0 +1,53 @@
+#pragma once
+
+#include "SaveOptions.hh"
+
+#include <QByteArray>
+#include <QImage>
+#include <QRgb>
+#include <QSize>
+#include <QString>
+
+#include <vector>
+
+class Progress;
+class TilePool;
+
+// Picks the filter of each row by the smallest sum of absolute (signed) differences, the heuristic libpng uses by
+// default.
+class PngRowFilter
+{
+public:
+  PngRowFilter(qsizetype rowBytes, int bytesPerPixel);
+
+  // row filtered against previous (null above the first row): its filter type, then rowBytes bytes
+  const std::vector<uchar> &
+  filter(const uchar *row, const uchar *previous);
+
+private:
+  int bytesPerPixel;
+  std::vector<uchar> zeros;
+  std::vector<uchar> filtered[5]; // by filter type
+};
+
+// zlib's value for strategy
+int
+getZlibStrategy(PngStrategy strategy);
+
+// Whether encodePng() takes images of format: Format_ARGB32, Format_RGB32, Format_RGBA8888 and Format_RGB888.
+bool
+canEncodePng(QImage::Format format);
+
+// A PNG of image, 8-bit RGBA or RGB as QImageWriter writes it, whose image data is deflated in chunks of rows at once
+// on the pool, as pigz does: each chunk ends on a byte boundary and starts with the 32 KiB of filtered rows before it
+// as its dictionary, so the file is barely bigger than one deflated in one go. An image of a single color is written
+// by encodeSolidPng() instead. Rows are counted into progress, if given. Empty if progress was cancelled, or with error
+// set if zlib failed.
+QByteArray
+encodePng(const QImage &image, int level, PngStrategy strategy, TilePool &pool, QString &error, Progress *progress = nullptr);
+
+// A PNG of size whose every pixel is pixel, needing no image to encode: 1-bit indices into a palette of that one
+// color, with its alpha too if alpha is set and it isn't 255, so there is next to nothing to filter or deflate.
+// Readers give the same pixel values as for encodePng()'s. Empty with error set if zlib failed.
+QByteArray
+encodeSolidPng(QSize size, QRgb pixel, bool alpha, int level, QString &error);
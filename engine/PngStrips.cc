@@ -0,0 +1,603 @@
+#include "PngStrips.hh"
+
+#include "PngEncoder.hh"
+
+#include <QRgb>
+#include <QSaveFile>
+#include <QtZlib/zlib.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+  constexpr uchar signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+
+  // compressed data is read and written in pieces of this size; also the size of the IDAT chunks written
+  constexpr qsizetype bufferBytes = 64 * 1024;
+
+  enum ColorType { Gray = 0, Rgb = 2, Palette = 3, GrayAlpha = 4, RgbAlpha = 6 };
+
+  quint32
+  readBigEndian32(const uchar *p)
+  {
+    return quint32(p[0]) << 24 | quint32(p[1]) << 16 | quint32(p[2]) << 8 | p[3];
+  }
+
+  void
+  writeBigEndian32(uchar *p, quint32 value)
+  {
+    p[0] = uchar(value >> 24);
+    p[1] = uchar(value >> 16);
+    p[2] = uchar(value >> 8);
+    p[3] = uchar(value);
+  }
+
+  // what QRgba64::toArgb32() makes of a 16-bit channel, which is what QImage::pixel() returns for 16-bit PNGs
+  constexpr uchar
+  from16(const uchar *p)
+  {
+    const quint32 v = quint32(p[0]) << 8 | p[1];
+    return uchar((v - (v >> 8) + 0x80) >> 8);
+  }
+
+  uchar
+  paeth(int a, int b, int c)
+  {
+    const int p = a + b - c;
+    const int pa = std::abs(p - a);
+    const int pb = std::abs(p - b);
+    const int pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc)
+      return uchar(a);
+    return uchar(pb <= pc ? b : c);
+  }
+
+  int
+  getChannelCount(int colorType)
+  {
+    switch (colorType)
+    {
+      case Gray: return 1;
+      case Rgb: return 3;
+      case Palette: return 1;
+      case GrayAlpha: return 2;
+      case RgbAlpha: return 4;
+    }
+    return 0;
+  }
+
+  bool
+  isValidBitDepth(int colorType, int bitDepth)
+  {
+    switch (colorType)
+    {
+      case Gray: return bitDepth == 1 || bitDepth == 2 || bitDepth == 4 || bitDepth == 8 || bitDepth == 16;
+      case Palette: return bitDepth == 1 || bitDepth == 2 || bitDepth == 4 || bitDepth == 8;
+      case Rgb:
+      case GrayAlpha:
+      case RgbAlpha: return bitDepth == 8 || bitDepth == 16;
+    }
+    return false;
+  }
+
+  class PngStripReader : public StripReader
+  {
+  public:
+    explicit PngStripReader(std::unique_ptr<QFile> file) : file{std::move(file)} {}
+
+    ~PngStripReader() override
+    {
+      if (inflating)
+        inflateEnd(&stream);
+    }
+
+    // reads everything up to the image data
+    bool
+    open(QString &error)
+    {
+      uchar header[8];
+      if (file->read((char*)header, 8) != 8 || std::memcmp(header, signature, 8) != 0)
+        return fail(error, "Not a PNG file");
+
+      bool seenHeader = false;
+      for (;;)
+      {
+        quint32 length;
+        char type[4];
+        if (!readChunkHeader(length, type, error))
+          return false;
+
+        if (std::memcmp(type, "IDAT", 4) == 0)
+        {
+          if (!seenHeader || (colorType == Palette && paletteSize == 0))
+            return fail(error, "The PNG file has no header or palette before its image data");
+          chunkLeft = length;
+          chunkCrc = crc32(crc32(0, nullptr, 0), (const Bytef*)type, 4);
+          break;
+        }
+
+        const bool critical = !(type[0] & 0x20);
+        const bool known = std::memcmp(type, "IHDR", 4) == 0 || std::memcmp(type, "PLTE", 4) == 0 || std::memcmp(type, "tRNS", 4) == 0;
+        if (!known)
+        {
+          if (critical)
+            return fail(error, "The PNG file has a chunk this program doesn't know");
+          if (!file->skip(qint64(length) + 4))
+            return fail(error, "The PNG file ends early");
+          continue;
+        }
+
+        std::vector<uchar> data(length + 4);
+        if (file->read((char*)data.data(), qint64(data.size())) != qint64(data.size()))
+          return fail(error, "The PNG file ends early");
+        quint32 crc = crc32(crc32(0, nullptr, 0), (const Bytef*)type, 4);
+        crc = crc32(crc, data.data(), uInt(length));
+        if (crc != readBigEndian32(data.data() + length))
+          return fail(error, "The PNG file is corrupt (CRC error)");
+
+        if (std::memcmp(type, "IHDR", 4) == 0)
+        {
+          if (length != 13)
+            return fail(error, "The PNG file has a malformed header");
+          const quint32 width = readBigEndian32(data.data());
+          const quint32 height = readBigEndian32(data.data() + 4);
+          bitDepth = data[8];
+          colorType = data[9];
+          if (width == 0 || height == 0 || width > 0x7fffffff || height > 0x7fffffff || !isValidBitDepth(colorType, bitDepth) || data[10] != 0 || data[11] != 0)
+            return fail(error, "The PNG file has a malformed header");
+          if (data[12] != 0)
+            return fail(error, "Interlaced PNG files can't be read in strips");
+          size = QSize(int(width), int(height));
+          seenHeader = true;
+        }
+        else if (std::memcmp(type, "PLTE", 4) == 0)
+        {
+          paletteSize = int(std::min<quint32>(256, length / 3));
+          for (int i = 0; i < paletteSize; ++i)
+            palette[i] = qRgb(data[i * 3], data[i * 3 + 1], data[i * 3 + 2]);
+        }
+        else // tRNS
+        {
+          // a transparent color key on gray or RGB images makes Qt change the pixel format; leave that to it
+          if (colorType != Palette)
+            return fail(error, "PNG files with a transparent color key can't be read in strips");
+          for (int i = 0; i < std::min<int>(256, int(length)); ++i)
+            palette[i] = (palette[i] & 0x00ffffff) | QRgb(data[i]) << 24;
+        }
+      }
+
+      const int bitsPerPixel = getChannelCount(colorType) * bitDepth;
+      bytesPerPixel = std::max(1, bitsPerPixel / 8);
+      rowBytes = (qsizetype(size.width()) * bitsPerPixel + 7) / 8;
+      row.assign(rowBytes + 1, 0);
+      previousRow.assign(rowBytes + 1, 0);
+      input.resize(bufferBytes);
+
+      if (inflateInit(&stream) != Z_OK)
+        return fail(error, "Couldn't start decompressing the PNG file");
+      inflating = true;
+      return true;
+    }
+
+    QSize
+    getSize() const override
+    {
+      return size;
+    }
+
+    bool
+    readRows(uchar *dst, qsizetype dstBytesPerLine, int rowCount, QString &error) override
+    {
+      for (int y = 0; y < rowCount; ++y)
+      {
+        if (!inflateRow(error))
+          return false;
+        unfilterRow();
+        convertRow((QRgb*)(dst + y * dstBytesPerLine));
+        std::swap(row, previousRow);
+        if (++rowsRead == size.height() && !checkLastChunk(error))
+          return false;
+      }
+      return true;
+    }
+
+  private:
+    std::unique_ptr<QFile> file;
+    QSize size;
+    int bitDepth = 0;
+    int colorType = 0;
+    int bytesPerPixel = 1; // whole bytes of one pixel, at least 1; what filters look back by
+    qsizetype rowBytes = 0;
+    QRgb palette[256]{}; // indices past paletteSize are 0, like QImage::pixel() gives for them
+    int paletteSize = 0;
+
+    z_stream stream{};
+    bool inflating = false;
+    std::vector<uchar> input;
+    quint32 chunkLeft = 0; // bytes of the current IDAT chunk not read yet
+    quint32 chunkCrc = 0;
+
+    std::vector<uchar> row, previousRow; // filter type, then rowBytes
+    int rowsRead = 0;
+
+    static bool
+    fail(QString &error, const char *message)
+    {
+      error = message;
+      return false;
+    }
+
+    bool
+    readChunkHeader(quint32 &length, char (&type)[4], QString &error)
+    {
+      uchar header[8];
+      if (file->read((char*)header, 8) != 8)
+        return fail(error, "The PNG file ends early");
+      length = readBigEndian32(header);
+      std::memcpy(type, header + 4, 4);
+      if (length > 0x7fffffff)
+        return fail(error, "The PNG file is corrupt");
+      return true;
+    }
+
+    // moves on to the next IDAT chunk once the current one is used up, then reads what is left of it
+    bool
+    fillInput(QString &error)
+    {
+      while (chunkLeft == 0)
+      {
+        uchar crc[4];
+        if (file->read((char*)crc, 4) != 4)
+          return fail(error, "The PNG file ends early");
+        if (readBigEndian32(crc) != chunkCrc)
+          return fail(error, "The PNG file is corrupt (CRC error)");
+
+        quint32 length;
+        char type[4];
+        if (!readChunkHeader(length, type, error))
+          return false;
+        if (std::memcmp(type, "IDAT", 4) != 0)
+          return fail(error, "The PNG file's image data ends early");
+        chunkLeft = length;
+        chunkCrc = crc32(crc32(0, nullptr, 0), (const Bytef*)type, 4);
+      }
+
+      const qint64 toRead = std::min<qint64>(chunkLeft, qint64(input.size()));
+      if (file->read((char*)input.data(), toRead) != toRead)
+        return fail(error, "The PNG file ends early");
+      chunkLeft -= quint32(toRead);
+      chunkCrc = crc32(chunkCrc, input.data(), uInt(toRead));
+      stream.next_in = input.data();
+      stream.avail_in = uInt(toRead);
+      return true;
+    }
+
+    // the rows can end before the IDAT chunk holding them does, so its CRC needs checking separately
+    bool
+    checkLastChunk(QString &error)
+    {
+      while (chunkLeft > 0)
+      {
+        const qint64 toRead = std::min<qint64>(chunkLeft, qint64(input.size()));
+        if (file->read((char*)input.data(), toRead) != toRead)
+          return fail(error, "The PNG file ends early");
+        chunkLeft -= quint32(toRead);
+        chunkCrc = crc32(chunkCrc, input.data(), uInt(toRead));
+      }
+
+      uchar crc[4];
+      if (file->read((char*)crc, 4) != 4)
+        return fail(error, "The PNG file ends early");
+      if (readBigEndian32(crc) != chunkCrc)
+        return fail(error, "The PNG file is corrupt (CRC error)");
+      return true;
+    }
+
+    bool
+    inflateRow(QString &error)
+    {
+      stream.next_out = row.data();
+      stream.avail_out = uInt(row.size());
+
+      while (stream.avail_out > 0)
+      {
+        if (stream.avail_in == 0 && !fillInput(error))
+          return false;
+
+        const int result = inflate(&stream, Z_NO_FLUSH);
+        if (result == Z_STREAM_END && stream.avail_out > 0)
+          return fail(error, "The PNG file's image data ends early");
+        if (result != Z_OK && result != Z_STREAM_END && !(result == Z_BUF_ERROR && stream.avail_in == 0))
+        {
+          error = QString("The PNG file's image data is corrupt: %1").arg(stream.msg ? stream.msg : "inflate failed");
+          return false;
+        }
+      }
+      return true;
+    }
+
+    void
+    unfilterRow()
+    {
+      uchar *cur = row.data() + 1;
+      const uchar *prev = previousRow.data() + 1;
+      const qsizetype n = rowBytes;
+      const int bpp = bytesPerPixel;
+
+      switch (row[0])
+      {
+        case 1: // sub
+          for (qsizetype i = bpp; i < n; ++i)
+            cur[i] = uchar(cur[i] + cur[i - bpp]);
+          break;
+        case 2: // up
+          for (qsizetype i = 0; i < n; ++i)
+            cur[i] = uchar(cur[i] + prev[i]);
+          break;
+        case 3: // average
+          for (qsizetype i = 0; i < n; ++i)
+            cur[i] = uchar(cur[i] + ((i >= bpp ? cur[i - bpp] : 0) + prev[i]) / 2);
+          break;
+        case 4: // paeth
+          for (qsizetype i = 0; i < n; ++i)
+            cur[i] = uchar(cur[i] + paeth(i >= bpp ? cur[i - bpp] : 0, prev[i], i >= bpp ? prev[i - bpp] : 0));
+          break;
+        default: // none; libpng treats unknown filters as an error, but a corrupt row is all we can make of it here
+          break;
+      }
+    }
+
+    // sample x of a row packed at bitDepth < 8
+    int
+    getPacked(const uchar *src, int x) const
+    {
+      const int bit = x * bitDepth;
+      return (src[bit / 8] >> (8 - bitDepth - bit % 8)) & ((1 << bitDepth) - 1);
+    }
+
+    void
+    convertRow(QRgb *dst) const
+    {
+      const uchar *src = row.data() + 1;
+      const int width = size.width();
+      const bool wide = bitDepth == 16;
+
+      switch (colorType)
+      {
+        case Gray:
+          if (bitDepth < 8)
+          {
+            // what libpng's expansion and Qt's gray color tables both give
+            const int scale = 255 / ((1 << bitDepth) - 1);
+            for (int x = 0; x < width; ++x)
+            {
+              const int v = getPacked(src, x) * scale;
+              dst[x] = qRgb(v, v, v);
+            }
+          }
+          else
+            for (int x = 0; x < width; ++x)
+            {
+              const uchar v = wide ? from16(src + x * 2) : src[x];
+              dst[x] = qRgb(v, v, v);
+            }
+          break;
+
+        case Rgb:
+          for (int x = 0; x < width; ++x)
+            dst[x] = wide ? qRgb(from16(src + x * 6), from16(src + x * 6 + 2), from16(src + x * 6 + 4))
+                          : qRgb(src[x * 3], src[x * 3 + 1], src[x * 3 + 2]);
+          break;
+
+        case Palette:
+          for (int x = 0; x < width; ++x)
+          {
+            const int index = bitDepth < 8 ? getPacked(src, x) : src[x];
+            dst[x] = index < paletteSize ? palette[index] : 0;
+          }
+          break;
+
+        case GrayAlpha:
+          for (int x = 0; x < width; ++x)
+          {
+            const uchar v = wide ? from16(src + x * 4) : src[x * 2];
+            const uchar a = wide ? from16(src + x * 4 + 2) : src[x * 2 + 1];
+            dst[x] = qRgba(v, v, v, a);
+          }
+          break;
+
+        case RgbAlpha:
+          for (int x = 0; x < width; ++x)
+            dst[x] = wide ? qRgba(from16(src + x * 8), from16(src + x * 8 + 2), from16(src + x * 8 + 4), from16(src + x * 8 + 6))
+                          : qRgba(src[x * 4], src[x * 4 + 1], src[x * 4 + 2], src[x * 4 + 3]);
+          break;
+      }
+    }
+  };
+
+  class PngStripWriter : public StripWriter
+  {
+  public:
+    PngStripWriter(const QString &filename, QSize size, const SaveOptions &options)
+      : file{filename}, size{size}, level{std::clamp(options.pngLevel, 0, 9)}, strategy{options.pngStrategy}, filter{qsizetype(size.width()) * 4, 4} {}
+
+    ~PngStripWriter() override
+    {
+      if (deflating)
+        deflateEnd(&stream);
+    }
+
+    bool
+    open(QString &error)
+    {
+      if (!file.open(QIODevice::WriteOnly))
+      {
+        error = file.errorString();
+        return false;
+      }
+
+      const qsizetype rowBytes = qsizetype(size.width()) * 4;
+      raw.assign(rowBytes, 0);
+      previousRaw.assign(rowBytes, 0);
+      output.resize(bufferBytes);
+
+      if (deflateInit2(&stream, level, Z_DEFLATED, 15, 8, getZlibStrategy(strategy)) != Z_OK)
+      {
+        error = "Couldn't start compressing the PNG file";
+        return false;
+      }
+      deflating = true;
+      stream.next_out = output.data();
+      stream.avail_out = uInt(output.size());
+
+      uchar header[13];
+      writeBigEndian32(header, quint32(size.width()));
+      writeBigEndian32(header + 4, quint32(size.height()));
+      header[8] = 8; // bits per channel
+      header[9] = RgbAlpha;
+      header[10] = header[11] = header[12] = 0; // deflate, adaptive filtering, not interlaced
+
+      return write(error, (const char*)signature, 8) && writeChunk(error, "IHDR", header, 13);
+    }
+
+    bool
+    writeRows(const uchar *src, qsizetype srcBytesPerLine, int rowCount, QString &error) override
+    {
+      for (int y = 0; y < rowCount; ++y)
+      {
+        const auto *pixels = (const QRgb*)(src + y * srcBytesPerLine);
+        for (int x = 0; x < size.width(); ++x)
+        {
+          raw[x * 4] = uchar(qRed(pixels[x]));
+          raw[x * 4 + 1] = uchar(qGreen(pixels[x]));
+          raw[x * 4 + 2] = uchar(qBlue(pixels[x]));
+          raw[x * 4 + 3] = uchar(qAlpha(pixels[x]));
+        }
+
+        const std::vector<uchar> &best = filter.filter(raw.data(), previousRaw.data());
+        stream.next_in = const_cast<uchar*>(best.data());
+        stream.avail_in = uInt(best.size());
+        if (!deflateInput(Z_NO_FLUSH, error))
+          return false;
+
+        std::swap(raw, previousRaw);
+        ++rowsWritten;
+      }
+      return true;
+    }
+
+    bool
+    finish(QString &error) override
+    {
+      if (rowsWritten != size.height())
+      {
+        error = "Not every row of the PNG file was written";
+        return false;
+      }
+
+      if (!deflateInput(Z_FINISH, error) || !flushOutput(error) || !writeChunk(error, "IEND", nullptr, 0))
+        return false;
+
+      if (!file.commit())
+      {
+        error = file.errorString();
+        return false;
+      }
+      return true;
+    }
+
+  private:
+    QSaveFile file;
+    const QSize size;
+    const int level;
+    const PngStrategy strategy;
+    z_stream stream{};
+    bool deflating = false;
+    std::vector<uchar> raw, previousRaw; // RGBA
+    PngRowFilter filter;
+    std::vector<uchar> output; // compressed, for the next IDAT chunk
+    int rowsWritten = 0;
+
+    bool
+    write(QString &error, const char *data, qint64 length)
+    {
+      if (file.write(data, length) != length)
+      {
+        error = file.errorString();
+        return false;
+      }
+      return true;
+    }
+
+    bool
+    writeChunk(QString &error, const char *type, const uchar *data, quint32 length)
+    {
+      uchar header[8];
+      writeBigEndian32(header, length);
+      std::memcpy(header + 4, type, 4);
+
+      quint32 crc = crc32(crc32(0, nullptr, 0), header + 4, 4);
+      if (length)
+        crc = crc32(crc, data, length);
+      uchar trailer[4];
+      writeBigEndian32(trailer, crc);
+
+      return write(error, (const char*)header, 8) && (!length || write(error, (const char*)data, length)) && write(error, (const char*)trailer, 4);
+    }
+
+    bool
+    flushOutput(QString &error)
+    {
+      const quint32 used = quint32(output.size() - stream.avail_out);
+      if (used && !writeChunk(error, "IDAT", output.data(), used))
+        return false;
+      stream.next_out = output.data();
+      stream.avail_out = uInt(output.size());
+      return true;
+    }
+
+    // compresses all of the pending input, writing an IDAT chunk whenever the output buffer fills up
+    bool
+    deflateInput(int flush, QString &error)
+    {
+      for (;;)
+      {
+        const int result = deflate(&stream, flush);
+        if (result == Z_STREAM_ERROR)
+        {
+          error = "Compressing the PNG file failed";
+          return false;
+        }
+        if (stream.avail_out == 0)
+        {
+          if (!flushOutput(error))
+            return false;
+          continue;
+        }
+        if (flush == Z_FINISH ? result == Z_STREAM_END : stream.avail_in == 0)
+          return true;
+      }
+    }
+  };
+} // namespace
+
+std::unique_ptr<StripReader>
+openPngStripReader(std::unique_ptr<QFile> file, QString &error)
+{
+  auto reader = std::make_unique<PngStripReader>(std::move(file));
+  if (!reader->open(error))
+    return nullptr;
+  return reader;
+}
+
+std::unique_ptr<StripWriter>
+openPngStripWriter(const QString &filename, QSize size, const SaveOptions &options, QString &error)
+{
+  auto writer = std::make_unique<PngStripWriter>(filename, size, options);
+  if (!writer->open(error))
+    return nullptr;
+  return writer;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "StripIO.hh"
+
+#include <QFile>
+
+#include <memory>
+
+// The PNG StripReader and StripWriter; see StripIO.hh for what they support.
+
+// file is open and positioned at the PNG signature.
+std::unique_ptr<StripReader>
+openPngStripReader(std::unique_ptr<QFile> file, QString &error);
+
+// Writes 8-bit RGBA, like QImageWriter does for Format_ARGB32 images.
+std::unique_ptr<StripWriter>
+openPngStripWriter(const QString &filename, QSize size, const SaveOptions &options, QString &error);
@@ -0,0 +1,4 @@
+#pragma once
+
+// Bits per channel of a composite image: QImage::Format_ARGB32, Format_RGBA64 or Format_RGBA32FPx4.
+enum class Precision { Uint8, Uint16, Float32, NUM };
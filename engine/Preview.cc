@@ -0,0 +1,209 @@
+#include "Preview.hh"
+
+#include "ComposeKernel.hh"
+#include "Resample.hh"
+#include "TilePool.hh"
+
+#include <QRgb>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace
+{
+  constexpr int channelShifts[4] = {16, 8, 0, 24}; // RGBA in QRgb
+
+  // constants only depend on their value, images on everything else
+  bool
+  isSameLane(const ChannelSpec &a, const ChannelSpec &b)
+  {
+    if (a.source != b.source)
+      return false;
+    if (a.source == InputSource::Constant)
+      return a.constant == b.constant;
+    return a.filename == b.filename && (a.inputChannel & 3) == (b.inputChannel & 3) && a.invert == b.invert;
+  }
+
+  // sets one byte of every pixel, from a lane of thumbnail or to value
+  void
+  writeLane(QImage &image, int outputChannel, const QImage *thumbnail, int inputChannel, bool invert, quint8 value)
+  {
+    const int shift = channelShifts[outputChannel];
+    const QRgb keep = ~(QRgb(0xff) << shift);
+    const QRgb flip = invert ? 0xff : 0;
+    const int width = image.width();
+
+    for (int y = 0; y < image.height(); ++y)
+    {
+      auto *dst = (QRgb*)image.scanLine(y);
+      if (!thumbnail)
+      {
+        for (int x = 0; x < width; ++x)
+          dst[x] = (dst[x] & keep) | (QRgb(value) << shift);
+        continue;
+      }
+
+      const auto *src = (const QRgb*)thumbnail->constScanLine(y);
+      const int srcShift = channelShifts[inputChannel];
+      for (int x = 0; x < width; ++x)
+        dst[x] = (dst[x] & keep) | ((((src[x] >> srcShift) & 0xff) ^ flip) << shift);
+    }
+  }
+} // namespace
+
+QSize
+Preview::getPreviewSize(QSize size, int maxSide)
+{
+  if (size.isEmpty())
+    return QSize(1, 1);
+  const qint64 longest = std::max(size.width(), size.height());
+  if (longest <= maxSide)
+    return size;
+  return QSize(std::max<qint64>(1, size.width() * maxSide / longest), std::max<qint64>(1, size.height() * maxSide / longest));
+}
+
+QImage
+Preview::makeThumbnail(const QImage &image, QSize size, TilePool &pool)
+{
+  if (size.isEmpty() || size.width() > image.width() || size.height() > image.height())
+    return {};
+
+  // one lane per channel gets the image into what the kernels read: 32-bit pixels or a gray plane
+  ComposeKernel::LaneSource lanes[4];
+  for (int c : {0, 1, 2, 3})
+  {
+    lanes[c].image = image;
+    lanes[c].inputChannel = c;
+  }
+  QImage thumbnail(size, QImage::Format_ARGB32);
+  if (thumbnail.isNull() || !ComposeKernel::prepareLanes(lanes, pool))
+    return {};
+
+  // each source pixel counts towards the thumbnail pixel it falls in, so some thumbnail pixels cover a row or column
+  // more than others
+  const int srcWidth = image.width(), srcHeight = image.height();
+  std::vector<int> columnOf(srcWidth), columnCounts(size.width());
+  for (int x = 0; x < srcWidth; ++x)
+    ++columnCounts[size_t(columnOf[size_t(x)] = int(qint64(x) * size.width() / srcWidth))];
+
+  uchar *thumbnailBits = thumbnail.bits();
+  const qsizetype thumbnailBytesPerLine = thumbnail.bytesPerLine();
+  pool.run(size.height(), [&](int y){
+    const int yBegin = int((qint64(y) * srcHeight + size.height() - 1) / size.height());
+    const int yEnd = int((qint64(y + 1) * srcHeight + size.height() - 1) / size.height());
+    std::vector<quint64> sums(size_t(size.width()) * 4);
+
+    for (int c : {0, 1, 2, 3})
+    {
+      const QImage &lane = lanes[c].image;
+      if (lane.isNull())
+        continue;
+
+      const bool gray = lane.format() == QImage::Format_Grayscale8;
+      const int shift = channelShifts[lanes[c].inputChannel & 3];
+      for (int sy = yBegin; sy < yEnd; ++sy)
+      {
+        const uchar *src = lane.constScanLine(sy);
+        if (gray)
+          for (int x = 0; x < srcWidth; ++x)
+            sums[size_t(columnOf[size_t(x)]) * 4 + c] += src[x];
+        else
+          for (int x = 0; x < srcWidth; ++x)
+            sums[size_t(columnOf[size_t(x)]) * 4 + c] += (((const QRgb*)src)[x] >> shift) & 0xff;
+      }
+    }
+
+    auto *dst = (QRgb*)(thumbnailBits + y * thumbnailBytesPerLine);
+    const quint64 rows = quint64(yEnd - yBegin);
+    for (int x = 0; x < size.width(); ++x)
+    {
+      const quint64 count = quint64(columnCounts[size_t(x)]) * rows;
+      quint8 values[4];
+      for (int c : {0, 1, 2, 3})
+        values[c] = lanes[c].image.isNull() ? lanes[c].constant : quint8((sums[size_t(x) * 4 + c] + count / 2) / count);
+      dst[x] = qRgba(values[0], values[1], values[2], values[3]);
+    }
+  });
+
+  return thumbnail;
+}
+
+void
+Preview::setThumbnail(const QString &filename, QImage thumbnail)
+{
+  thumbnails[filename] = std::move(thumbnail);
+  resized.erase(filename);
+}
+
+bool
+Preview::hasThumbnail(const QString &filename) const
+{
+  return thumbnails.count(filename) > 0;
+}
+
+void
+Preview::clear()
+{
+  thumbnails.clear();
+  resized.clear();
+}
+
+bool
+Preview::update(const CompositionSpec &spec, QSize emptySize)
+{
+  const auto findThumbnail = [&](const ChannelSpec &channel) -> const QImage *{
+    if (channel.source != InputSource::Image)
+      return nullptr;
+    const auto it = thumbnails.find(channel.filename);
+    return it == thumbnails.end() || it->second.isNull() ? nullptr : &it->second;
+  };
+
+  std::vector<QSize> sizes;
+  for (const ChannelSpec &channel : spec.channels)
+    if (const QImage *thumbnail = findThumbnail(channel))
+      sizes.push_back(thumbnail->size());
+
+  QSize size = emptySize;
+  if (spec.resize != ResizeMode::Explicit && !sizes.empty())
+    size = spec.resize == ResizeMode::None ? sizes.front() : Resample::getTargetSize(spec, sizes).value_or(sizes.front());
+
+  // thumbnails are tiny, so a pool without workers resamples them on this thread
+  const auto getResized = [&](const QString &filename, const QImage &thumbnail) -> const QImage *{
+    Resized &entry = resized[filename];
+    if (entry.image.size() != size || entry.thumbnailKey != thumbnail.cacheKey() || entry.filter != spec.filter)
+    {
+      TilePool pool(1);
+      entry = {thumbnail.cacheKey(), spec.filter, Resample::resize(thumbnail, size, spec.filter, pool)};
+    }
+    return entry.image.isNull() ? nullptr : &entry.image;
+  };
+
+  if (image.size() != size)
+  {
+    image = QImage(size, QImage::Format_ARGB32);
+    for (Lane &lane : lanes)
+      lane.drawn = false;
+  }
+
+  bool complete = true;
+  for (int c : {0, 1, 2, 3})
+  {
+    const ChannelSpec &channel = spec.channels[c];
+    const QImage *thumbnail = findThumbnail(channel);
+    if (thumbnail && thumbnail->size() != size)
+      thumbnail = spec.resize == ResizeMode::None ? nullptr : getResized(channel.filename, *thumbnail);
+    if (channel.source == InputSource::Image && !thumbnail)
+      complete = false;
+
+    Lane &lane = lanes[c];
+    const qint64 thumbnailKey = thumbnail ? thumbnail->cacheKey() : 0;
+    if (lane.drawn && isSameLane(lane.channel, channel) && lane.thumbnailKey == thumbnailKey)
+      continue;
+
+    if (!image.isNull())
+      writeLane(image, c, thumbnail, channel.inputChannel & 3, channel.invert, channel.source == InputSource::Constant ? channel.constant : 0);
+    lane = {channel, thumbnailKey, true};
+  }
+  return complete;
+}
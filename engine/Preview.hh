@@ -0,0 +1,72 @@
+#pragma once
+
+#include "CompositionSpec.hh"
+
+#include <QImage>
+#include <QSize>
+#include <QString>
+
+#include <map>
+
+class TilePool;
+
+// A downscaled composite to show while the channels are edited. Each input is reduced once to a thumbnail of the
+// preview's size, so that bringing the preview up to date after a channel changes only rewrites that channel's byte
+// of each preview pixel, however big the inputs are.
+//
+// Not thread-safe; thumbnails are meant to be made elsewhere (with makeThumbnail()) and handed in.
+class Preview
+{
+public:
+  // the largest size within maxSide x maxSide with the aspect ratio of size, at least 1 x 1
+  static QSize
+  getPreviewSize(QSize size, int maxSide);
+
+  // Format_ARGB32 of the given size, no larger than image, each pixel the average of the pixels of image it covers,
+  // with the values QImage::pixel() gives for them; rows are spread over the pool. Null if it couldn't be allocated.
+  static QImage
+  makeThumbnail(const QImage &image, QSize size, TilePool &pool);
+
+  // replaces the thumbnail of filename; lanes reading it are redrawn by the next update()
+  void
+  setThumbnail(const QString &filename, QImage thumbnail);
+
+  bool
+  hasThumbnail(const QString &filename) const;
+
+  // drops every thumbnail, e.g. when the inputs are reloaded
+  void
+  clear();
+
+  // Redraws the lanes whose channel changed since the last call, or whose thumbnail did. The preview takes the size
+  // of the first thumbnail the spec reads, or emptySize (already downscaled) if it reads none; a change of size
+  // redraws every lane. With a spec.resize, it takes the size that picks from the thumbnails instead (emptySize for
+  // ResizeMode::Explicit) and thumbnails of other sizes are resampled to it with spec.filter, on the calling thread.
+  // Image lanes without a thumbnail of that size are drawn as 0. Returns whether every lane could be drawn.
+  bool
+  update(const CompositionSpec &spec, QSize emptySize);
+
+  // Format_ARGB32; null before the first update()
+  const QImage &
+  getImage() const { return image; }
+
+private:
+  struct Lane
+  {
+    ChannelSpec channel;
+    qint64 thumbnailKey = 0; // of the thumbnail drawn, 0 for none
+    bool drawn = false;
+  };
+
+  struct Resized
+  {
+    qint64 thumbnailKey = 0; // of the thumbnail resampled
+    ResampleFilter filter = ResampleFilter::Bilinear;
+    QImage image;
+  };
+
+  std::map<QString, QImage> thumbnails;
+  std::map<QString, Resized> resized; // thumbnails resampled to the size of the preview, by file
+  QImage image;
+  Lane lanes[4]; // RGBA
+};
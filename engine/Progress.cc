@@ -0,0 +1,40 @@
+#include "Progress.hh"
+
+#include <utility>
+
+namespace
+{
+  thread_local Progress *currentProgress = nullptr;
+} // namespace
+
+Progress::Scope::Scope(Progress *progress)
+  : previous{std::exchange(currentProgress, progress)}
+{
+}
+
+Progress::Scope::~Scope()
+{
+  currentProgress = previous;
+}
+
+Progress *
+Progress::current()
+{
+  return currentProgress;
+}
+
+void
+Progress::beginStage(QString stage, qint64 total)
+{
+  std::lock_guard lock(mutex);
+  this->stage = std::move(stage);
+  this->total = total;
+  done = 0;
+}
+
+Progress::State
+Progress::getState() const
+{
+  std::lock_guard lock(mutex);
+  return {stage, done, total};
+}
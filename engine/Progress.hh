@@ -0,0 +1,61 @@
+#pragma once
+
+#include <QString>
+
+#include <atomic>
+#include <mutex>
+
+// How far a save has got, shared between the thread doing the work and a thread watching it, which may also cancel
+// it. Work checks isCancelled() between row bands and blocks of bytes, then stops and drops what it made so far.
+// All methods may be called from any thread.
+class Progress
+{
+public:
+  struct State
+  {
+    QString stage;
+    qint64 done = 0;
+    qint64 total = 0; // 0 when not known in advance
+  };
+
+  // Makes progress the one current() returns on this thread until the scope ends; lets code that can't be handed
+  // a Progress, such as an ImageCache::Loader, still report to it.
+  class Scope
+  {
+  public:
+    explicit Scope(Progress *progress);
+    ~Scope();
+
+    Scope(const Scope&) = delete;
+    Scope &operator=(const Scope&) = delete;
+
+  private:
+    Progress *const previous;
+  };
+
+  static Progress *
+  current();
+
+  // starts counting done from 0 again
+  void
+  beginStage(QString stage, qint64 total);
+
+  void
+  advance(qint64 units) { done += units; }
+
+  State
+  getState() const;
+
+  void
+  cancel() { cancelled = true; }
+
+  bool
+  isCancelled() const { return cancelled; }
+
+private:
+  mutable std::mutex mutex; // for stage, and so that a State doesn't mix two stages
+  QString stage;
+  std::atomic<qint64> done{0};
+  qint64 total = 0;
+  std::atomic<bool> cancelled{false};
+};
@@ -0,0 +1,395 @@
+#include "Resample.hh"
+
+#include "BufferPool.hh"
+#include "ComposeKernel.hh"
+#include "Progress.hh"
+#include "TilePool.hh"
+
+#include <QFloat16>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <type_traits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RESAMPLE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+  // of result rows; big enough to amortize scheduling, small enough to balance across threads
+  constexpr qsizetype bandBytes = 256 * 1024;
+
+  constexpr double pi = 3.14159265358979323846;
+
+  enum class Sample { Uint8, Uint16, Float16, Float32 };
+
+  struct Layout
+  {
+    Sample sample;
+    int channels;
+    int alpha = -1; // the channel colors are kept within, for premultiplied formats
+  };
+
+  std::optional<Layout>
+  getLayout(QImage::Format format)
+  {
+    switch (format)
+    {
+      case QImage::Format_Grayscale8:
+        return Layout{Sample::Uint8, 1};
+      case QImage::Format_RGB888:
+      case QImage::Format_BGR888:
+        return Layout{Sample::Uint8, 3};
+      case QImage::Format_RGB32:
+      case QImage::Format_ARGB32:
+      case QImage::Format_RGBX8888:
+      case QImage::Format_RGBA8888:
+        return Layout{Sample::Uint8, 4};
+      case QImage::Format_ARGB32_Premultiplied:
+        return Layout{Sample::Uint8, 4, Q_BYTE_ORDER == Q_LITTLE_ENDIAN ? 3 : 0};
+      case QImage::Format_RGBA8888_Premultiplied:
+        return Layout{Sample::Uint8, 4, 3};
+      case QImage::Format_Grayscale16:
+        return Layout{Sample::Uint16, 1};
+      case QImage::Format_RGBX64:
+      case QImage::Format_RGBA64:
+        return Layout{Sample::Uint16, 4};
+      case QImage::Format_RGBA64_Premultiplied:
+        return Layout{Sample::Uint16, 4, 3};
+      case QImage::Format_RGBX16FPx4:
+      case QImage::Format_RGBA16FPx4:
+        return Layout{Sample::Float16, 4};
+      case QImage::Format_RGBA16FPx4_Premultiplied:
+        return Layout{Sample::Float16, 4, 3};
+      case QImage::Format_RGBX32FPx4:
+      case QImage::Format_RGBA32FPx4:
+        return Layout{Sample::Float32, 4};
+      case QImage::Format_RGBA32FPx4_Premultiplied:
+        return Layout{Sample::Float32, 4, 3};
+      default:
+        return std::nullopt;
+    }
+  }
+
+  double
+  evaluateFilter(ResampleFilter filter, double x)
+  {
+    x = std::abs(x);
+    if (filter == ResampleFilter::Bilinear)
+      return std::max(0.0, 1 - x);
+
+    if (x < 1e-8)
+      return 1;
+    if (x >= 3)
+      return 0;
+    return 3 * std::sin(pi * x) * std::sin(pi * x / 3) / (pi * pi * x * x);
+  }
+
+  // Which source pixels along one axis make up each result pixel, and by how much. Shrinking widens the filter by the
+  // scale so that every source pixel counts.
+  struct Taps
+  {
+    std::vector<int> first; // per result pixel
+    std::vector<int> counts;
+    std::vector<float> weights; // stride per result pixel, summing to 1
+    int stride = 0;
+  };
+
+  Taps
+  makeTaps(int srcSize, int dstSize, ResampleFilter filter)
+  {
+    const double scale = double(dstSize) / srcSize;
+    const double filterScale = std::max(1.0, 1 / scale);
+    const double support = (filter == ResampleFilter::Lanczos3 ? 3.0 : 1.0) * filterScale;
+
+    Taps taps;
+    taps.stride = 2 * int(std::ceil(support)) + 2;
+    taps.first.resize(size_t(dstSize));
+    taps.counts.resize(size_t(dstSize));
+    taps.weights.resize(size_t(dstSize) * taps.stride);
+
+    std::vector<double> weights(size_t(taps.stride));
+    for (int i = 0; i < dstSize; ++i)
+    {
+      const double center = (i + 0.5) / scale;
+      int begin = std::max(0, int(std::floor(center - support)));
+      int end = std::min(srcSize, int(std::ceil(center + support)));
+
+      double sum = 0;
+      for (int j = begin; j < end; ++j)
+        sum += weights[size_t(j - begin)] = evaluateFilter(filter, (j + 0.5 - center) / filterScale);
+
+      // pixels at the very edge of the support weigh nothing
+      int skip = 0;
+      while (begin + skip < end - 1 && weights[size_t(skip)] == 0)
+        ++skip;
+      while (end - 1 > begin + skip && weights[size_t(end - 1 - begin)] == 0)
+        --end;
+
+      float *dst = &taps.weights[size_t(i) * taps.stride];
+      for (int j = begin + skip; j < end; ++j)
+        dst[j - begin - skip] = float(sum != 0 ? weights[size_t(j - begin)] / sum : 1);
+      taps.first[size_t(i)] = begin + skip;
+      taps.counts[size_t(i)] = end - begin - skip;
+    }
+    return taps;
+  }
+
+  // acc[i] += weight * src[i] for a row of count samples
+  template<typename T>
+  void
+  accumulate(float *acc, const T *src, int count, float weight)
+  {
+    int i = 0;
+#ifdef RESAMPLE_SSE2
+    const __m128 w = _mm_set1_ps(weight);
+    const __m128i zero = _mm_setzero_si128();
+    const auto add = [&](int at, __m128 samples){ _mm_storeu_ps(acc + at, _mm_add_ps(_mm_loadu_ps(acc + at), _mm_mul_ps(samples, w))); };
+
+    if constexpr (std::is_same_v<T, uchar>)
+      for (; i + 16 <= count; i += 16)
+      {
+        const __m128i bytes = _mm_loadu_si128((const __m128i*)(src + i));
+        const __m128i low = _mm_unpacklo_epi8(bytes, zero), high = _mm_unpackhi_epi8(bytes, zero);
+        add(i, _mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero)));
+        add(i + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero)));
+        add(i + 8, _mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero)));
+        add(i + 12, _mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero)));
+      }
+    else if constexpr (std::is_same_v<T, quint16>)
+      for (; i + 8 <= count; i += 8)
+      {
+        const __m128i words = _mm_loadu_si128((const __m128i*)(src + i));
+        add(i, _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero)));
+        add(i + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(words, zero)));
+      }
+    else if constexpr (std::is_same_v<T, float>)
+      for (; i + 4 <= count; i += 4)
+        add(i, _mm_loadu_ps(src + i));
+#endif
+    for (; i < count; ++i)
+      acc[i] += weight * float(src[i]);
+  }
+
+  template<typename T>
+  T
+  toSample(float value)
+  {
+    if constexpr (std::is_same_v<T, uchar>)
+      return uchar(std::clamp(value, 0.0f, 255.0f) + 0.5f);
+    else if constexpr (std::is_same_v<T, quint16>)
+      return quint16(std::clamp(value, 0.0f, 65535.0f) + 0.5f);
+    else
+      return T(value);
+  }
+
+  // one result pixel from the channels in values, with colors kept within alpha if there is one
+  template<typename T, int C>
+  void
+  storePixel(T *dst, float *values, int alpha)
+  {
+    if (alpha >= 0)
+      for (int c = 0; c < C; ++c)
+        if (c != alpha)
+          values[c] = std::min(values[c], values[alpha]);
+    for (int c = 0; c < C; ++c)
+      dst[c] = toSample<T>(values[c]);
+  }
+
+  // result rows [yBegin, yEnd) of C channels of T: down the columns of each row's source rows into acc, then across
+  template<typename T, int C>
+  void
+  filterRows(const QImage &image, uchar *resultBits, qsizetype resultBytesPerLine, int resultWidth, const Taps &rows, const Taps &columns, int alpha, int yBegin, int yEnd)
+  {
+    const int count = image.width() * C;
+    std::vector<float> acc(size_t(image.width()) * C);
+
+    for (int y = yBegin; y < yEnd; ++y)
+    {
+      std::fill(acc.begin(), acc.end(), 0.0f);
+      const float *rowWeights = &rows.weights[size_t(y) * rows.stride];
+      for (int k = 0; k < rows.counts[size_t(y)]; ++k)
+        accumulate(acc.data(), (const T*)image.constScanLine(rows.first[size_t(y)] + k), count, rowWeights[k]);
+
+      auto *dst = (T*)(resultBits + y * resultBytesPerLine);
+      for (int x = 0; x < resultWidth; ++x)
+      {
+        const float *weights = &columns.weights[size_t(x) * columns.stride];
+        const float *src = acc.data() + size_t(columns.first[size_t(x)]) * C;
+        const int taps = columns.counts[size_t(x)];
+
+#ifdef RESAMPLE_SSE2
+        if constexpr (C == 4)
+        {
+          __m128 sum = _mm_setzero_ps();
+          for (int k = 0; k < taps; ++k)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(src + k * 4), _mm_set1_ps(weights[k])));
+
+          // saturating packs clamp to [0, 255]
+          if constexpr (std::is_same_v<T, uchar>)
+          {
+            if (alpha >= 0)
+              sum = _mm_min_ps(sum, alpha == 3 ? _mm_shuffle_ps(sum, sum, 0xff) : _mm_shuffle_ps(sum, sum, 0x00));
+            const __m128i words = _mm_packs_epi32(_mm_cvtps_epi32(sum), _mm_setzero_si128());
+            const int bytes = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+            std::memcpy(dst + x * 4, &bytes, 4);
+            continue;
+          }
+
+          float values[4];
+          _mm_storeu_ps(values, sum);
+          storePixel<T, 4>(dst + x * 4, values, alpha);
+          continue;
+        }
+#endif
+        float values[C]{};
+        for (int k = 0; k < taps; ++k)
+          for (int c = 0; c < C; ++c)
+            values[c] += weights[k] * src[k * C + c];
+        storePixel<T, C>(dst + x * C, values, alpha);
+      }
+    }
+  }
+
+  template<typename T>
+  void
+  filterRows(const QImage &image, uchar *resultBits, qsizetype resultBytesPerLine, int resultWidth, const Taps &rows, const Taps &columns, const Layout &layout, int yBegin, int yEnd)
+  {
+    switch (layout.channels)
+    {
+      case 1: return filterRows<T, 1>(image, resultBits, resultBytesPerLine, resultWidth, rows, columns, layout.alpha, yBegin, yEnd);
+      case 3: return filterRows<T, 3>(image, resultBits, resultBytesPerLine, resultWidth, rows, columns, layout.alpha, yBegin, yEnd);
+      default: return filterRows<T, 4>(image, resultBits, resultBytesPerLine, resultWidth, rows, columns, layout.alpha, yBegin, yEnd);
+    }
+  }
+
+  // the source pixel whose center is closest to that of result pixel i
+  int
+  getNearest(int i, int srcSize, int dstSize)
+  {
+    return int(std::min<qint64>(srcSize - 1, (2 * qint64(i) + 1) * srcSize / (2 * qint64(dstSize))));
+  }
+
+  template<int Bytes>
+  void
+  copyNearest(uchar *dst, const uchar *src, const std::vector<int> &offsets, int bytes)
+  {
+    for (size_t x = 0; x < offsets.size(); ++x)
+      std::memcpy(dst + x * size_t(Bytes ? Bytes : bytes), src + offsets[x], size_t(Bytes ? Bytes : bytes));
+  }
+} // namespace
+
+namespace Resample
+{
+  std::optional<QSize>
+  getTargetSize(const CompositionSpec &spec, const std::vector<QSize> &sizes)
+  {
+    if (sizes.empty())
+      return std::nullopt;
+
+    const auto area = [](QSize size){ return qint64(size.width()) * size.height(); };
+    switch (spec.resize)
+    {
+      case ResizeMode::Largest:
+        return *std::max_element(sizes.begin(), sizes.end(), [&](QSize a, QSize b){ return area(a) < area(b); });
+      case ResizeMode::Smallest:
+        return *std::min_element(sizes.begin(), sizes.end(), [&](QSize a, QSize b){ return area(a) < area(b); });
+      case ResizeMode::Explicit:
+        if (spec.size && !spec.size->isEmpty())
+          return *spec.size;
+        break;
+      default:
+        break;
+    }
+
+    if (std::any_of(sizes.begin(), sizes.end(), [&](QSize size){ return size != sizes.front(); }))
+      return std::nullopt;
+    return sizes.front();
+  }
+
+  bool
+  isResizable(QImage::Format format, ResampleFilter filter)
+  {
+    if (filter == ResampleFilter::Nearest)
+      return format != QImage::Format_Invalid && QImage::toPixelFormat(format).bitsPerPixel() % 8 == 0;
+    return getLayout(format).has_value();
+  }
+
+  QImage
+  resize(const QImage &image, QSize size, ResampleFilter filter, TilePool &pool, Progress *progress)
+  {
+    if (image.size() == size)
+      return image;
+
+    const QImage source = isResizable(image.format(), filter) ? image : ComposeKernel::toKernelFormat(image);
+    QImage result = allocateImage(size, source.format());
+    if (result.isNull() || source.isNull())
+      return {};
+    result.setColorTable(source.colorTable());
+
+    // bits() detaches, so fetch it once here rather than from the worker threads
+    uchar *resultBits = result.bits();
+    const qsizetype resultBytesPerLine = result.bytesPerLine();
+    const int height = size.height();
+    const int bandRows = int(std::clamp<qsizetype>(bandBytes / resultBytesPerLine, 1, height));
+
+    std::function<void(int yBegin, int yEnd)> filterBand;
+    std::vector<int> offsets;
+    Taps rows, columns;
+    if (filter == ResampleFilter::Nearest)
+    {
+      const int bytes = source.depth() / 8;
+      for (int x = 0; x < size.width(); ++x)
+        offsets.push_back(getNearest(x, source.width(), size.width()) * bytes);
+
+      filterBand = [&, bytes](int yBegin, int yEnd){
+        for (int y = yBegin; y < yEnd; ++y)
+        {
+          uchar *dst = resultBits + y * resultBytesPerLine;
+          const uchar *src = source.constScanLine(getNearest(y, source.height(), height));
+          switch (bytes)
+          {
+            case 1: copyNearest<1>(dst, src, offsets, bytes); break;
+            case 4: copyNearest<4>(dst, src, offsets, bytes); break;
+            case 8: copyNearest<8>(dst, src, offsets, bytes); break;
+            default: copyNearest<0>(dst, src, offsets, bytes); break;
+          }
+        }
+      };
+    }
+    else
+    {
+      rows = makeTaps(source.height(), height, filter);
+      columns = makeTaps(source.width(), size.width(), filter);
+      const Layout layout = *getLayout(source.format());
+
+      filterBand = [&, layout](int yBegin, int yEnd){
+        switch (layout.sample)
+        {
+          case Sample::Uint8: return filterRows<uchar>(source, resultBits, resultBytesPerLine, size.width(), rows, columns, layout, yBegin, yEnd);
+          case Sample::Uint16: return filterRows<quint16>(source, resultBits, resultBytesPerLine, size.width(), rows, columns, layout, yBegin, yEnd);
+          case Sample::Float16: return filterRows<qfloat16>(source, resultBits, resultBytesPerLine, size.width(), rows, columns, layout, yBegin, yEnd);
+          case Sample::Float32: return filterRows<float>(source, resultBits, resultBytesPerLine, size.width(), rows, columns, layout, yBegin, yEnd);
+        }
+      };
+    }
+
+    pool.run((height + bandRows - 1) / bandRows, [&](int band){
+      if (progress && progress->isCancelled())
+        return;
+      const int yBegin = band * bandRows;
+      const int yEnd = std::min(height, yBegin + bandRows);
+      filterBand(yBegin, yEnd);
+      if (progress)
+        progress->advance(yEnd - yBegin);
+    });
+
+    if (progress && progress->isCancelled())
+      return {};
+    return result;
+  }
+}
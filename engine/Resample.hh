@@ -0,0 +1,36 @@
+#pragma once
+
+#include "CompositionSpec.hh"
+
+#include <QImage>
+
+#include <optional>
+#include <vector>
+
+class Progress;
+class TilePool;
+
+// Resampling of input images to the size a spec's ResizeMode picks, so that inputs of different sizes can be composed
+// without scaling them in another tool first. Channels are filtered on their own, without premultiplying or
+// linearizing, like MipChain does: channel-packed textures hold data rather than colors. Premultiplied formats are
+// filtered as stored, with colors then kept within alpha.
+namespace Resample
+{
+  // The size inputs of sizes are composed at under spec.resize: the one size they all have without resizing, else
+  // the largest or smallest of them by area (the first of equals) or spec.size. Empty if there are no sizes, and if
+  // they differ without a mode to pick one.
+  std::optional<QSize>
+  getTargetSize(const CompositionSpec &spec, const std::vector<QSize> &sizes);
+
+  // Whether resize() filters images of format as they are; nearest takes any format of whole bytes per pixel, the
+  // other filters 8-bit, 16-bit and float formats of 1, 3 or 4 channels.
+  bool
+  isResizable(QImage::Format format, ResampleFilter filter);
+
+  // image resampled to size, in the same format (or ComposeKernel::toKernelFormat() of it if it isn't resizable), in
+  // one pass from image to the result: each output row is filtered down from its source rows into a row buffer, then
+  // across into the result. Rows are spread over the pool and counted into progress, if given. Null if the result
+  // couldn't be allocated or progress was cancelled.
+  QImage
+  resize(const QImage &image, QSize size, ResampleFilter filter, TilePool &pool, Progress *progress = nullptr);
+}
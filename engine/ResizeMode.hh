@@ -0,0 +1,9 @@
+#pragma once
+
+// What size inputs of different sizes are resampled to before composing: none leaves them as they are, which makes
+// differing sizes an error; the others take the size of the largest or smallest input (by area) or the spec's size.
+enum class ResizeMode { None, Largest, Smallest, Explicit, NUM };
+
+// The filter inputs are resampled with: nearest copies the closest pixel, bilinear interpolates (a box-like average
+// when shrinking) and Lanczos3 is the sharpest, with some ringing at hard edges.
+enum class ResampleFilter { Nearest, Bilinear, Lanczos3, NUM };
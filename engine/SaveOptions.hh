@@ -0,0 +1,18 @@
+#pragma once
+
+#include "BlockFormat.hh"
+
+// zlib's compression strategies, for PNG
+enum class PngStrategy { Default, Filtered, Rle, HuffmanOnly, NUM };
+
+// How saveImage() and saveResult() encode their output.
+struct SaveOptions
+{
+  int pngLevel = 6; // zlib's, from 0 (stored) to 9 (smallest)
+  PngStrategy pngStrategy = PngStrategy::Default;
+  bool parallelPng = true; // deflate chunks of rows on the pool with encodePng() rather than through QImageWriter
+  int quality = -1; // QImageWriter::setQuality() for lossy formats such as JPEG and WebP; -1 leaves the writer's default
+
+  BlockFormat ddsFormat = BlockFormat::Bc7;
+  BlockQuality ddsQuality = BlockQuality::Normal;
+};
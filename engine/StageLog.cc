@@ -0,0 +1,190 @@
+#include "StageLog.hh"
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QStringList>
+
+#include <algorithm>
+#include <utility>
+
+namespace
+{
+  thread_local StageLog *currentLog = nullptr;
+
+  // keeps lines appended from different threads whole
+  std::mutex appendMutex;
+
+  QString
+  formatBytes(qint64 bytes)
+  {
+    return QString("%1 MiB").arg(double(bytes) / (1024 * 1024), 0, 'f', 1);
+  }
+} // namespace
+
+StageLog::Timer::Timer(StageLog *log, QString name, QString detail)
+  : log{log}
+  , stage{std::move(name), std::move(detail)}
+{
+}
+
+StageLog::Timer::~Timer()
+{
+  if (!log)
+    return;
+  stage.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  log->add(std::move(stage));
+}
+
+StageLog::Scope::Scope(StageLog *log)
+  : previous{std::exchange(currentLog, log)}
+{
+}
+
+StageLog::Scope::~Scope()
+{
+  currentLog = previous;
+}
+
+StageLog *
+StageLog::current()
+{
+  return currentLog;
+}
+
+void
+StageLog::add(Stage stage)
+{
+  std::lock_guard lock(mutex);
+  stages.push_back(std::move(stage));
+}
+
+void
+StageLog::addImageBytes(qint64 bytes)
+{
+  std::lock_guard lock(mutex);
+  imageBytes += bytes;
+  peakImageBytes = std::max(peakImageBytes, imageBytes);
+}
+
+void
+StageLog::addImageBuffer(bool reused)
+{
+  std::lock_guard lock(mutex);
+  ++(reused ? reusedBuffers : allocatedBuffers);
+}
+
+std::vector<StageLog::Stage>
+StageLog::getStages() const
+{
+  std::lock_guard lock(mutex);
+  return stages;
+}
+
+bool
+StageLog::hasStage(const QString &name, const QString &detail) const
+{
+  std::lock_guard lock(mutex);
+  return std::any_of(stages.begin(), stages.end(), [&](const Stage &stage){ return stage.name == name && stage.detail == detail; });
+}
+
+qint64
+StageLog::getPeakImageBytes() const
+{
+  std::lock_guard lock(mutex);
+  return peakImageBytes;
+}
+
+QString
+StageLog::toSummary() const
+{
+  struct Total
+  {
+    QString name;
+    double ms = 0;
+    qint64 bytes = 0;
+  };
+
+  std::vector<Total> totals; // in order of first appearance
+  qint64 peak = 0;
+  QString buffers;
+  {
+    std::lock_guard lock(mutex);
+    for (const Stage &stage : stages)
+    {
+      auto it = std::find_if(totals.begin(), totals.end(), [&](const Total &total){ return total.name == stage.name; });
+      if (it == totals.end())
+        it = totals.insert(totals.end(), {stage.name});
+      it->ms += stage.ms;
+      it->bytes += stage.bytes;
+    }
+    peak = peakImageBytes;
+    buffers = formatBuffers();
+  }
+
+  QStringList parts;
+  for (const Total &total : totals)
+    parts.append(QString("%1 %2 ms").arg(total.name).arg(total.ms, 0, 'f', 0) + (total.bytes ? " (" + formatBytes(total.bytes) + ")" : QString()));
+  parts.append("peak image memory " + formatBytes(peak));
+  if (!buffers.isEmpty())
+    parts.append(buffers);
+  return parts.join(", ");
+}
+
+QString
+StageLog::toText() const
+{
+  QStringList lines;
+  for (const Stage &stage : getStages())
+    lines.append(QString("%1 %2 ms").arg(stage.name).arg(stage.ms, 0, 'f', 1)
+                 + (stage.bytes ? ", " + formatBytes(stage.bytes) : QString())
+                 + (stage.detail.isEmpty() ? QString() : ": " + stage.detail));
+  lines.append("peak image memory " + formatBytes(getPeakImageBytes()));
+  {
+    std::lock_guard lock(mutex);
+    if (const QString buffers = formatBuffers(); !buffers.isEmpty())
+      lines.append(buffers);
+  }
+  return lines.join("\n");
+}
+
+QJsonObject
+StageLog::toJson() const
+{
+  QJsonArray stageArray;
+  for (const Stage &stage : getStages())
+  {
+    QJsonObject object{{"name", stage.name}, {"ms", stage.ms}, {"bytes", stage.bytes}};
+    if (!stage.detail.isEmpty())
+      object.insert("detail", stage.detail);
+    stageArray.append(object);
+  }
+  std::lock_guard lock(mutex);
+  return {{"stages", stageArray}, {"peakImageBytes", peakImageBytes}, {"allocatedBuffers", allocatedBuffers}, {"reusedBuffers", reusedBuffers}};
+}
+
+bool
+StageLog::appendToFile(const QString &filename, const QJsonObject &extra, QString &error) const
+{
+  QJsonObject object = toJson();
+  for (auto it = extra.begin(); it != extra.end(); ++it)
+    object.insert(it.key(), it.value());
+  const QByteArray line = QJsonDocument(object).toJson(QJsonDocument::Compact) + '\n';
+
+  std::lock_guard lock(appendMutex);
+  QFile file(filename);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Append) || file.write(line) != line.size())
+  {
+    error = file.errorString();
+    return false;
+  }
+  return true;
+}
+
+QString
+StageLog::formatBuffers() const
+{
+  if (!allocatedBuffers && !reusedBuffers)
+    return {};
+  return QString("image buffers %1 new, %2 reused").arg(allocatedBuffers).arg(reusedBuffers);
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <QJsonObject>
+#include <QString>
+
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+// Wall time and bytes of each stage of producing one composite image (per-file decode, format conversion,
+// compose, encode, file write) plus the peak memory held in images and how many image buffers were newly allocated
+// or reused (see BufferPool), so that a slow save can be put down to I/O, a codec, the kernels or the allocator.
+// Stages may be added from any thread.
+class StageLog
+{
+public:
+  struct Stage
+  {
+    QString name;
+    QString detail; // e.g. the file, or empty
+    double ms = 0;
+    qint64 bytes = 0;
+  };
+
+  // Adds a stage timed from construction to destruction, unless log is null.
+  class Timer
+  {
+  public:
+    Timer(StageLog *log, QString name, QString detail = {});
+    ~Timer();
+
+    Timer(const Timer&) = delete;
+    Timer &operator=(const Timer&) = delete;
+
+    void
+    setBytes(qint64 bytes) { stage.bytes = bytes; }
+
+  private:
+    StageLog *const log;
+    Stage stage;
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  };
+
+  // Makes log the one current() returns on this thread until the scope ends; lets code that can't be handed
+  // a log, such as an ImageCache::Loader, still report to it.
+  class Scope
+  {
+  public:
+    explicit Scope(StageLog *log);
+    ~Scope();
+
+    Scope(const Scope&) = delete;
+    Scope &operator=(const Scope&) = delete;
+
+  private:
+    StageLog *const previous;
+  };
+
+  static StageLog *
+  current();
+
+  void
+  add(Stage stage);
+
+  // image memory taken (positive) or given back (negative); the largest total is kept as the peak
+  void
+  addImageBytes(qint64 bytes);
+
+  // an image given a buffer of a BufferPool: one it newly allocated, or one an earlier image had
+  void
+  addImageBuffer(bool reused);
+
+  std::vector<Stage>
+  getStages() const;
+
+  bool
+  hasStage(const QString &name, const QString &detail) const;
+
+  qint64
+  getPeakImageBytes() const;
+
+  // a single line with the total time and bytes of each kind of stage, e.g. for a status bar
+  QString
+  toSummary() const;
+
+  // every stage on its own line
+  QString
+  toText() const;
+
+  QJsonObject
+  toJson() const;
+
+  // Appends toJson() merged with extra as one line to filename (JSON Lines). May be called from several threads.
+  bool
+  appendToFile(const QString &filename, const QJsonObject &extra, QString &error) const;
+
+private:
+  mutable std::mutex mutex;
+  std::vector<Stage> stages; // in the order they finished
+  qint64 imageBytes = 0;
+  qint64 peakImageBytes = 0;
+  qint64 allocatedBuffers = 0;
+  qint64 reusedBuffers = 0;
+
+  // "image buffers 2 new, 3 reused", or empty if no image came from a BufferPool; called under the lock
+  QString
+  formatBuffers() const;
+};
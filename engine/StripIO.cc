@@ -0,0 +1,246 @@
+#include "StripIO.hh"
+
+#include "PngStrips.hh"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QRgb>
+#include <QSaveFile>
+
+#include <cctype>
+#include <vector>
+
+namespace
+{
+  // Binary PGM (P5) and PPM (P6) with a maximum value of 255, which Qt reads as Format_Grayscale8 and
+  // Format_RGB32; other maximum values make it rescale, so those are left to it.
+  class NetpbmStripReader : public StripReader
+  {
+  public:
+    explicit NetpbmStripReader(std::unique_ptr<QFile> file) : file{std::move(file)} {}
+
+    bool
+    open(QString &error)
+    {
+      char magic[2];
+      if (file->read(magic, 2) != 2 || magic[0] != 'P' || (magic[1] != '5' && magic[1] != '6'))
+        return fail(error, "Only binary PGM and PPM files can be read in strips");
+      channels = magic[1] == '5' ? 1 : 3;
+
+      int width = 0, height = 0, maxValue = 0;
+      if (!readNumber(width) || !readNumber(height) || !readNumber(maxValue) || width <= 0 || height <= 0)
+        return fail(error, "The file has a malformed PGM/PPM header");
+      if (maxValue != 255)
+        return fail(error, "Only PGM and PPM files with a maximum value of 255 can be read in strips");
+
+      // exactly one whitespace character separates the header from the pixels
+      char separator;
+      if (!file->getChar(&separator) || !std::isspace(uchar(separator)))
+        return fail(error, "The file has a malformed PGM/PPM header");
+
+      size = QSize(width, height);
+      row.resize(size_t(width) * channels);
+      return true;
+    }
+
+    QSize
+    getSize() const override
+    {
+      return size;
+    }
+
+    bool
+    readRows(uchar *dst, qsizetype dstBytesPerLine, int rowCount, QString &error) override
+    {
+      for (int y = 0; y < rowCount; ++y)
+      {
+        if (file->read((char*)row.data(), qint64(row.size())) != qint64(row.size()))
+          return fail(error, "The file ends early");
+
+        auto *pixels = (QRgb*)(dst + y * dstBytesPerLine);
+        const uchar *src = row.data();
+        if (channels == 1)
+          for (int x = 0; x < size.width(); ++x)
+            pixels[x] = qRgb(src[x], src[x], src[x]);
+        else
+          for (int x = 0; x < size.width(); ++x)
+            pixels[x] = qRgb(src[x * 3], src[x * 3 + 1], src[x * 3 + 2]);
+      }
+      return true;
+    }
+
+  private:
+    std::unique_ptr<QFile> file;
+    QSize size;
+    int channels = 0;
+    std::vector<uchar> row;
+
+    static bool
+    fail(QString &error, const char *message)
+    {
+      error = message;
+      return false;
+    }
+
+    // a decimal number after whitespace and # comments
+    bool
+    readNumber(int &value)
+    {
+      char c;
+      for (;;)
+      {
+        if (!file->getChar(&c))
+          return false;
+        if (c == '#')
+        {
+          while (c != '\n' && c != '\r')
+            if (!file->getChar(&c))
+              return false;
+        }
+        else if (!std::isspace(uchar(c)))
+          break;
+      }
+
+      if (!std::isdigit(uchar(c)))
+        return false;
+
+      qint64 number = 0;
+      while (std::isdigit(uchar(c)))
+      {
+        number = number * 10 + (c - '0');
+        if (number > 0x7fffffff)
+          return false;
+        if (!file->peek(&c, 1))
+          break;
+        if (std::isdigit(uchar(c)))
+          file->getChar(&c);
+      }
+      value = int(number);
+      return true;
+    }
+  };
+
+  // Binary PPM: RGB, dropping alpha as QImageWriter does for Format_ARGB32 images.
+  class PpmStripWriter : public StripWriter
+  {
+  public:
+    PpmStripWriter(const QString &filename, QSize size) : file{filename}, size{size} {}
+
+    bool
+    open(QString &error)
+    {
+      const QByteArray header = "P6\n" + QByteArray::number(size.width()) + ' ' + QByteArray::number(size.height()) + "\n255\n";
+      if (!file.open(QIODevice::WriteOnly) || file.write(header) != header.size())
+      {
+        error = file.errorString();
+        return false;
+      }
+      row.resize(size_t(size.width()) * 3);
+      return true;
+    }
+
+    bool
+    writeRows(const uchar *src, qsizetype srcBytesPerLine, int rowCount, QString &error) override
+    {
+      for (int y = 0; y < rowCount; ++y)
+      {
+        const auto *pixels = (const QRgb*)(src + y * srcBytesPerLine);
+        for (int x = 0; x < size.width(); ++x)
+        {
+          row[x * 3] = uchar(qRed(pixels[x]));
+          row[x * 3 + 1] = uchar(qGreen(pixels[x]));
+          row[x * 3 + 2] = uchar(qBlue(pixels[x]));
+        }
+        if (file.write((const char*)row.data(), qint64(row.size())) != qint64(row.size()))
+        {
+          error = file.errorString();
+          return false;
+        }
+        ++rowsWritten;
+      }
+      return true;
+    }
+
+    bool
+    finish(QString &error) override
+    {
+      if (rowsWritten != size.height())
+      {
+        error = "Not every row of the PPM file was written";
+        return false;
+      }
+      if (!file.commit())
+      {
+        error = file.errorString();
+        return false;
+      }
+      return true;
+    }
+
+  private:
+    QSaveFile file;
+    const QSize size;
+    std::vector<uchar> row;
+    int rowsWritten = 0;
+  };
+
+  QString
+  getSuffix(const QString &filename)
+  {
+    return QFileInfo(filename).suffix().toLower();
+  }
+} // namespace
+
+std::unique_ptr<StripReader>
+openStripReader(const QString &filename, QString &error)
+{
+  auto file = std::make_unique<QFile>(filename);
+  if (!file->open(QIODevice::ReadOnly))
+  {
+    error = file->errorString();
+    return nullptr;
+  }
+
+  // by content, like QImageReader does when the suffix doesn't fit
+  const QByteArray magic = file->peek(8);
+  if (magic.startsWith("\x89PNG"))
+    return openPngStripReader(std::move(file), error);
+
+  if (magic.startsWith("P5") || magic.startsWith("P6"))
+  {
+    auto reader = std::make_unique<NetpbmStripReader>(std::move(file));
+    if (!reader->open(error))
+      return nullptr;
+    return reader;
+  }
+
+  error = "Only PNG and binary PGM/PPM files can be read in strips";
+  return nullptr;
+}
+
+bool
+canWriteStrips(const QString &filename)
+{
+  const QString suffix = getSuffix(filename);
+  return suffix == "png" || suffix == "ppm";
+}
+
+std::unique_ptr<StripWriter>
+openStripWriter(const QString &filename, QSize size, const SaveOptions &options, QString &error)
+{
+  const QString suffix = getSuffix(filename);
+
+  if (suffix == "png")
+    return openPngStripWriter(filename, size, options, error);
+
+  if (suffix == "ppm")
+  {
+    auto writer = std::make_unique<PpmStripWriter>(filename, size);
+    if (!writer->open(error))
+      return nullptr;
+    return writer;
+  }
+
+  error = "Only PNG and PPM files can be written in strips";
+  return nullptr;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "SaveOptions.hh"
+
+#include <QSize>
+#include <QString>
+#include <QtGlobal>
+
+#include <memory>
+
+// Reading and writing images a strip of rows at a time, for images too big to hold whole. Rows are Format_ARGB32
+// with exactly the values QImage::pixel() would give for the image read by QImageReader, so composing strips gives
+// the same pixels as composing whole images.
+//
+// Streamed formats:
+// - PNG: every bit depth and color type, not interlaced; tRNS only with palettes
+// - PGM/PPM: binary (P5/P6) with a maximum value of 255
+// Anything else makes openStripReader() / openStripWriter() return null, and callers fall back to whole images.
+
+class StripReader
+{
+public:
+  virtual ~StripReader() = default;
+
+  virtual QSize
+  getSize() const = 0;
+
+  // Reads the next rowCount rows into dst; returns false and sets error on failure.
+  virtual bool
+  readRows(uchar *dst, qsizetype dstBytesPerLine, int rowCount, QString &error) = 0;
+};
+
+class StripWriter
+{
+public:
+  virtual ~StripWriter() = default;
+
+  // Encodes and writes the next rowCount rows from src; returns false and sets error on failure.
+  virtual bool
+  writeRows(const uchar *src, qsizetype srcBytesPerLine, int rowCount, QString &error) = 0;
+
+  // After the last row: completes the file and puts it in place. Until then (or if this fails) any previous
+  // file of the same name is left alone.
+  virtual bool
+  finish(QString &error) = 0;
+};
+
+// Null, with error set, if filename can't be opened or isn't a streamed format.
+std::unique_ptr<StripReader>
+openStripReader(const QString &filename, QString &error);
+
+// Whether filename's suffix names a format openStripWriter() can write.
+bool
+canWriteStrips(const QString &filename);
+
+// Null, with error set, if filename can't be opened or its suffix isn't a streamed format. PNGs are deflated with
+// options' level and strategy, in one stream.
+std::unique_ptr<StripWriter>
+openStripWriter(const QString &filename, QSize size, const SaveOptions &options, QString &error);
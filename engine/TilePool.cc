@@ -0,0 +1,202 @@
+#include "TilePool.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <utility>
+
+namespace
+{
+  // [begin, end) of a participant's remaining tiles, packed so both ends change in one compare-exchange
+  struct alignas(64) Range
+  {
+    std::atomic<std::uint64_t> packed{0};
+  };
+
+  // the pool whose tiles the current thread is running, so that nested run() calls don't wait on themselves
+  thread_local const TilePool *currentPool = nullptr;
+
+  struct CurrentPool
+  {
+    const TilePool *previous;
+    explicit CurrentPool(const TilePool *pool) : previous{std::exchange(currentPool, pool)} {}
+    ~CurrentPool() { currentPool = previous; }
+  };
+
+  constexpr std::uint64_t
+  pack(std::uint32_t begin, std::uint32_t end)
+  {
+    return (std::uint64_t(begin) << 32) | end;
+  }
+
+  constexpr std::uint32_t begin(std::uint64_t packed) { return std::uint32_t(packed >> 32); }
+  constexpr std::uint32_t end(std::uint64_t packed) { return std::uint32_t(packed); }
+
+  // the owner takes tiles from the front of its range...
+  std::optional<int>
+  popFront(Range &range)
+  {
+    std::uint64_t v = range.packed.load(std::memory_order_relaxed);
+    while (begin(v) < end(v))
+      if (range.packed.compare_exchange_weak(v, pack(begin(v) + 1, end(v)), std::memory_order_acq_rel))
+        return int(begin(v));
+    return std::nullopt;
+  }
+
+  // ...while thieves take the back half, so the two rarely contend
+  bool
+  stealInto(Range &victim, Range &thief)
+  {
+    std::uint64_t v = victim.packed.load(std::memory_order_relaxed);
+    while (begin(v) < end(v))
+    {
+      const std::uint32_t take = (end(v) - begin(v) + 1) / 2;
+      if (victim.packed.compare_exchange_weak(v, pack(begin(v), end(v) - take), std::memory_order_acq_rel))
+      {
+        // the thief's own range is empty here, so nobody else can be changing it
+        thief.packed.store(pack(end(v) - take, end(v)), std::memory_order_release);
+        return true;
+      }
+    }
+    return false;
+  }
+} // namespace
+
+struct TilePool::Job
+{
+  const std::function<void(int tile)> &fn;
+  const int participants;
+  std::unique_ptr<Range[]> ranges;
+
+  Job(int tileCount, const std::function<void(int tile)> &fn, int participants)
+    : fn{fn}
+    , participants{participants}
+    , ranges{new Range[participants]}
+  {
+    for (int p = 0; p < participants; ++p)
+      ranges[p].packed.store(pack(std::uint32_t(std::int64_t(tileCount) * p / participants), std::uint32_t(std::int64_t(tileCount) * (p + 1) / participants)));
+  }
+
+  void
+  participate(int self)
+  {
+    for (;;)
+    {
+      while (std::optional<int> tile = popFront(ranges[self]))
+        fn(*tile);
+
+      bool stole = false;
+      for (int i = 1; i < participants && !stole; ++i)
+        stole = stealInto(ranges[(self + i) % participants], ranges[self]);
+
+      // nothing left anywhere; tiles that were stolen but not finished yet belong to their thief
+      if (!stole)
+        return;
+    }
+  }
+};
+
+TilePool::TilePool(int threadCount)
+  : threadCount{resolveThreadCount(threadCount)}
+{
+  // the thread calling run() is participant 0
+  for (int participant = 1; participant < this->threadCount; ++participant)
+    workers.emplace_back([this, participant]{ workerLoop(participant); });
+}
+
+TilePool::~TilePool()
+{
+  {
+    std::lock_guard lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+
+  for (std::thread &worker : workers)
+    worker.join();
+}
+
+void
+TilePool::run(int tileCount, const std::function<void(int tile)> &fn)
+{
+  if (tileCount <= 0)
+    return;
+
+  // called from inside one of this pool's tiles: every thread is already busy, so just run them here
+  if (currentPool == this)
+  {
+    for (int tile = 0; tile < tileCount; ++tile)
+      fn(tile);
+    return;
+  }
+
+  // a lone tile leaves the workers free, so runs from inside it still get the whole pool
+  if (tileCount == 1)
+  {
+    fn(0);
+    return;
+  }
+
+  std::lock_guard runLock(runMutex);
+  CurrentPool current(this);
+
+  if (workers.empty())
+  {
+    for (int tile = 0; tile < tileCount; ++tile)
+      fn(tile);
+    return;
+  }
+
+  auto newJob = std::make_shared<Job>(tileCount, fn, threadCount);
+  {
+    std::lock_guard lock(mutex);
+    job = newJob;
+    busyWorkers = int(workers.size());
+    ++generation;
+  }
+  wake.notify_all();
+
+  newJob->participate(0);
+
+  std::unique_lock lock(mutex);
+  done.wait(lock, [&]{ return busyWorkers == 0; });
+  job.reset();
+}
+
+int
+TilePool::resolveThreadCount(int requested)
+{
+  if (requested > 0)
+    return requested;
+
+  return std::max(1, int(std::thread::hardware_concurrency()));
+}
+
+void
+TilePool::workerLoop(int participant)
+{
+  unsigned seenGeneration = 0;
+
+  for (;;)
+  {
+    std::shared_ptr<Job> current;
+    {
+      std::unique_lock lock(mutex);
+      wake.wait(lock, [&]{ return stopping || generation != seenGeneration; });
+      if (stopping)
+        return;
+      seenGeneration = generation;
+      current = job;
+    }
+
+    {
+      CurrentPool currentPool(this);
+      current->participate(participant);
+    }
+
+    std::lock_guard lock(mutex);
+    if (--busyWorkers == 0)
+      done.notify_all();
+  }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads that run numbered tiles of one job at a time.
+// Each participant starts with an even share of the tiles and, once it runs out, steals half of what
+// remains of another participant's share, so uneven tiles don't leave threads idle.
+class TilePool
+{
+public:
+  // 0 means one thread per hardware thread
+  explicit TilePool(int threadCount = 0);
+  ~TilePool();
+
+  TilePool(const TilePool &) = delete;
+  TilePool &operator=(const TilePool &) = delete;
+
+  int
+  getThreadCount() const { return threadCount; }
+
+  // Calls fn(tile) once for every tile in [0, tileCount), using the workers and the calling thread, and returns
+  // when all tiles are done. fn must not throw. Calls from different threads are run one after another;
+  // calls made from inside a tile of the same pool run their tiles serially on that thread, unless that tile is the
+  // only one of its run, which is just called on the calling thread without taking the pool.
+  void
+  run(int tileCount, const std::function<void(int tile)> &fn);
+
+  static int
+  resolveThreadCount(int requested);
+
+private:
+  struct Job;
+
+  int threadCount;
+  std::vector<std::thread> workers;
+
+  std::mutex runMutex; // one job at a time
+  std::mutex mutex;
+  std::condition_variable wake, done;
+  std::shared_ptr<Job> job;
+  unsigned generation = 0;
+  int busyWorkers = 0;
+  bool stopping = false;
+
+  void
+  workerLoop(int participant);
+};
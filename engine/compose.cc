@@ -0,0 +1,847 @@
+#include "compose.hh"
+
+#include "BufferPool.hh"
+#include "ComposeKernel.hh"
+#include "ComposeWide.hh"
+#include "DdsFile.hh"
+#include "ImageCache.hh"
+#include "MappedImage.hh"
+#include "MipChain.hh"
+#include "PngEncoder.hh"
+#include "Progress.hh"
+#include "Resample.hh"
+#include "StageLog.hh"
+#include "StripIO.hh"
+#include "TilePool.hh"
+
+#include <QBuffer>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QSaveFile>
+#include <QStringList>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <set>
+#include <utility>
+#include <vector>
+
+namespace
+{
+  ComposeResult
+  makeError(QString title, QString text)
+  {
+    ComposeResult result;
+    result.errorTitle = std::move(title);
+    result.errorText = std::move(text);
+    return result;
+  }
+
+  ComposeResult
+  makeCancelled()
+  {
+    ComposeResult result = makeError("Cancelled", "The save was cancelled.");
+    result.cancelled = true;
+    return result;
+  }
+
+  QString
+  makeSizeMismatchText(const std::vector<std::pair<QString, QSize>> &sizes)
+  {
+    QStringList lines;
+    for (const auto &[filename, size] : sizes)
+      lines.append(QString("%1 x %2: %3").arg(size.width()).arg(size.height()).arg(QDir::toNativeSeparators(filename)));
+    return "The input images must be the same size but are different sizes:\n" + lines.join("\n");
+  }
+
+  // A file whose reads count towards progress and fail once it is cancelled, so that a decoder reading through
+  // it gives up part way.
+  class ProgressFile : public QFile
+  {
+  public:
+    ProgressFile(const QString &name, Progress *progress) : QFile(name), progress{progress} {}
+
+  protected:
+    qint64
+    readData(char *data, qint64 maxSize) override
+    {
+      if (progress && progress->isCancelled())
+        return -1;
+      const qint64 read = QFile::readData(data, maxSize);
+      if (progress && read > 0)
+        progress->advance(read);
+      return read;
+    }
+
+  private:
+    Progress *const progress;
+  };
+
+  // The same for an encoder writing into memory.
+  class ProgressBuffer : public QBuffer
+  {
+  public:
+    explicit ProgressBuffer(Progress *progress) : progress{progress} {}
+
+  protected:
+    qint64
+    writeData(const char *data, qint64 size) override
+    {
+      if (progress && progress->isCancelled())
+        return -1;
+      const qint64 written = QBuffer::writeData(data, size);
+      if (progress && written > 0)
+        progress->advance(written);
+      return written;
+    }
+
+  private:
+    Progress *const progress;
+  };
+
+  void
+  setLanes(const CompositionSpec &spec, std::map<QString, QImage> &images, ComposeKernel::LaneSource (&lanes)[4])
+  {
+    for (int outputChannel : {0, 1, 2, 3})
+    {
+      const ChannelSpec &channel = spec.channels[outputChannel];
+      ComposeKernel::LaneSource &lane = lanes[outputChannel];
+
+      if (channel.source == InputSource::Image)
+      {
+        lane.image = images[channel.filename];
+        lane.inputChannel = channel.inputChannel;
+        lane.invert = channel.invert;
+      }
+      else
+        lane.constant = channel.constant;
+    }
+  }
+
+  std::set<QString>
+  getInputFilenames(const CompositionSpec &spec)
+  {
+    std::set<QString> filenames;
+    for (const ChannelSpec &channel : spec.channels)
+      if (channel.source == InputSource::Image)
+        filenames.insert(channel.filename);
+    return filenames;
+  }
+
+  // the chain below an output of size and format if spec asks for one and there is a level to make; false if it
+  // couldn't be allocated
+  bool
+  makeMipChain(const CompositionSpec &spec, QSize size, QImage::Format format, std::unique_ptr<MipChain> &mips)
+  {
+    if (!spec.mipmaps || size == QSize(1, 1))
+      return true;
+    mips = std::make_unique<MipChain>(size, format);
+    return !mips->isNull();
+  }
+
+  // the composed image and its levels, if any, or why there aren't any
+  ComposeResult
+  makeResult(QImage image, const MipChain *mips, QSize imageSize, StageLog *log, Progress *progress)
+  {
+    const qint64 mipBytes = mips ? mips->getBytes() : 0;
+    if (log)
+      log->addImageBytes(image.sizeInBytes() + mipBytes);
+    if (progress && progress->isCancelled())
+      return makeCancelled();
+    if (image.isNull())
+      return makeError("Out of memory", QString("Couldn't allocate a %1 x %2 output image.").arg(imageSize.width()).arg(imageSize.height()));
+
+    ComposeResult result;
+    result.image = std::move(image);
+    if (mips)
+      result.mipLevels = mips->getLevels();
+    return result;
+  }
+
+  // 16-bit and float composition reads the inputs as they are, so there is nothing to prepare
+  ComposeResult
+  composeWide(const CompositionSpec &spec, QSize imageSize, const ComposeKernel::LaneSource (&lanes)[4], TilePool &pool, StageLog *log, Progress *progress)
+  {
+    std::unique_ptr<MipChain> mips;
+    if (!makeMipChain(spec, imageSize, ComposeWide::getOutputFormat(spec.precision), mips))
+      return makeError("Out of memory", QString("Couldn't allocate the mip levels of a %1 x %2 image.").arg(imageSize.width()).arg(imageSize.height()));
+
+    if (progress)
+      progress->beginStage("Composing", imageSize.height());
+
+    QImage image;
+    {
+      StageLog::Timer timer(log, "compose");
+      image = ComposeWide::composeImage(imageSize, lanes, spec.precision, pool, progress, mips.get());
+      timer.setBytes(image.sizeInBytes() + (mips ? mips->getBytes() : 0));
+    }
+    return makeResult(std::move(image), mips.get(), imageSize, log, progress);
+  }
+
+  // Decodes every distinct input image concurrently (or takes it from the cache), then reports all read errors and
+  // size mismatches at once. Inputs of another size than the one spec.resize picks are resampled straight from what
+  // was decoded. On success, images holds each file converted for ComposeKernel and imageSize is set.
+  std::optional<ComposeResult>
+  loadImages(const CompositionSpec &spec, TilePool &pool, ImageCache &imageCache, StageLog *log, Progress *progress, std::map<QString, QImage> &images, std::optional<QSize> &imageSize)
+  {
+    struct Decoded
+    {
+      QString filename;
+      QImage image;
+      QString error;
+    };
+
+    std::vector<Decoded> decoded;
+    for (const ChannelSpec &channel : spec.channels)
+      if (channel.source == InputSource::Image && !images.count(channel.filename))
+      {
+        images.emplace(channel.filename, QImage());
+        decoded.push_back({channel.filename, {}, {}});
+      }
+
+    if (progress)
+    {
+      qint64 fileBytes = 0;
+      for (const Decoded &d : decoded)
+        fileBytes += QFileInfo(d.filename).size();
+      progress->beginStage("Decoding", fileBytes);
+    }
+
+    // the workers decode into buffers of the pool this thread draws from, if any
+    BufferPool *buffers = BufferPool::current();
+
+    pool.run(int(decoded.size()), [&](int i){
+      Decoded &d = decoded[i];
+      if (progress && progress->isCancelled())
+        return;
+
+      const auto start = std::chrono::steady_clock::now();
+      const auto elapsedMs = [&]{ return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(); };
+
+      // uncompressed files are read in place from the page cache as the kernels touch them, by this composition
+      // alone: what the cache holds outlives it, and must not change or vanish when the file is written again. All
+      // there is to time is the header; the pages aren't counted as image memory since the system can drop them
+      // again, and every mapped format is native
+      if (QImage mapped = mapImageFile(d.filename); !mapped.isNull())
+      {
+        d.image = std::move(mapped);
+        if (log)
+          log->add({"map", d.filename, elapsedMs(), d.image.sizeInBytes()});
+        if (progress)
+          progress->advance(QFileInfo(d.filename).size());
+        return;
+      }
+
+      // a loader running on this thread reports decoding itself; anything else came out of the cache
+      StageLog::Scope logScope(log);
+      Progress::Scope progressScope(progress);
+      BufferPool::Scope bufferScope(buffers);
+      d.image = imageCache.get(d.filename, d.error);
+      if (log && !d.image.isNull() && !log->hasStage("decode", d.filename))
+      {
+        log->add({"cached", d.filename, elapsedMs(), 0});
+        log->addImageBytes(d.image.sizeInBytes());
+        if (progress)
+          progress->advance(QFileInfo(d.filename).size());
+      }
+    });
+
+    if (progress && progress->isCancelled())
+      return makeCancelled();
+
+    QStringList readErrors;
+    std::vector<QSize> sizes;
+
+    for (const Decoded &d : decoded)
+    {
+      if (d.image.isNull())
+        readErrors.append("Couldn't read image from file " + QDir::toNativeSeparators(d.filename) + "\n" + d.error);
+      else
+        sizes.push_back(d.image.size());
+    }
+
+    imageSize = Resample::getTargetSize(spec, sizes);
+    if (!imageSize && !sizes.empty())
+    {
+      std::vector<std::pair<QString, QSize>> namedSizes;
+      for (const Decoded &d : decoded)
+        if (!d.image.isNull())
+          namedSizes.emplace_back(d.filename, d.image.size());
+      readErrors.append(makeSizeMismatchText(namedSizes));
+    }
+
+    if (!readErrors.isEmpty())
+      return makeError("Error reading input images", readErrors.join("\n\n"));
+
+    // the cache keeps the decoded images, so the resampled ones are the only extra memory
+    if (progress)
+    {
+      qint64 rows = 0;
+      for (const Decoded &d : decoded)
+        if (imageSize && d.image.size() != *imageSize)
+          rows += imageSize->height();
+      if (rows)
+        progress->beginStage("Resizing", rows);
+    }
+
+    for (Decoded &d : decoded)
+    {
+      if (imageSize && d.image.size() != *imageSize)
+      {
+        StageLog::Timer timer(log, "resize", d.filename);
+        d.image = Resample::resize(d.image, *imageSize, spec.filter, pool, progress);
+        if (progress && progress->isCancelled())
+          return makeCancelled();
+        if (d.image.isNull())
+          return makeError("Out of memory", QString("Couldn't allocate a %1 x %2 image to resize %3 to.").arg(imageSize->width()).arg(imageSize->height()).arg(QDir::toNativeSeparators(d.filename)));
+        timer.setBytes(d.image.sizeInBytes());
+        if (log)
+          log->addImageBytes(d.image.sizeInBytes());
+      }
+
+      images[d.filename] = d.image;
+    }
+
+    return std::nullopt;
+  }
+
+  // writes data to filename through a QSaveFile, so that failing or being cancelled leaves any previous file alone
+  bool
+  writeFile(const QByteArray &data, const QString &filename, QString &error, StageLog *log, Progress *progress)
+  {
+    if (progress)
+      progress->beginStage("Writing", data.size());
+
+    StageLog::Timer timer(log, "write", filename);
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+      error = file.errorString();
+      return false;
+    }
+
+    // in blocks, so that a cancel doesn't wait for a big file to be written out
+    constexpr qint64 blockBytes = 1 << 20;
+    for (qint64 offset = 0; offset < data.size(); offset += blockBytes)
+    {
+      if (progress && progress->isCancelled())
+      {
+        error = "The save was cancelled.";
+        return false;
+      }
+      const qint64 size = std::min(blockBytes, qint64(data.size()) - offset);
+      if (file.write(data.constData() + offset, size) != size)
+      {
+        error = file.errorString();
+        return false;
+      }
+      if (progress)
+        progress->advance(size);
+    }
+
+    if (!file.commit())
+    {
+      error = file.errorString();
+      return false;
+    }
+    timer.setBytes(data.size());
+    return true;
+  }
+
+  // runs encode as the encoding stage, of stageTotal units, and writes what it returns; encode returns an empty array
+  // if it was cancelled or failed, setting error for the latter
+  bool
+  encodeAndWrite(const std::function<QByteArray(QString &error)> &encode, qint64 stageTotal, const QString &filename, QString &error, StageLog *log, Progress *progress)
+  {
+    if (progress)
+      progress->beginStage("Encoding", stageTotal);
+    QByteArray data;
+    {
+      StageLog::Timer timer(log, "encode", filename);
+      data = encode(error);
+      if (data.isEmpty())
+      {
+        if (progress && progress->isCancelled())
+          error = "The save was cancelled.";
+        return false;
+      }
+      timer.setBytes(data.size());
+    }
+    if (log)
+      log->addImageBytes(data.size());
+
+    return writeFile(data, filename, error, log, progress);
+  }
+} // namespace
+
+ComposeResult
+compose(const CompositionSpec &spec, TilePool &pool, ImageCache &imageCache, StageLog *log, Progress *progress)
+{
+  // RGBA is the customary order and what is presented to the user in the UI, while QImage and QRgb expects ARGB.
+  // Thus the order in the arrays below is RGBA; ComposeKernel takes care of placing each channel in a QRgb.
+
+  std::map<QString, QImage> images;
+  std::optional<QSize> imageSize;
+
+  if (std::optional<ComposeResult> error = loadImages(spec, pool, imageCache, log, progress, images, imageSize))
+    return *error;
+
+  // if any image was loaded then imageSize is set; otherwise the spec must say what size to make the output image
+  if (!imageSize)
+    imageSize = spec.size;
+  if (!imageSize || imageSize->isEmpty())
+    return makeError("No image size", "No input images were selected, so an output image size must be given.");
+
+  ComposeKernel::LaneSource lanes[4]; // RGBA
+  setLanes(spec, images, lanes);
+
+  if (spec.precision != Precision::Uint8)
+    return composeWide(spec, *imageSize, lanes, pool, log, progress);
+
+  // inputs are cached as decoded; what this spec reads of them is reduced to planes or converted here
+  {
+    const auto start = std::chrono::steady_clock::now();
+    qint64 bytes = 0;
+    if (!ComposeKernel::prepareLanes(lanes, pool, &bytes))
+      return makeError("Out of memory", QString("Couldn't allocate %1 x %2 images to compose from.").arg(imageSize->width()).arg(imageSize->height()));
+    if (log && bytes)
+    {
+      log->add({"convert", {}, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(), bytes});
+      log->addImageBytes(bytes);
+    }
+  }
+
+  // compose new image, straight into what the writer takes; kernels are selected once here instead of per pixel
+  const bool opaque = lanes[3].image.isNull() && lanes[3].constant == 255;
+  const ComposeKernel::Plan plan = ComposeKernel::makePlan(*imageSize, lanes, getComposeFormat(spec.saveFormat, opaque));
+
+  std::unique_ptr<MipChain> mips;
+  if (!makeMipChain(spec, *imageSize, plan.format, mips))
+    return makeError("Out of memory", QString("Couldn't allocate the mip levels of a %1 x %2 image.").arg(imageSize->width()).arg(imageSize->height()));
+
+  if (progress)
+    progress->beginStage("Composing", imageSize->height());
+
+  QImage image;
+  {
+    StageLog::Timer timer(log, "compose");
+    image = ComposeKernel::composeImage(plan, pool, progress, mips.get());
+    timer.setBytes(image.sizeInBytes() + (mips ? mips->getBytes() : 0));
+  }
+  return makeResult(std::move(image), mips.get(), *imageSize, log, progress);
+}
+
+ComposeResult
+compose(const CompositionSpec &spec)
+{
+  TilePool pool;
+  ImageCache imageCache(&loadInputImage, std::numeric_limits<qint64>::max());
+  return compose(spec, pool, imageCache);
+}
+
+QByteArray
+getSaveFormat(const QString &filename)
+{
+  return QFileInfo(filename).suffix().toLower().toLatin1();
+}
+
+QImage::Format
+getComposeFormat(const QByteArray &saveFormat, bool opaque)
+{
+  // JPEG has no alpha to keep
+  if (saveFormat == "jpg" || saveFormat == "jpeg")
+    return QImage::Format_RGB888;
+
+  if (saveFormat == "png" || saveFormat == "tif" || saveFormat == "tiff")
+  {
+    if (opaque)
+      return QImage::Format_RGB888;
+    if (ComposeKernel::isOutputFormat(QImage::Format_RGBA8888))
+      return QImage::Format_RGBA8888;
+  }
+
+  return QImage::Format_ARGB32;
+}
+
+qint64
+estimateComposeBytes(const CompositionSpec &spec)
+{
+  qint64 bytes = 0;
+  std::vector<QSize> sizes;
+  for (const QString &filename : getInputFilenames(spec))
+  {
+    const QSize size = QImageReader(filename).size();
+    if (size.isValid())
+    {
+      bytes += qint64(size.width()) * size.height() * 4;
+      sizes.push_back(size);
+    }
+  }
+
+  // inputs of another size are resampled into images of their own
+  QSize outputSize = spec.size.value_or(QSize(0, 0));
+  if (const std::optional<QSize> targetSize = Resample::getTargetSize(spec, sizes))
+  {
+    outputSize = *targetSize;
+    for (QSize size : sizes)
+      if (size != outputSize)
+        bytes += qint64(outputSize.width()) * outputSize.height() * 4;
+  }
+  else if (!sizes.empty())
+    outputSize = sizes.back();
+
+  const int outputBytesPerPixel = QImage::toPixelFormat(ComposeWide::getOutputFormat(spec.precision)).bitsPerPixel() / 8;
+  const qint64 outputBytes = qint64(outputSize.width()) * outputSize.height() * outputBytesPerPixel;
+
+  // the levels below add up to a third of the output
+  return bytes + outputBytes + (spec.mipmaps ? outputBytes / 3 : 0);
+}
+
+bool
+canComposeToFile(const CompositionSpec &spec, const QString &outputFilename)
+{
+  // strips are 8-bit, and each level below takes every strip
+  if (spec.precision != Precision::Uint8 || spec.mipmaps || !canWriteStrips(outputFilename))
+    return false;
+
+  std::vector<QSize> sizes;
+  for (const QString &filename : getInputFilenames(spec))
+  {
+    QString error;
+    const std::unique_ptr<StripReader> reader = openStripReader(filename, error);
+    if (!reader)
+      return false;
+    sizes.push_back(reader->getSize());
+  }
+
+  // strips are composed as they are read, so inputs that would be resampled can't be streamed; without a resize mode,
+  // composeToFile() reports inputs of different sizes itself
+  const std::optional<QSize> targetSize = Resample::getTargetSize(spec, sizes);
+  return spec.resize == ResizeMode::None || std::all_of(sizes.begin(), sizes.end(), [&](QSize size){ return size == targetSize; });
+}
+
+ComposeResult
+composeToFile(const CompositionSpec &spec, const QString &outputFilename, const SaveOptions &options, TilePool &pool, StageLog *log, Progress *progress)
+{
+  // per image; big enough that handing strips to the threads costs next to nothing
+  constexpr qint64 stripBytes = 4 * 1024 * 1024;
+
+  struct Input
+  {
+    QString filename;
+    std::unique_ptr<StripReader> reader;
+    QImage strip;
+    QString error;
+    double decodeMs = 0;
+  };
+
+  std::vector<Input> inputs;
+  for (const QString &filename : getInputFilenames(spec))
+    inputs.emplace_back().filename = filename;
+
+  QStringList readErrors;
+  std::vector<std::pair<QString, QSize>> sizes;
+  std::optional<QSize> imageSize;
+  bool sizesDiffer = false;
+
+  for (Input &input : inputs)
+  {
+    input.reader = openStripReader(input.filename, input.error);
+    if (!input.reader)
+    {
+      readErrors.append("Couldn't read image from file " + QDir::toNativeSeparators(input.filename) + "\n" + input.error);
+      continue;
+    }
+
+    const QSize size = input.reader->getSize();
+    sizes.emplace_back(input.filename, size);
+    if (!imageSize)
+      imageSize = size;
+    else if (*imageSize != size)
+      sizesDiffer = true;
+  }
+
+  if (sizesDiffer)
+    readErrors.append(makeSizeMismatchText(sizes));
+  if (!readErrors.isEmpty())
+    return makeError("Error reading input images", readErrors.join("\n\n"));
+
+  if (!imageSize)
+    imageSize = spec.size;
+  if (!imageSize || imageSize->isEmpty())
+    return makeError("No image size", "No input images were selected, so an output image size must be given.");
+
+  QString error;
+
+  // a PNG of constants alone is written from its one color, without composing a single row
+  if (inputs.empty() && options.parallelPng && getSaveFormat(outputFilename) == "png")
+  {
+    const QRgb pixel = qRgba(spec.channels[0].constant, spec.channels[1].constant, spec.channels[2].constant, spec.channels[3].constant);
+    const auto encode = [&](QString &error){ return encodeSolidPng(*imageSize, pixel, true, options.pngLevel, error); };
+    if (!encodeAndWrite(encode, 0, outputFilename, error, log, progress))
+      return progress && progress->isCancelled() ? makeCancelled() : makeError("Error saving image file", "Couldn't save image to file " + QDir::toNativeSeparators(outputFilename) + "\n\n" + error);
+    return {};
+  }
+
+  std::unique_ptr<StripWriter> writer = openStripWriter(outputFilename, *imageSize, options, error);
+  if (!writer)
+    return makeError("Error saving image file", "Couldn't save image to file " + QDir::toNativeSeparators(outputFilename) + "\n\n" + error);
+
+  const int width = imageSize->width();
+  const int height = imageSize->height();
+  const int stripRows = int(std::clamp<qint64>(stripBytes / (qint64(width) * 4), 1, height));
+
+  QImage output = allocateImage(QSize(width, stripRows), QImage::Format_ARGB32);
+  bool allocated = !output.isNull();
+  for (Input &input : inputs)
+  {
+    input.strip = allocateImage(QSize(width, stripRows), QImage::Format_ARGB32);
+    allocated = allocated && !input.strip.isNull();
+  }
+  if (!allocated)
+    return makeError("Out of memory", QString("Couldn't allocate strips of %1 x %2 pixels.").arg(width).arg(stripRows));
+  if (log)
+    log->addImageBytes(qint64(inputs.size() + 1) * output.sizeInBytes());
+
+  if (progress)
+    progress->beginStage("Composing in strips", height);
+
+  double composeMs = 0;
+  double encodeMs = 0;
+  const auto elapsedMs = [](std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  };
+
+  for (int y = 0; y < height; y += stripRows)
+  {
+    if (progress && progress->isCancelled())
+      return makeCancelled();
+
+    const int rowCount = std::min(stripRows, height - y);
+
+    // the inputs are separate files, so they are decoded side by side
+    pool.run(int(inputs.size()), [&](int i){
+      Input &input = inputs[i];
+      const auto start = std::chrono::steady_clock::now();
+      if (!input.reader->readRows(input.strip.bits(), input.strip.bytesPerLine(), rowCount, input.error))
+        input.reader.reset();
+      input.decodeMs += elapsedMs(start);
+    });
+
+    for (const Input &input : inputs)
+      if (!input.reader)
+        return makeError("Error reading input images", "Couldn't read image from file " + QDir::toNativeSeparators(input.filename) + "\n" + input.error);
+
+    // without inputs every strip is the same, so the first one is written again
+    if (inputs.empty() && y > 0)
+    {
+      if (progress)
+        progress->advance(rowCount);
+    }
+    else
+    {
+      // scoped so that nothing but the inputs holds their strips when the next ones are read into them
+      std::map<QString, QImage> strips;
+      for (const Input &input : inputs)
+        strips[input.filename] = input.strip;
+      ComposeKernel::LaneSource lanes[4]; // RGBA
+      setLanes(spec, strips, lanes);
+
+      const auto start = std::chrono::steady_clock::now();
+      ComposeKernel::composeInto(ComposeKernel::makePlan(QSize(width, rowCount), lanes), output.bits(), output.bytesPerLine(), pool, progress);
+      composeMs += elapsedMs(start);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    if (!writer->writeRows(output.constBits(), output.bytesPerLine(), rowCount, error))
+      return makeError("Error saving image file", "Couldn't save image to file " + QDir::toNativeSeparators(outputFilename) + "\n\n" + error);
+    encodeMs += elapsedMs(start);
+  }
+
+  if (progress && progress->isCancelled())
+    return makeCancelled();
+
+  const auto start = std::chrono::steady_clock::now();
+  if (!writer->finish(error))
+    return makeError("Error saving image file", "Couldn't save image to file " + QDir::toNativeSeparators(outputFilename) + "\n\n" + error);
+  encodeMs += elapsedMs(start);
+
+  if (log)
+  {
+    for (const Input &input : inputs)
+      log->add({"decode", input.filename, input.decodeMs, QFileInfo(input.filename).size()});
+    log->add({"compose", {}, composeMs, qint64(width) * height * 4});
+    log->add({"encode+write", outputFilename, encodeMs, QFileInfo(outputFilename).size()});
+  }
+
+  return {};
+}
+
+QImage
+loadInputImage(const QString &filename, QString &error)
+{
+  StageLog *log = StageLog::current();
+
+  // uncompressed files are copied out of their mapping, which beats decoding them; the cache must hold images of
+  // their own memory, which the file being written again can't change or take away. Every mapped format is native
+  if (const QImage mapped = mapImageFile(filename); !mapped.isNull())
+  {
+    QImage image;
+    {
+      StageLog::Timer timer(log, "decode", filename);
+      image = allocateImage(mapped.size(), mapped.format());
+      if (image.isNull())
+      {
+        error = "out of memory";
+        return {};
+      }
+      const size_t rowBytes = size_t(mapped.width()) * size_t(mapped.depth() / 8);
+      for (int y = 0; y < mapped.height(); ++y)
+        std::memcpy(image.scanLine(y), mapped.constScanLine(y), rowBytes);
+      timer.setBytes(QFileInfo(filename).size());
+    }
+    if (log)
+      log->addImageBytes(image.sizeInBytes());
+    if (Progress *progress = Progress::current())
+      progress->advance(QFileInfo(filename).size());
+    return image;
+  }
+
+  QImage image;
+  {
+    StageLog::Timer timer(log, "decode", filename);
+
+    // reading through ProgressFile lets a cancel stop the decoder part way; a reader on a device can't go by the
+    // file's suffix, so the format is decided the way QImageReader(filename) would
+    ProgressFile file(filename, Progress::current());
+    if (!file.open(QIODevice::ReadOnly))
+    {
+      error = file.errorString();
+      return {};
+    }
+    QImageReader reader(&file, QImageReader::imageFormat(filename));
+
+    // decoders that are handed an image of the size and format they decode to fill it rather than allocating one,
+    // so the pixels go straight into a buffer of BufferPool::current(), if any
+    if (const QSize size = reader.size(); size.isValid() && reader.imageFormat() != QImage::Format_Invalid)
+      image = allocateImage(size, reader.imageFormat());
+    if (!reader.read(&image))
+    {
+      error = reader.errorString();
+      return {};
+    }
+    timer.setBytes(file.size());
+  }
+  if (log)
+    log->addImageBytes(image.sizeInBytes());
+
+  // formats the kernels handle natively are kept as they are, which for grayscale inputs is a quarter of the memory,
+  // as are those with more bits than toKernelFormat() keeps; anything else is converted once here rather than per save
+  if (ComposeKernel::isNativeFormat(image.format()) || ComposeWide::isNativeFormat(image.format()))
+    return image;
+
+  StageLog::Timer timer(log, "convert", filename);
+  QImage converted = ComposeKernel::toKernelFormat(image);
+  if (log && converted.cacheKey() != image.cacheKey())
+  {
+    // both are held until the original goes out of scope
+    timer.setBytes(converted.sizeInBytes());
+    log->addImageBytes(converted.sizeInBytes());
+    log->addImageBytes(-image.sizeInBytes());
+  }
+  return converted;
+}
+
+QString
+getMipFilename(const QString &filename, int level)
+{
+  const QFileInfo info(filename);
+  const QString name = QString("%1_mip%2").arg(info.completeBaseName()).arg(level);
+  return info.dir().filePath(info.suffix().isEmpty() ? name : name + "." + info.suffix());
+}
+
+bool
+saveMipLevels(const std::vector<QImage> &levels, const QString &filename, const SaveOptions &options, TilePool &pool, QString &error, StageLog *log, Progress *progress)
+{
+  for (size_t i = 0; i < levels.size(); ++i)
+  {
+    const QString levelFilename = getMipFilename(filename, int(i) + 1);
+    if (!saveImage(levels[i], levelFilename, options, pool, error, log, progress))
+    {
+      error = QDir::toNativeSeparators(levelFilename) + ": " + error;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool
+saveImage(const QImage &image, const QString &filename, const SaveOptions &options, TilePool &pool, QString &error, StageLog *log, Progress *progress)
+{
+  const QByteArray format = getSaveFormat(filename);
+  if (format == "png" && options.parallelPng && canEncodePng(image.format()))
+    return encodeAndWrite([&](QString &encodeError){
+      return encodePng(image, options.pngLevel, options.pngStrategy, pool, encodeError, progress);
+    }, image.height(), filename, error, log, progress);
+
+  // encode into memory first so that the codec and the file system are timed separately
+  if (progress)
+    progress->beginStage("Encoding", 0);
+  ProgressBuffer buffer(progress);
+  buffer.open(QIODevice::WriteOnly);
+  {
+    StageLog::Timer timer(log, "encode", filename);
+    QImageWriter writer(&buffer, format);
+    // Qt's PNG handler makes quality into the zlib level (100 - quality) * 9 / 91
+    if (format == "png")
+      writer.setQuality(100 - (std::clamp(options.pngLevel, 0, 9) * 91 + 8) / 9);
+    else if (options.quality >= 0)
+      writer.setQuality(options.quality);
+    const bool written = writer.write(image);
+    if (progress && progress->isCancelled())
+    {
+      error = "The save was cancelled.";
+      return false;
+    }
+    if (!written)
+    {
+      error = writer.errorString();
+      return false;
+    }
+    timer.setBytes(buffer.size());
+  }
+  if (log)
+    log->addImageBytes(buffer.size());
+
+  return writeFile(buffer.data(), filename, error, log, progress);
+}
+
+QStringList
+getWrittenFiles(const ComposeResult &result, const QString &filename)
+{
+  QStringList files{filename};
+  if (getSaveFormat(filename) != "dds")
+    for (size_t i = 0; i < result.mipLevels.size(); ++i)
+      files.append(getMipFilename(filename, int(i) + 1));
+  return files;
+}
+
+bool
+saveResult(const ComposeResult &result, const QString &filename, const SaveOptions &options, TilePool &pool, QString &error, StageLog *log, Progress *progress)
+{
+  if (getSaveFormat(filename) != "dds")
+    return saveImage(result.image, filename, options, pool, error, log, progress) && saveMipLevels(result.mipLevels, filename, options, pool, error, log, progress);
+
+  // the mip levels go into the file itself rather than next to it
+  return encodeAndWrite([&](QString &){
+    return encodeDds(result.image, result.mipLevels, options.ddsFormat, options.ddsQuality, pool, progress);
+  }, getDdsBlockRows(result.image, result.mipLevels), filename, error, log, progress);
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "CompositionSpec.hh"
+#include "SaveOptions.hh"
+
+#include <QImage>
+#include <QString>
+#include <QStringList>
+
+#include <vector>
+
+class ImageCache;
+class Progress;
+class StageLog;
+class TilePool;
+
+struct ComposeResult
+{
+  QImage image; // null on error, and from composeToFile()
+  std::vector<QImage> mipLevels; // below image if the spec asks for mipmaps; level 1 (half the size) first
+  QString errorTitle;
+  QString errorText;
+  bool cancelled = false; // through Progress::cancel(); errorTitle is set too
+
+  bool
+  ok() const { return errorTitle.isEmpty(); }
+};
+
+// Decodes the inputs of spec (through imageCache, concurrently on pool; files mapImageFile() takes are mapped for this
+// call alone instead) and composes them into an image of ComposeWide::getOutputFormat(spec.precision), or for 8-bit
+// output of getComposeFormat(), and its mip levels in the same pass if spec asks for them.
+// Nothing is shown to the user; problems are reported in the result. Stages are reported to log and progress if given.
+// The output, its levels and whatever is decoded or resampled for it draw from BufferPool::current(), if any.
+ComposeResult
+compose(const CompositionSpec &spec, TilePool &pool, ImageCache &imageCache, StageLog *log = nullptr, Progress *progress = nullptr);
+
+// One-off version of the above with a pool of one thread per core and no cache kept afterwards.
+ComposeResult
+compose(const CompositionSpec &spec);
+
+// The format QImageWriter and saveImage() encode filename in, by its suffix; "dds" for saveResult()'s own encoder.
+QByteArray
+getSaveFormat(const QString &filename);
+
+// The layout of 8-bit output whose writer for saveFormat encodes it as it is rather than converting it first:
+// Format_RGB888 for JPEG, and for PNG and TIFF if opaque (the alpha is a constant 255), which also keeps a needless
+// alpha channel out of the file; Format_RGBA8888 for PNG and TIFF otherwise where ComposeKernel can write it; and
+// Format_ARGB32 for everything else.
+QImage::Format
+getComposeFormat(const QByteArray &saveFormat, bool opaque);
+
+// Rough upper bound of the image memory compose() holds: the decoded inputs, those resampled from them and the
+// output. Reads only the inputs' headers.
+qint64
+estimateComposeBytes(const CompositionSpec &spec);
+
+// Whether composeToFile() can handle spec and outputFilename, i.e. whether spec is 8-bit without mipmaps, they are all
+// in formats StripIO.hh streams and no input would have to be resampled. Reads the inputs' headers.
+bool
+canComposeToFile(const CompositionSpec &spec, const QString &outputFilename);
+
+// Composes spec straight into outputFilename a strip of rows at a time, so that memory grows with the image width
+// rather than its area; for images too big for compose() and saveImage(), whose pixels it matches. Inputs are read
+// from their files rather than the cache. The output is encoded as options say; a spec of constants alone composes a
+// single strip, and as a PNG that encodePng() would write not even that (see encodeSolidPng()). Stages are reported to
+// log and progress if given.
+ComposeResult
+composeToFile(const CompositionSpec &spec, const QString &outputFilename, const SaveOptions &options, TilePool &pool, StageLog *log = nullptr, Progress *progress = nullptr);
+
+// The ImageCache::Loader for input images: decodes filename (or copies it out of its mapImageFile() mapping) and
+// converts it for ComposeKernel unless ComposeKernel or ComposeWide reads its format natively.
+// Reports decoding and conversion to StageLog::current() and bytes read to Progress::current(), if any, and decodes
+// into a buffer of BufferPool::current(), if any.
+QImage
+loadInputImage(const QString &filename, QString &error);
+
+// Where mip level (1 for half the size) of an output saved as filename goes: name_mip1.png and so on.
+QString
+getMipFilename(const QString &filename, int level);
+
+// saveImage() for every one of levels, level 1 first, into getMipFilename(filename, level).
+bool
+saveMipLevels(const std::vector<QImage> &levels, const QString &filename, const SaveOptions &options, TilePool &pool, QString &error, StageLog *log = nullptr, Progress *progress = nullptr);
+
+// Encodes image in the format given by the suffix of filename and writes it there, reporting both stages to log
+// and progress if given. PNGs that encodePng() takes are deflated on pool unless options turn that off; otherwise
+// QImageWriter encodes, with options' PNG level or lossy quality. The file is replaced only once it is completely
+// written, so failing or being cancelled leaves any previous file alone. Returns false and sets error on failure.
+bool
+saveImage(const QImage &image, const QString &filename, const SaveOptions &options, TilePool &pool, QString &error, StageLog *log = nullptr, Progress *progress = nullptr);
+
+// The files saveResult() writes for result as filename: filename itself, then those of the mip levels unless they go
+// into it.
+QStringList
+getWrittenFiles(const ComposeResult &result, const QString &filename);
+
+// Saves result.image and its mip levels as filename: DDS files, block-compressed as options say, hold the levels
+// themselves and are encoded on pool; any other format goes through saveImage() and saveMipLevels(). Reports like
+// saveImage().
+bool
+saveResult(const ComposeResult &result, const QString &filename, const SaveOptions &options, TilePool &pool, QString &error, StageLog *log = nullptr, Progress *progress = nullptr);
@@ -0,0 +1,20 @@
+# Include this from a project that links the engine library.
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+# the engine's PNG streaming links against Qt's zlib
+QT += zlib-private
+
+# the buffer pool reads the process's memory counters through psapi on Windows
+win32: LIBS += -lpsapi
+
+# the engine's build directory, wherever the including project sits in the tree
+win32:CONFIG(release, debug|release): ENGINE_DIR = $$shadowed($$PWD)/release
+else:win32:CONFIG(debug, debug|release): ENGINE_DIR = $$shadowed($$PWD)/debug
+else: ENGINE_DIR = $$shadowed($$PWD)
+
+LIBS += -L$$ENGINE_DIR -lrgba-compose-engine
+
+win32-g++|!win32: PRE_TARGETDEPS += $$ENGINE_DIR/librgba-compose-engine.a
+else: PRE_TARGETDEPS += $$ENGINE_DIR/rgba-compose-engine.lib
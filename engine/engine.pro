@@ -0,0 +1,57 @@
+TEMPLATE = lib
+TARGET = rgba-compose-engine
+
+QT       += core gui
+
+# zlib for streaming PNG; Qt's own, so there is no extra dependency
+QT       += zlib-private
+
+CONFIG += c++latest staticlib
+
+SOURCES += \
+    BlockCompress.cc \
+    BufferPool.cc \
+    compose.cc \
+    ComposeKernel.cc \
+    ComposeSimd.cc \
+    ComposeWide.cc \
+    DdsFile.cc \
+    ImageCache.cc \
+    MappedImage.cc \
+    MipChain.cc \
+    OutputIndex.cc \
+    PngEncoder.cc \
+    PngStrips.cc \
+    Preview.cc \
+    Progress.cc \
+    Resample.cc \
+    StageLog.cc \
+    StripIO.cc \
+    TilePool.cc
+
+HEADERS += \
+    BlockCompress.hh \
+    BlockFormat.hh \
+    BufferPool.hh \
+    compose.hh \
+    ComposeKernel.hh \
+    ComposeSimd.hh \
+    ComposeWide.hh \
+    CompositionSpec.hh \
+    DdsFile.hh \
+    ImageCache.hh \
+    InputSource.hh \
+    MappedImage.hh \
+    MipChain.hh \
+    OutputIndex.hh \
+    PngEncoder.hh \
+    PngStrips.hh \
+    Precision.hh \
+    Preview.hh \
+    Progress.hh \
+    Resample.hh \
+    ResizeMode.hh \
+    SaveOptions.hh \
+    StageLog.hh \
+    StripIO.hh \
+    TilePool.hh
@@ -0,0 +1,106 @@
+// Checks that inputs with the same bytes under different paths are decoded once when one composition reads them all.
+//
+// usage: duplicateInputs [rounds=50]
+//
+// Each round composes a PNG and two copies of it under other names, one per channel, through a new ImageCache on a
+// pool of four threads, so that all three are asked for at once, and counts the calls of its loader.
+
+#include "compose.hh"
+#include "CompositionSpec.hh"
+#include "ImageCache.hh"
+#include "TilePool.hh"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QImage>
+#include <QTemporaryDir>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+
+namespace
+{
+  const char *const inputFiles[] = {"a.png", "b.png", "c.png"};
+
+  bool
+  writeInputs(const QTemporaryDir &dir)
+  {
+    std::mt19937 rng(1);
+    QImage image(64, 64, QImage::Format_ARGB32);
+    for (int y = 0; y < image.height(); ++y)
+    {
+      uchar *row = image.scanLine(y);
+      for (qsizetype x = 0; x < image.bytesPerLine(); ++x)
+        row[x] = uchar(rng());
+    }
+
+    if (!image.save(dir.filePath(inputFiles[0])))
+      return false;
+    for (int i = 1; i < 3; ++i)
+      if (!QFile::copy(dir.filePath(inputFiles[0]), dir.filePath(inputFiles[i])))
+        return false;
+    return true;
+  }
+
+  CompositionSpec
+  makeSpec(const QTemporaryDir &dir)
+  {
+    CompositionSpec spec;
+    for (int c = 0; c < 3; ++c)
+    {
+      spec.channels[c].source = InputSource::Image;
+      spec.channels[c].filename = dir.filePath(inputFiles[c]);
+      spec.channels[c].inputChannel = c;
+    }
+    spec.channels[3].constant = 255;
+    return spec;
+  }
+
+  int
+  checkRound(int round, const CompositionSpec &spec, TilePool &pool)
+  {
+    std::atomic<int> decodes = 0;
+    ImageCache imageCache([&](const QString &filename, QString &error){
+      ++decodes;
+      return loadInputImage(filename, error);
+    }, std::numeric_limits<qint64>::max());
+
+    const ComposeResult result = compose(spec, pool, imageCache);
+    if (!result.ok())
+    {
+      std::printf("round %d: %s\n", round, qPrintable(result.errorText));
+      return 1;
+    }
+    if (decodes != 1)
+    {
+      std::printf("round %d: %d decodes of one file's bytes\n", round, int(decodes));
+      return 1;
+    }
+    return 0;
+  }
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  QCoreApplication app(argc, argv);
+  const int rounds = argc > 1 ? std::atoi(argv[1]) : 50;
+
+  QTemporaryDir dir;
+  if (!dir.isValid() || !writeInputs(dir))
+  {
+    std::printf("couldn't write the inputs\n");
+    return 1;
+  }
+
+  const CompositionSpec spec = makeSpec(dir);
+  TilePool pool(4);
+  int failures = 0;
+  for (int round = 0; round < rounds; ++round)
+    failures += checkRound(round, spec, pool);
+
+  std::printf("%d failures\n", failures);
+  return failures ? 1 : 0;
+}
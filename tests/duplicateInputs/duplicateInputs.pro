@@ -0,0 +1,11 @@
+QT       += core gui
+
+CONFIG += c++latest console testcase
+CONFIG -= app_bundle
+
+TARGET = duplicateInputs
+
+include(../../engine/engine.pri)
+
+SOURCES += \
+    duplicateInputs.cc
@@ -0,0 +1,198 @@
+// Checks that every vector merge path this CPU has writes exactly the pixels of the scalar ones.
+//
+// usage: simdMerge [specs=200]
+//
+// Random merge specs, over every width from 0 to 99 so that each path's tails are covered, go through each forced
+// instruction set and ComposeSimd::mergeScalar(); random lanes then go through ComposeKernel plans, 1 to 99 pixels
+// wide, with the vector path of each instruction set and with makePlan(useSimd = false). Merge sources are exactly
+// as wide as the row, so that reads past their end show up under a sanitizer.
+
+#include "ComposeKernel.hh"
+#include "ComposeSimd.hh"
+#include "TilePool.hh"
+
+#include <QImage>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <random>
+#include <vector>
+
+namespace
+{
+  using ComposeSimd::MergeSpec;
+
+  constexpr int maxWidth = 100;
+  const char *const isaNames[] = {"ssse3", "avx2"};
+
+  // as ComposeKernel builds them: each output byte from at most one source, constants and inversion in the others
+  MergeSpec
+  makeRandomSpec(std::mt19937 &rng)
+  {
+    MergeSpec spec;
+    spec.sourceCount = int(rng() % 5);
+    for (int s = 0; s < spec.sourceCount; ++s)
+    {
+      spec.planes[s] = rng() % 2;
+      for (quint8 &from : spec.shuffles[s])
+        from = MergeSpec::none;
+    }
+
+    for (int byte = 0; byte < 4; ++byte)
+    {
+      if (spec.sourceCount > 0 && rng() % 4 != 0)
+      {
+        const int s = int(rng() % unsigned(spec.sourceCount));
+        spec.shuffles[s][byte] = spec.planes[s] ? 0 : quint8(rng() % 4);
+      }
+      else
+        spec.orBits |= quint32(rng() % 256) << (byte * 8);
+
+      if (rng() % 2)
+        spec.xorBits |= 255u << (byte * 8);
+    }
+    return spec;
+  }
+
+  int
+  checkMergeFns(int specCount)
+  {
+    std::mt19937 rng(1);
+    int failures = 0;
+
+    for (int i = 0; i < specCount; ++i)
+    {
+      const MergeSpec spec = makeRandomSpec(rng);
+      for (int width = 0; width < maxWidth; ++width)
+      {
+        std::vector<uchar> sources[4];
+        const uchar *sourcePointers[4]{};
+        for (int s = 0; s < spec.sourceCount; ++s)
+        {
+          sources[s].resize(size_t(width) * (spec.planes[s] ? 1 : 4));
+          for (uchar &byte : sources[s])
+            byte = uchar(rng());
+          sourcePointers[s] = sources[s].data();
+        }
+
+        std::vector<quint32> expected(size_t(width) + 1, 0xdeadbeef);
+        ComposeSimd::mergeScalar(expected.data(), sourcePointers, spec, width);
+
+        for (const char *isa : isaNames)
+          if (const ComposeSimd::MergeFn mergeFn = ComposeSimd::getMergeFn(isa))
+          {
+            std::vector<quint32> actual(size_t(width) + 1, 0xdeadbeef);
+            mergeFn(actual.data(), sourcePointers, spec, width);
+            if (actual != expected)
+            {
+              std::printf("%s merge of spec %d differs from scalar at width %d\n", isa, i, width);
+              ++failures;
+            }
+          }
+      }
+    }
+    return failures;
+  }
+
+  QImage
+  makeNoise(QSize size, QImage::Format format, std::mt19937 &rng)
+  {
+    QImage image(size, format);
+    for (int y = 0; y < size.height(); ++y)
+    {
+      uchar *row = image.scanLine(y);
+      for (qsizetype x = 0; x < image.bytesPerLine(); ++x)
+        row[x] = uchar(rng());
+    }
+    return image;
+  }
+
+  bool
+  samePixels(const QImage &a, const QImage &b)
+  {
+    const qsizetype rowBytes = qsizetype(a.width()) * a.depth() / 8;
+    for (int y = 0; y < a.height(); ++y)
+      if (std::memcmp(a.constScanLine(y), b.constScanLine(y), size_t(rowBytes)) != 0)
+        return false;
+    return true;
+  }
+
+  QImage
+  compose(const ComposeKernel::Plan &plan)
+  {
+    QImage image(plan.size, plan.format);
+    image.fill(0x5a);
+    ComposeKernel::composeRows(plan, image.bits(), image.bytesPerLine(), 0, plan.size.height());
+    return image;
+  }
+
+  int
+  checkPlans(int specCount)
+  {
+    std::mt19937 rng(2);
+    TilePool pool(1);
+    int failures = 0;
+
+    const QImage::Format inputFormats[] = {QImage::Format_ARGB32, QImage::Format_Grayscale8, QImage::Format_RGB888, QImage::Format_RGBA8888};
+    const QImage::Format outputFormats[] = {QImage::Format_ARGB32, QImage::Format_RGB888, QImage::Format_RGBA8888};
+
+    // an image is at least a pixel wide
+    for (int i = 0; i < specCount; ++i)
+      for (int width = 1; width < maxWidth; ++width)
+      {
+        const QSize size(width, 3);
+        QImage images[2];
+        for (QImage &image : images)
+          image = makeNoise(size, inputFormats[rng() % std::size(inputFormats)], rng);
+
+        ComposeKernel::LaneSource lanes[4];
+        for (ComposeKernel::LaneSource &lane : lanes)
+        {
+          if (rng() % 4 != 0)
+          {
+            lane.image = images[rng() % 2];
+            lane.inputChannel = int(rng() % 4);
+            lane.invert = rng() % 2;
+          }
+          else
+            lane.constant = quint8(rng());
+        }
+        if (!ComposeKernel::prepareLanes(lanes, pool))
+        {
+          std::printf("couldn't prepare the lanes of plan %d at width %d\n", i, width);
+          return failures + 1;
+        }
+
+        const QImage::Format format = outputFormats[rng() % std::size(outputFormats)];
+        const QImage expected = compose(ComposeKernel::makePlan(size, lanes, format, false));
+
+        ComposeKernel::Plan plan = ComposeKernel::makePlan(size, lanes, format, true);
+        if (!plan.mergeFn)
+          continue; // solid, or no vector path at all
+        for (const char *isa : isaNames)
+          if ((plan.mergeFn = ComposeSimd::getMergeFn(isa)) && !samePixels(compose(plan), expected))
+          {
+            std::printf("%s plan %d differs from the scalar lanes at width %d\n", isa, i, width);
+            ++failures;
+          }
+      }
+    return failures;
+  }
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  const int specCount = argc > 1 ? std::atoi(argv[1]) : 200;
+
+  std::printf("vector paths:");
+  for (const char *isa : isaNames)
+    if (ComposeSimd::getMergeFn(isa))
+      std::printf(" %s", isa);
+  std::printf("\n");
+
+  const int failures = checkMergeFns(specCount) + checkPlans(specCount);
+  std::printf("%d failures\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,11 @@
+QT       += core gui
+
+CONFIG += c++latest console testcase
+CONFIG -= app_bundle
+
+TARGET = simdMerge
+
+include(../../engine/engine.pri)
+
+SOURCES += \
+    simdMerge.cc
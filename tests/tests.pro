@@ -0,0 +1,7 @@
+# Checks of the engine and the command line; run them with "make check".
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    duplicateInputs \
+    simdMerge \
+    watchManifest
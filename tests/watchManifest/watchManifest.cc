@@ -0,0 +1,160 @@
+// Checks that --watch follows a manifest that grows and shrinks while the command line's own job keeps going.
+//
+// usage: watchManifest [path to rgba-compose]
+//
+// Runs rgba-compose --watch on a manifest of one output plus an -o job, then rewrites the manifest with three
+// outputs, then with one again, and after each change edits inputs and checks from the program's output which
+// outputs it recomposes: the added ones, the -o job whenever its input changes, and never an output the manifest
+// dropped.
+
+#include <QColor>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QProcess>
+#include <QTemporaryDir>
+
+#include <algorithm>
+#include <cstdio>
+
+namespace
+{
+  constexpr int timeoutMs = 20000;
+
+  class Check
+  {
+  public:
+    // runs rgba-compose --watch on the files written so far
+    void
+    start(const QString &program)
+    {
+      process.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+      process.setWorkingDirectory(dir.path());
+      process.start(program, {"--manifest", "manifest.json", "--output", "cli.png", "--red", "d.png", "--watch", "--watch-delay", "200"});
+    }
+
+    ~Check()
+    {
+      process.kill();
+      process.waitForFinished();
+    }
+
+    QString
+    path(const QString &file) const
+    {
+      return dir.filePath(file);
+    }
+
+    void
+    writeImage(const QString &file, int size, QColor color) const
+    {
+      QImage image(size, size, QImage::Format_ARGB32);
+      image.fill(color);
+      image.save(path(file));
+    }
+
+    void
+    writeManifest(const QStringList &entries) const
+    {
+      QFile file(path("manifest.json"));
+      file.open(QIODevice::WriteOnly);
+      file.write(("[" + entries.join(", ") + "]").toUtf8());
+    }
+
+    // reads the program's output until a line contains text; false if it ends or times out first
+    bool
+    waitForLine(const QString &text)
+    {
+      return waitForLines({text});
+    }
+
+    // reads the program's output until each of texts has been in a line, in any order
+    bool
+    waitForLines(QStringList texts)
+    {
+      while (true)
+      {
+        while (process.canReadLine())
+        {
+          const QString line = QString::fromUtf8(process.readLine()).trimmed();
+          std::printf("  > %s\n", qPrintable(line));
+          texts.erase(std::remove_if(texts.begin(), texts.end(), [&](const QString &text){ return line.contains(text); }), texts.end());
+          if (texts.isEmpty())
+            return true;
+        }
+        if (process.state() != QProcess::Running || !process.waitForReadyRead(timeoutMs))
+          return false;
+      }
+    }
+
+    bool
+    isRunning() const
+    {
+      return process.state() == QProcess::Running;
+    }
+
+  private:
+    QTemporaryDir dir;
+    QProcess process;
+  };
+
+  QString
+  entry(const QString &output, const QString &input)
+  {
+    return QString("{\"output\": \"%1\", \"r\": \"%2\"}").arg(output, input);
+  }
+
+  // the line the program prints once it has written output, which comes after the line saying it will
+  QString
+  written(const QString &output)
+  {
+    return output + " (";
+  }
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  QCoreApplication app(argc, argv);
+  const QString program = argc > 1 ? QString(argv[1]) : QString(RGBA_COMPOSE_PATH);
+
+  int failures = 0;
+  const auto expect = [&](bool ok, const char *what){
+    std::printf("%s: %s\n", ok ? "ok" : "FAILED", what);
+    failures += !ok;
+  };
+
+  Check check;
+  check.writeImage("a.png", 4, Qt::red);
+  check.writeImage("b.png", 4, Qt::green);
+  check.writeImage("c.png", 4, Qt::blue);
+  check.writeImage("d.png", 4, Qt::white);
+  check.writeManifest({entry("out1.png", "a.png")});
+  check.start(program);
+  expect(check.waitForLine("Watching"), "first run composes the manifest and the -o job, then watches");
+
+  // growing past the jobs the manifest had
+  check.writeManifest({entry("out1.png", "a.png"), entry("out2.png", "b.png"), entry("out3.png", "c.png")});
+  expect(check.waitForLine("recomposing 2 outputs"), "a grown manifest composes the outputs it adds");
+  expect(check.waitForLines({written("out2.png"), written("out3.png")}), "the added outputs are composed");
+  expect(QFileInfo::exists(check.path("out2.png")) && QFileInfo::exists(check.path("out3.png")), "the added outputs are written");
+  check.writeImage("d.png", 5, Qt::gray);
+  expect(check.waitForLine("d.png changed; recomposing 1 outputs"), "the -o job still follows its input after the manifest grew");
+  expect(check.waitForLine(written("cli.png")), "the -o job is composed");
+
+  // shrinking back, with the one output left changed so that the program says when it has read the manifest
+  check.writeManifest({entry("out1.png", "b.png")});
+  expect(check.waitForLine("recomposing 1 outputs"), "a shrunk manifest composes the output it changed");
+  expect(check.waitForLine(written("out1.png")), "the changed output is composed");
+  const QDateTime out3Modified = QFileInfo(check.path("out3.png")).lastModified();
+  check.writeImage("c.png", 5, Qt::black);
+  check.writeImage("d.png", 6, Qt::darkGray);
+  expect(check.waitForLine("d.png changed; recomposing 1 outputs"), "an input of a dropped output changing recomposes only the -o job");
+  expect(check.waitForLine(written("cli.png")), "the -o job is composed");
+  expect(QFileInfo(check.path("out3.png")).lastModified() == out3Modified, "the dropped output isn't written again");
+
+  expect(check.isRunning(), "the program is still watching");
+  std::printf("%d failures\n", failures);
+  return failures ? 1 : 0;
+}
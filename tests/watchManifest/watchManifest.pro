@@ -0,0 +1,15 @@
+QT       += core gui
+
+CONFIG += c++latest console testcase
+CONFIG -= app_bundle
+
+TARGET = watchManifest
+
+# the program under test, from the app's build directory
+win32:CONFIG(release, debug|release): APP_DIR = $$shadowed($$PWD/../../app)/release
+else:win32:CONFIG(debug, debug|release): APP_DIR = $$shadowed($$PWD/../../app)/debug
+else: APP_DIR = $$shadowed($$PWD/../../app)
+DEFINES += RGBA_COMPOSE_PATH=\\\"$$APP_DIR/rgba-compose\\\"
+
+SOURCES += \
+    watchManifest.cc